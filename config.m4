@@ -20,6 +20,7 @@ if test "$PHP_SMBCW_WRAPPER" != "no"; then
   dnl PHP_CHECK_LIBRARY(smbclient, smbc_getFunctionOpen,
   dnl [
     PHP_ADD_LIBRARY_WITH_PATH(smbclient, $SMB_DIR, SMBCW_WRAPPER_SHARED_LIBADD)
+    PHP_ADD_LIBRARY(pthread, 1, SMBCW_WRAPPER_SHARED_LIBADD)
     AC_DEFINE(HAVE_SMBLIB,1,[ ])
   dnl ],[
   dnl   AC_MSG_ERROR([wrong smbclient version or lib not found])
@@ -27,6 +28,20 @@ if test "$PHP_SMBCW_WRAPPER" != "no"; then
   dnl   -L$SMB_DIR 
   dnl ])
 
+  PHP_CHECK_LIBRARY(smbclient, smbc_getFunctionReaddirPlus2,
+  [
+    AC_DEFINE(HAVE_SMBC_READDIRPLUS2,1,[Whether libsmbclient provides readdirplus2])
+  ],[],[
+    -L$SMB_DIR
+  ])
+
+  PHP_CHECK_LIBRARY(smbclient, smbc_getFunctionSplice,
+  [
+    AC_DEFINE(HAVE_SMBC_SPLICE,1,[Whether libsmbclient provides server-side copy])
+  ],[],[
+    -L$SMB_DIR
+  ])
+
   dnl PHP_ADD_LIBRARY_WITH_PATH(smbclient, $SMB_DIR, SMB_SHARED_LIBADD)
 
   dnl AC_DEFINE(HAVE_SMB, 1, [Whether you have smbclient installed])
@@ -36,6 +51,6 @@ if test "$PHP_SMBCW_WRAPPER" != "no"; then
   PHP_ADD_BUILD_DIR(smbcw)
 
   dnl PHP_NEW_EXTENSION(smbcw_wrapper, smbcw_wrapper.c smbcw/smbcw.c smbcw/smbcw_url.c smbcw/smbcw_descriptor.c smbcw/smbcw_connections.c, $ext_shared)
-  PHP_NEW_EXTENSION(smbcw_wrapper, smbcw_wrapper.c smbcw/smbcw.c smbcw/smbcw_url.c smbcw/smbcw_descriptor.c smbcw/smbcw_connections.c, $ext_shared, ,-D_FILE_OFFSET_BITS=64 -D_LARGEFILE64_SOURCE )
+  PHP_NEW_EXTENSION(smbcw_wrapper, smbcw_wrapper.c smbcw/smbcw.c smbcw/smbcw_url.c smbcw/smbcw_descriptor.c smbcw/smbcw_connections.c smbcw/smbcw_urlcache.c smbcw/smbcw_cache.c smbcw/smbcw_prefetch.c smbcw/smbcw_transfer.c smbcw/smbcw_async.c smbcw/smbcw_stats.c smbcw/smbcw_backend.c smbcw/smbcw_fake.c smbcw/smbcw_trace.c smbcw/smbcw_slowlog.c, $ext_shared, ,-D_FILE_OFFSET_BITS=64 -D_LARGEFILE64_SOURCE )
   dnl PHP_NEW_EXTENSION(smbcw_wrapper, smbcw_wrapper.c, $ext_shared)
 fi
@@ -4,10 +4,44 @@
 #define PHP_SMBCW_WRAPPER_VERSION "1.0"
 #define PHP_SMBCW_WRAPPER_EXTNAME "smbcw_wrapper"
 
+struct smbcw_async_queue;
+struct smbcw_completion;
+
+ZEND_BEGIN_MODULE_GLOBALS(smbcw)
+	/* Completion queue of the asynchronous calls of the request and the
+	   completions fetched from it which have not been returned yet */
+	struct smbcw_async_queue *async_queue;
+	struct smbcw_completion *async_done;
+	int async_done_count;
+	int async_done_size;
+ZEND_END_MODULE_GLOBALS(smbcw)
+
+#ifdef ZTS
+#define SMBCW_G(v) TSRMG(smbcw_globals_id, zend_smbcw_globals *, v)
+#else
+#define SMBCW_G(v) (smbcw_globals.v)
+#endif
+
 PHP_MINIT_FUNCTION(smbcw);
 PHP_MSHUTDOWN_FUNCTION(smbcw);
+PHP_RSHUTDOWN_FUNCTION(smbcw);
 PHP_MINFO_FUNCTION(smbcw);
 PHP_FUNCTION(smb_chmod);
+PHP_FUNCTION(smb_cache_stats);
+PHP_FUNCTION(smb_copy);
+PHP_FUNCTION(smb_async_open);
+PHP_FUNCTION(smb_async_read);
+PHP_FUNCTION(smb_async_write);
+PHP_FUNCTION(smb_async_stat);
+PHP_FUNCTION(smb_async_opendir);
+PHP_FUNCTION(smb_async_readdir);
+PHP_FUNCTION(smb_async_close);
+PHP_FUNCTION(smb_async_closedir);
+PHP_FUNCTION(smb_async_wait);
+PHP_FUNCTION(smb_async_fd);
+PHP_FUNCTION(smb_stat_many);
+PHP_FUNCTION(smb_stats);
+PHP_FUNCTION(smb_roundtrips);
 
 extern zend_module_entry smbcw_wrapper_module_entry;
 #define phpext_smbcw_wrapper_ptr &smbcw_wrapper_module_entry
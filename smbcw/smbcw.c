@@ -16,18 +16,33 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.*/
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <libsmbclient.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "smbcw.h"
 #include "smbcw_common.h"
 #include "smbcw_url.h"
 #include "smbcw_connections.h"
+#include "smbcw_backend.h"
 #include "smbcw_descriptor.h"
+#include "smbcw_urlcache.h"
+#include "smbcw_cache.h"
+#include "smbcw_prefetch.h"
+#include "smbcw_transfer.h"
+#include "smbcw_async.h"
+#include "smbcw_stats.h"
+#include "smbcw_trace.h"
+#include "smbcw_slowlog.h"
 
 
 /**
@@ -50,25 +65,64 @@ typedef struct {
 	int fd_check;
 	lp_smbcctx ctx;
 	lp_smbcfile file;  
+	/* smbc filename and open flags the file has been opened with */
+	char *filename;
+	int flags;
+	/* Read-ahead buffer. The server side file pointer is ahead of the position
+	   seen by the user by rbuf_len - rbuf_pos bytes. */
+	char *rbuf;
+	size_t rbuf_size;
+	size_t rbuf_pos;
+	size_t rbuf_len;
+	/* Number of reads since the file has been opened or seeked and number of
+	   times the read-ahead buffer has been filled since then */
+	int seq_reads;
+	int ra_fills;
+	/* Background reader of files read sequentially, see smbcw_prefetch.h */
+	lp_smbcw_prefetch prefetch;
+	int prefetch_failed;
+	/* Write-behind buffer, holds wbuf_len bytes which have not been sent to the
+	   server yet. A wbuf_size of 0 means every write goes to the server. */
+	char *wbuf;
+	size_t wbuf_size;
+	size_t wbuf_len;
+	/* Whether smbcw_readdirplus gets the attributes along with the names (1) or
+	   has to stat every entry (-1), 0 until the first entry has been read */
+	int readdir_plus;
 } smbcw_file;
 
 typedef smbcw_file *lp_smbcw_file;
 
+/**
+ * Size of the write-behind buffer of newly opened files, 0 disables buffering
+ */
+size_t smbcw_write_buffer_size = DEFAULT_WRITE_BUFFER_SIZE;
+
 
-int smbcw_create_file_desc(lp_smbcctx ctx, lp_smbcfile file, lp_smbcw_file *file_desc)
+int smbcw_create_file_desc(lp_smbcctx ctx, lp_smbcfile file, const char *filename,
+	int flags, lp_smbcw_file *file_desc)
 {
 	lp_smbcw_file desc = malloc(sizeof(*desc));
+	memset(desc, 0, sizeof(*desc));
 
 	//Fill the descriptor with the stuff passed as function parameters
 	desc->fd_check = FD_STRUCT_VAL;
 	desc->ctx = ctx;
 	desc->file = file;	
+	desc->filename = strdup(filename);
+	desc->flags = flags;
+	if ((flags & O_ACCMODE) != O_RDONLY)
+		desc->wbuf_size = smbcw_write_buffer_size;
 
 	//Register the descriptor
 	int id = smbcw_gen_id(desc);
 
 	if (id > 0)
 	{
+		//Pin the descriptor to the context, which stays checked out for the
+		//calling thread until the descriptor is closed
+		connections_checkout_ctx(ctx);
+		stats_fd_opened();
 
 		//Set the output parameter
 		if (file_desc)
@@ -76,11 +130,159 @@ int smbcw_create_file_desc(lp_smbcctx ctx, lp_smbcfile file, lp_smbcw_file *file
 
 		return id;
 	} else {
+		free(desc->filename);
+		free(desc);
 		return 0;
 	}
 }
 
-int smbcw_errno = 0;
+/**
+ * Frees the memory used by a file descriptor created by smbcw_create_file_desc
+ */
+void smbcw_free_file_desc(lp_smbcw_file desc)
+{
+	//Make sure a stale pointer is not accepted as descriptor anymore
+	desc->fd_check = 0;
+
+	if (desc->prefetch)
+		prefetch_stop(desc->prefetch);
+
+	free(desc->rbuf);
+	free(desc->wbuf);
+	free(desc->filename);
+	free(desc);
+
+	stats_fd_closed();
+}
+
+/**
+ * Error code of the last smbcw call of the calling thread, see smbcw_geterr
+ */
+__thread int smbcw_errno = 0;
+
+/**
+ * Passes a call which took ns nanoseconds to the slow log. Calls on descriptors
+ * are logged with the file name of the descriptor, which is unknown once it has
+ * been closed.
+ */
+static void smbcw_slowlog(int op, int host, uint64_t ns, int64_t ret,
+	const t_trace_call *call)
+{
+	const char *url = call->url;
+
+	if (!url && call->fd > 0) {
+		lp_smbcw_file pfd = smbcw_get_ptr(call->fd);
+		if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+			url = pfd->filename;
+	}
+
+	slowlog_record(op, ns, ret, smbcw_errno, url, host);
+}
+
+/**
+ * Set while the statistics, the round trip log, the trace or the slow log need
+ * the duration of the calls, so that the _STATS macros read the clock only then.
+ * Updated by smbcw_update_clock whenever one of them is switched on or off.
+ */
+static int smbcw_clock_enabled = 0;
+
+/**
+ * Serializes smbcw_update_clock, so that the last update sees all settings
+ */
+static pthread_mutex_t smbcw_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Recomputes smbcw_clock_enabled from the settings
+ */
+static void smbcw_update_clock()
+{
+	pthread_mutex_lock(&smbcw_clock_lock);
+	__atomic_store_n(&smbcw_clock_enabled,
+		__atomic_load_n(&stats_enabled, __ATOMIC_RELAXED) ||
+		__atomic_load_n(&stats_log_fd, __ATOMIC_RELAXED) >= 0 ||
+		__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) ||
+		__atomic_load_n(&slowlog_min_ns, __ATOMIC_RELAXED) != UINT64_MAX,
+		__ATOMIC_RELAXED);
+	pthread_mutex_unlock(&smbcw_clock_lock);
+}
+
+/**
+ * Latency recording of the public functions. _STATS_BEGIN declares the start time,
+ * operation, host and backend calls so far locally, _STATS_HOST sets the host once
+ * the context is known and the _RETURN macros record the call. Functions without
+ * _STATS_BEGIN see the file scope defaults below, for which nothing is recorded.
+ * The _TRACE macros store the arguments written to the trace, see smbcw_trace.h.
+ */
+static const uint64_t _stats_start = 0;
+static const int _stats_op = -1;
+static const int _stats_host = 0;
+static const uint64_t _stats_trips = 0;
+static const t_trace_call _trace = {NULL, NULL, NULL, -1, 0, 0, 0};
+
+/**
+ * Calls on a descriptor hold it locked while they use it, see smbcw_lock_ptr, so
+ * several threads may share a descriptor. _LOCK_FD declares pfd as the locked
+ * descriptor of fd, NULL if there is none. The _RETURN macros release the lock
+ * once the call has been recorded, as the slow log reads the file name of the
+ * descriptor. Functions without _LOCK_FD see the defaults below.
+ */
+static const int _fd_locked = 0;
+static const int _fd_locked2 = 0;
+
+#define _LOCK_FD(fd)\
+lp_smbcw_file pfd = smbcw_lock_ptr(fd);\
+int _fd_locked = pfd ? fd : 0;
+
+#define _UNLOCK_FD \
+if (_fd_locked) {\
+	if (_fd_locked2)\
+		smbcw_unlock_ptr2(_fd_locked, _fd_locked2);\
+	else\
+		smbcw_unlock_ptr(_fd_locked);\
+}
+
+#define _STATS_BEGIN(op)\
+uint64_t _stats_start = __atomic_load_n(&smbcw_clock_enabled, __ATOMIC_RELAXED) ?\
+	stats_clock() : 0;\
+int _stats_op = op;\
+int _stats_host = 0;\
+uint64_t _stats_trips = backend_round_trips;\
+t_trace_call _trace = {NULL, NULL, NULL, -1, 0, 0, 0};\
+if (_stats_start)\
+	trace_depth++;
+
+#define _STATS_HOST(ctx)\
+if (_stats_start)\
+	_stats_host = connections_host_id(ctx);
+
+#define _STATS_END(ret)\
+if (_stats_start) {\
+	uint64_t _stats_ns = stats_clock() - _stats_start;\
+	if (__atomic_load_n(&stats_enabled, __ATOMIC_RELAXED))\
+		stats_record(_stats_op, _stats_host, _stats_ns, ret,\
+			backend_round_trips - _stats_trips);\
+	if (__atomic_load_n(&stats_log_fd, __ATOMIC_RELAXED) >= 0)\
+		stats_log(_stats_op, _stats_host, _stats_ns, ret,\
+			backend_round_trips - _stats_trips);\
+	trace_depth--;\
+	if (__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED))\
+		trace_record(_stats_op, _stats_start, _stats_ns, ret, smbcw_errno, &_trace);\
+	if (_stats_ns >= __atomic_load_n(&slowlog_min_ns, __ATOMIC_RELAXED) &&\
+		trace_depth == 0)\
+		smbcw_slowlog(_stats_op, _stats_host, _stats_ns, ret, &_trace);\
+}
+
+#define _TRACE_URL(u1, u2)\
+_trace.url = u1;\
+_trace.url2 = u2;
+
+#define _TRACE_FD(d, sz, off)\
+_trace.fd = d;\
+_trace.size = sz;\
+_trace.offset = off;
+
+#define _TRACE_FLAGS(f)\
+_trace.flags = f;
 
 #define _RETURN(cmd)\
 {\
@@ -89,12 +291,28 @@ if (_retval1 < 0)\
 	smbcw_errno = errno;\
 else\
 	smbcw_errno = 0;\
+_STATS_END(_retval1);\
+_UNLOCK_FD;\
+return _retval1;\
+}
+
+#define _RETURN64(cmd)\
+{\
+int64_t _retval1 = cmd;\
+if (_retval1 < 0)\
+	smbcw_errno = errno;\
+else\
+	smbcw_errno = 0;\
+_STATS_END(_retval1);\
+_UNLOCK_FD;\
 return _retval1;\
 }
 
 #define _RETURN_ERR(err)\
 {\
 	smbcw_errno = err;\
+	_STATS_END(-1);\
+	_UNLOCK_FD;\
 	return -1;\
 }
 
@@ -119,7 +337,8 @@ lp_smbcw_url smbcw_check_url(char *url)
 /**
  * Checks whether the given url is valid, and if yes, obtains a SMBCW context
  * for the given URL an returns it. Returns NULL if any error occurs. In this case
- * url_out will also be set to NULL and any reserved memory will be freed.
+ * url_out will also be set to NULL and any reserved memory will be freed. The
+ * context is returned with a reference added, see connections_get_ctx.
  */
 lp_smbcctx smbcw_get_url_context(char *url, lp_smbcw_url *url_out)
 {
@@ -158,6 +377,211 @@ lp_smbcctx smbcw_get_url_context(char *url, lp_smbcw_url *url_out)
 	return NULL;
 }
 
+/**
+ * Size of the reads issued for files read sequentially, 0 disables read-ahead
+ */
+size_t smbcw_read_ahead_size = DEFAULT_READ_AHEAD_SIZE;
+
+/**
+ * Number of read-ahead sized blocks the prefetch thread keeps ahead of the reader,
+ * 0 disables prefetching
+ */
+int smbcw_prefetch_blocks = 0;
+
+/**
+ * Mode used by smbcw_urlstat
+ */
+int smbcw_stat_mode = SMBCW_STAT_PROBE;
+
+/**
+ * Result of the access probe of smbcw_urlstat for the files (index 0) and the
+ * directories (index 1) inside of one directory
+ */
+typedef struct {
+	int known[2];
+	uint32_t clear[2];
+} smbcw_probe_result;
+
+typedef smbcw_probe_result *lp_smbcw_probe_result;
+
+/**
+ * Cache of the probe results, keyed by context and parent directory
+ */
+t_smbcw_cache smbcw_probe_cache;
+
+/**
+ * Stat of a file as returned by smbcw_urlstat. If probed is not set, the
+ * permissions are the ones reported by the server. Entries of a directory
+ * listing are marked as listed and returned without probe while they are
+ * cached.
+ */
+typedef struct {
+	smbcw_stat stat;
+	int probed;
+	int listed;
+} smbcw_stat_entry;
+
+typedef smbcw_stat_entry *lp_smbcw_stat_entry;
+
+/**
+ * Metadata cache, keyed by context and smbc filename without trailing slashes
+ */
+t_smbcw_cache smbcw_stat_cache;
+
+/**
+ * Negative lookup cache, stores the error code (ENOENT) smbcw_urlstat got for
+ * files which do not exist. Keyed like the metadata cache.
+ */
+t_smbcw_cache smbcw_neg_cache;
+
+/**
+ * Resolves the given url to the context connections_get_ctx returns for it and the
+ * smbc filename belonging to it. Repeated calls for the same url are served by the
+ * url cache. Returns NULL if the url is invalid or no context could be obtained.
+ * The context of the returned entry is referenced, so no other thread can close
+ * it. The reference has to be removed with connections_unref_ctx and the entry
+ * has to be released with urlcache_release.
+ */
+lp_smbcw_urlcache_entry smbcw_lookup_url(char *url)
+{
+	lp_smbcw_urlcache_entry entry = urlcache_get(url);
+
+	if (entry)
+		return entry;
+
+	lp_smbcw_url checked_url;
+	lp_smbcctx ctx = smbcw_get_url_context(url, &checked_url);
+
+	if (ctx) {
+		//Assemble the filename smbc expects and remember it along with the context
+		char *fn = smbcw_url_gen_filename(checked_url);
+
+		if (fn) {
+			entry = urlcache_put(url, ctx, fn);
+			free(fn);
+		}
+
+		//Keep the reference of connections_get_ctx for the caller
+		if (!entry)
+			connections_unref_ctx(ctx);
+
+		smbcw_url_free(checked_url);
+	}
+
+	return entry;
+}
+
+/**
+ * Resolves the given url like smbcw_lookup_url and checks out a context of its
+ * pool for the calling thread, which is stored in ctx. Returns NULL if the url
+ * could not be resolved or no context is available. The returned entry has to be
+ * released with smbcw_release_url.
+ */
+lp_smbcw_urlcache_entry smbcw_resolve_url(char *url, lp_smbcctx *ctx)
+{
+	lp_smbcw_urlcache_entry entry = smbcw_lookup_url(url);
+
+	if (entry) {
+		//The checkout keeps the pool open from now on
+		*ctx = connections_checkout_ctx(entry->ctx);
+		int err = errno;
+		connections_unref_ctx(entry->ctx);
+
+		if (!*ctx) {
+			urlcache_release(entry);
+			errno = err;
+			return NULL;
+		}
+	}
+
+	return entry;
+}
+
+/**
+ * Releases an url resolved by smbcw_resolve_url and checks its context back in
+ */
+void smbcw_release_url(lp_smbcw_urlcache_entry entry, lp_smbcctx ctx)
+{
+	if (entry) {
+		connections_checkin_ctx(ctx);
+		urlcache_release(entry);
+	}
+}
+
+/**
+ * Called by the connection manager right before a context is freed
+ */
+void smbcw_ctx_freed(lp_smbcctx ctx)
+{
+	urlcache_invalidate_ctx(ctx);
+	cache_invalidate_ctx(&smbcw_probe_cache, ctx);
+	cache_invalidate_ctx(&smbcw_stat_cache, ctx);
+	cache_invalidate_ctx(&smbcw_neg_cache, ctx);
+}
+
+/**
+ * Returns the length of the given smbc filename without trailing slashes, which
+ * is the part used as key of the metadata cache.
+ */
+size_t smbcw_path_len(const char *fn)
+{
+	size_t len = strlen(fn);
+
+	while (len > 0 && fn[len - 1] == '/')
+		len--;
+
+	return len;
+}
+
+/**
+ * Returns the length of the parent directory part of the given smbc filename,
+ * including the trailing slash.
+ */
+size_t smbcw_parent_len(const char *fn)
+{
+	size_t len = smbcw_path_len(fn);
+
+	while (len > 0 && fn[len - 1] != '/')
+		len--;
+
+	return len;
+}
+
+/**
+ * Drops the cached metadata of the given file and its parent directory, has to be
+ * called whenever the file is modified through smbcw.
+ */
+void smbcw_invalidate_path(lp_smbcctx ctx, const char *fn)
+{
+	size_t parent_len = smbcw_parent_len(fn);
+
+	//All contexts of a pool share the cached data
+	ctx = connections_pool_ctx(ctx);
+
+	cache_remove(&smbcw_stat_cache, ctx, fn, smbcw_path_len(fn));
+	cache_remove(&smbcw_neg_cache, ctx, fn, smbcw_path_len(fn));
+
+	//The parent directory is stored without trailing slash as well
+	if (parent_len > 0)
+		cache_remove(&smbcw_stat_cache, ctx, fn, parent_len - 1);
+}
+
+/**
+ * Like smbcw_invalidate_path, but also drops everything cached below fn. Has to
+ * be called when a directory is renamed or removed.
+ */
+void smbcw_invalidate_tree(lp_smbcctx ctx, const char *fn)
+{
+	size_t len = smbcw_path_len(fn);
+
+	smbcw_invalidate_path(ctx, fn);
+
+	ctx = connections_pool_ctx(ctx);
+	cache_invalidate_prefix(&smbcw_stat_cache, ctx, fn, len);
+	cache_invalidate_prefix(&smbcw_neg_cache, ctx, fn, len);
+	cache_invalidate_prefix(&smbcw_probe_cache, ctx, fn, len);
+}
+
 
 
 /* SMBCW Initialization/Finalization functions */
@@ -179,7 +603,25 @@ int smbcw_init()
 {
 	//Initialize the smbcw connection manager
 	connections_init();
+	connections_set_free_callback(&smbcw_ctx_freed);
+
+	//Enable the url cache
+	urlcache_set_size(DEFAULT_URL_CACHE_SIZE);
 
+	//Prepare the metadata cache
+	cache_init(&smbcw_stat_cache, sizeof(smbcw_stat_entry), NULL);
+	cache_configure(&smbcw_stat_cache, DEFAULT_STAT_CACHE_SIZE,
+		DEFAULT_STAT_CACHE_TTL);
+
+	//Prepare the cache for the access probe of smbcw_urlstat
+	cache_init(&smbcw_probe_cache, sizeof(smbcw_probe_result), NULL);
+	cache_configure(&smbcw_probe_cache, DEFAULT_PROBE_CACHE_SIZE,
+		DEFAULT_PROBE_CACHE_TTL);
+
+	//Prepare the negative lookup cache
+	cache_init(&smbcw_neg_cache, sizeof(int), NULL);
+	cache_configure(&smbcw_neg_cache, DEFAULT_NEG_CACHE_SIZE,
+		DEFAULT_NEG_CACHE_TTL);
 
 	/*smbc_init is only needed if we would be using the deprecated compatibility
 	  layer provided in libsmb_compat.h
@@ -190,10 +632,93 @@ int smbcw_init()
 	_RETURN(0);
 }
 
+void smbcw_set_context_limits(int max_contexts, int idle_timeout)
+{
+	connections_set_limits(max_contexts, idle_timeout);
+}
+
+void smbcw_set_pool(int size, int wait)
+{
+	connections_set_pool(size, wait);
+}
+
+void smbcw_set_url_cache_size(int size)
+{
+	urlcache_set_size(size);
+}
+
+void smbcw_set_stat_mode(int mode)
+{
+	if (mode == SMBCW_STAT_PROBE || mode == SMBCW_STAT_FAST ||
+			mode == SMBCW_STAT_CACHED)
+		smbcw_stat_mode = mode;
+}
+
+void smbcw_set_probe_cache_ttl(int ttl)
+{
+	cache_configure(&smbcw_probe_cache, DEFAULT_PROBE_CACHE_SIZE, ttl);
+}
+
+void smbcw_set_stat_cache(int size, int ttl)
+{
+	cache_configure(&smbcw_stat_cache, size, ttl);
+}
+
+void smbcw_set_read_ahead(int64_t size)
+{
+	smbcw_read_ahead_size = size > 0 ? size : 0;
+}
+
+void smbcw_set_write_buffer_size(int64_t size)
+{
+	smbcw_write_buffer_size = size > 0 ? size : 0;
+}
+
+void smbcw_set_prefetch(int blocks)
+{
+	smbcw_prefetch_blocks = blocks > 0 ? blocks : 0;
+}
+
+void smbcw_set_negative_cache(int size, int ttl)
+{
+	cache_configure(&smbcw_neg_cache, size, ttl);
+}
+
+void smbcw_clear_stat_cache()
+{
+	cache_clear(&smbcw_stat_cache);
+	cache_clear(&smbcw_probe_cache);
+	cache_clear(&smbcw_neg_cache);
+}
+
+int smbcw_set_backend(int backend)
+{
+	_RETURN(backend_select(backend));
+}
+
 void smbcw_finalize()
 {
+	//Stop the workers of the asynchronous calls, which still use the connections
+	async_finalize();
+
+	//The calls of the workers are part of the trace
+	trace_stop();
+	smbcw_update_clock();
+
 	//Finalize all connections
 	connections_finalize();
+
+	//Drop all cached urls, probe results and metadata
+	urlcache_finalize();
+	cache_finalize(&smbcw_probe_cache);
+	cache_finalize(&smbcw_stat_cache);
+	cache_finalize(&smbcw_neg_cache);
+
+	//Release the descriptor table
+	smbcw_free_all_ids();
+
+	//Drop the recorded latencies
+	stats_finalize();
 }
 
 
@@ -250,38 +775,78 @@ int smbcw_assembleflags(char *mode)
 	return flags;
 }
 
+/**
+ * Sends the content of the write-behind buffer to the server. Has to be called
+ * before the file pointer is used for anything but writing. Returns -1 if not
+ * all data could be written, the buffer is emptied in any case.
+ */
+int smbcw_flush_write_buffer(lp_smbcw_file pfd)
+{
+	size_t done = 0;
+
+	if (pfd->wbuf_len == 0)
+		return 0;
+
+	smbc_write_fn write_fn = backend_active->get_write(pfd->ctx);
+
+	while (write_fn && done < pfd->wbuf_len)
+	{
+		ssize_t count = write_fn(pfd->ctx, pfd->file, pfd->wbuf + done,
+			pfd->wbuf_len - done);
+
+		if (count <= 0) {
+			if (count == 0)
+				errno = EIO;
+			break;
+		}
+
+		done += count;
+	}
+
+	//The size might have changed once more
+	smbcw_invalidate_path(pfd->ctx, pfd->filename);
+
+	int ret = (done == pfd->wbuf_len) ? 0 : -1;
+	pfd->wbuf_len = 0;
+
+	return ret;
+}
+
 int smbcw_fopen(char *url, char *mode)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_OPEN);
+	_TRACE_URL(url, NULL);
+	_trace.mode = mode;
 
-	lp_smbcw_url url_desc;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &url_desc);
-	if (ctx)
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
+	if (res)
 	{
-		smbc_open_fn open_fn = smbc_getFunctionOpen(ctx);
+		_STATS_HOST(ctx);
+
+		smbc_open_fn open_fn = backend_active->get_open(ctx);
 
 		if (open_fn)
 		{
 			//Assemble the flag parameter from the mode string
 			int flags = smbcw_assembleflags(mode);
 
+			//Opening a file for writing might create or truncate it
+			if (flags >= 0 && (flags & (O_WRONLY | O_RDWR)))
+				smbcw_invalidate_path(ctx, res->filename);
+
 			if (flags >= 0)
 			{
-				//Assemble the filename smbc should open
-				char *fn = smbcw_url_gen_filename(url_desc);
-
 				//Obtain a pointer on the smbc file construct
-				lp_smbcfile file = open_fn(ctx, fn, flags, 0);
-
-				//Free the filename string again
-				free(fn);
+				lp_smbcfile file = open_fn(ctx, res->filename, flags, 0);
 
 				if (file)
 				{
 					//Create the file descriptor which will be returned to the user of the
 					//library
-					int id = smbcw_create_file_desc(ctx, file, NULL);
+					int id = smbcw_create_file_desc(ctx, file, res->filename, flags, NULL);
 
 					if (id > 0)
 					{
@@ -289,15 +854,15 @@ int smbcw_fopen(char *url, char *mode)
 					} else {
 						//The context couldn't be created for whatever reason. Close the file
 						//descriptor again.
-						smbc_close_fn close_fn = smbc_getFunctionClose(ctx);
+						smbc_close_fn close_fn = backend_active->get_close(ctx);
 						close_fn(ctx, file);
 					}
 				}
 			}
-
-			//Free the url_descriptor
-			smbcw_url_free(url_desc);
 		}
+
+		//Release the resolved url
+		smbcw_release_url(res, ctx);
 	}
 
 	_RETURN(ret);
@@ -307,176 +872,1106 @@ int smbcw_fclose(int fd)
 {
 	errno = EINVAL;
 	int ret = -1;
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
+	_STATS_BEGIN(SMBCW_OP_CLOSE);
+	_TRACE_FD(fd, 0, 0);
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
 	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
 	{
+		_STATS_HOST(pfd->ctx);
+
 		//Obtain the close function pointer
-		smbc_close_fn close_fn = smbc_getFunctionClose(pfd->ctx);
-		if (close_fn)
+		smbc_close_fn close_fn = backend_active->get_close(pfd->ctx);
+
+		//Remove the fd from the descriptor list first, only the thread which
+		//removed it closes and frees the file
+		if (close_fn && smbcw_free_id(fd))
 		{
+			//Send buffered data first, a failure is reported by the close
+			int flushed = smbcw_flush_write_buffer(pfd);
+			int err = errno;
+
 			//Close the file
 			ret = close_fn(pfd->ctx, pfd->file);
 
-			//Free the memory reserved for the file descriptor
-			free(pfd);
+			if (flushed < 0) {
+				errno = err;
+				ret = -1;
+			}
+
+			//The server might update the metadata of written files on close
+			if (pfd->flags & (O_WRONLY | O_RDWR))
+				smbcw_invalidate_path(pfd->ctx, pfd->filename);
+
+			//Allow the context to be used by other threads or closed again
+			connections_checkin_ctx(pfd->ctx);
 
-			//Remove the fd from the descriptor list
-			smbcw_free_id(fd);
+			//Free the memory reserved for the file descriptor
+			smbcw_free_file_desc(pfd);
 		}
 	}
 
 	 _RETURN(ret);
 }
 
-int64_t smbcw_fread(int fd, char *buf, uint64_t size)
+/**
+ * Drops the content of the read-ahead buffer and moves the server side file
+ * pointer back to the position seen by the user. Has to be called before the file
+ * pointer is used for anything but reading. Returns -1 if the file pointer could
+ * not be restored.
+ */
+int smbcw_discard_read_ahead(lp_smbcw_file pfd)
 {
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
-	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
-	{
-		//Obtain the read function pointer
-		smbc_read_fn read_fn = smbc_getFunctionRead(pfd->ctx);
+	off_t ahead = pfd->rbuf_len - pfd->rbuf_pos;
 
-		if (read_fn)
-		{
-			//Read from the file
-			_RETURN(read_fn(pfd->ctx, pfd->file, buf, size));
-		}
-	}
+	pfd->rbuf_pos = 0;
+	pfd->rbuf_len = 0;
+	pfd->seq_reads = 0;
+	pfd->ra_fills = 0;
 
-	_RETURN_ERR(EINVAL);
-}
+	//The prefetch thread reads through its own file handle, ours is still at the
+	//position it has been started at
+	if (pfd->prefetch)
+	{
+		int64_t offset = prefetch_tell(pfd->prefetch);
+		smbc_lseek_fn lseek_fn = backend_active->get_lseek(pfd->ctx);
 
-int64_t smbcw_fwrite(int fd, char *buf, uint64_t size)
-{
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
-	if (pfd && pfd->fd_check == FD_STRUCT_VAL) {
+		prefetch_stop(pfd->prefetch);
+		pfd->prefetch = NULL;
 
-		//Obtain the write function pointer
-		smbc_write_fn write_fn = smbc_getFunctionWrite(pfd->ctx);
+		if (!lseek_fn || lseek_fn(pfd->ctx, pfd->file, offset, SEEK_SET) < 0)
+			return -1;
+	}
+	else if (ahead > 0)
+	{
+		smbc_lseek_fn lseek_fn = backend_active->get_lseek(pfd->ctx);
 
-		//Write to the file
-		_RETURN(write_fn(pfd->ctx, pfd->file, buf, size));
+		if (!lseek_fn || lseek_fn(pfd->ctx, pfd->file, -ahead, SEEK_CUR) < 0)
+			return -1;
 	}
 
-	_RETURN_ERR(EINVAL);
+	return 0;
 }
 
-int64_t smbcw_fseek(int fd, int64_t offset, int whence)
+/**
+ * Copies up to size bytes from the read-ahead buffer to buf and returns the number
+ * of bytes copied.
+ */
+size_t smbcw_copy_read_ahead(lp_smbcw_file pfd, char *buf, uint64_t size)
 {
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
-	if (pfd && pfd->fd_check == FD_STRUCT_VAL) {
-		//Obtain the seek function pointer
-		smbc_lseek_fn lseek_fn = smbc_getFunctionLseek(pfd->ctx);
+	size_t count = pfd->rbuf_len - pfd->rbuf_pos;
+	if (count > size)
+		count = size;
 
-		//Write to the file
-		_RETURN(lseek_fn(pfd->ctx, pfd->file, offset, whence));
-	}
+	memcpy(buf, pfd->rbuf + pfd->rbuf_pos, count);
+	pfd->rbuf_pos += count;
 
-	_RETURN_ERR(EINVAL);
+	return count;
 }
 
-int smbcw_fstat(int fd, smbcw_stat *stat)
+int64_t smbcw_fread(int fd, char *buf, uint64_t size)
+{
+	_STATS_BEGIN(SMBCW_OP_READ);
+	_TRACE_FD(fd, size, 0);
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+	{
+		_STATS_HOST(pfd->ctx);
+
+		//Serve the read from the read-ahead buffer
+		if (pfd->rbuf_pos < pfd->rbuf_len)
+			_RETURN64(smbcw_copy_read_ahead(pfd, buf, size));
+
+		//Read what has been written before
+		if (smbcw_flush_write_buffer(pfd) < 0)
+			_RETURN64(-1);
+
+		//Once the file has proven to be larger than one read-ahead block, read
+		//the following blocks in the background
+		if (!pfd->prefetch && pfd->ra_fills > 0 && smbcw_prefetch_blocks > 0 &&
+			!pfd->prefetch_failed && (pfd->flags & O_ACCMODE) == O_RDONLY)
+		{
+			smbc_lseek_fn lseek_fn = backend_active->get_lseek(pfd->ctx);
+			int64_t offset = lseek_fn ? lseek_fn(pfd->ctx, pfd->file, 0, SEEK_CUR) : -1;
+
+			if (offset >= 0)
+				pfd->prefetch = prefetch_start(pfd->ctx, pfd->filename, offset,
+					smbcw_prefetch_blocks, smbcw_read_ahead_size);
+
+			//Do not try again for this file if that failed
+			pfd->prefetch_failed = pfd->prefetch ? 0 : 1;
+		}
+
+		if (pfd->prefetch)
+			_RETURN64(prefetch_read(pfd->prefetch, buf, size));
+
+		//Obtain the read function pointer
+		smbc_read_fn read_fn = backend_active->get_read(pfd->ctx);
+
+		if (read_fn)
+		{
+			size_t ra_size = smbcw_read_ahead_size;
+
+			//The first read after opening or seeking might be all the caller wants,
+			//read ahead as soon as the file is read sequentially
+			pfd->seq_reads++;
+
+			if (pfd->seq_reads > 1 && size < ra_size)
+			{
+				//The read-ahead size might have been changed since the last time
+				if (pfd->rbuf_size != ra_size)
+				{
+					free(pfd->rbuf);
+					pfd->rbuf = malloc(ra_size);
+					pfd->rbuf_size = pfd->rbuf ? ra_size : 0;
+				}
+
+				if (pfd->rbuf)
+				{
+					ssize_t count = read_fn(pfd->ctx, pfd->file, pfd->rbuf, ra_size);
+					if (count <= 0)
+						_RETURN64(count);
+
+					pfd->rbuf_pos = 0;
+					pfd->rbuf_len = count;
+					pfd->ra_fills++;
+
+					_RETURN64(smbcw_copy_read_ahead(pfd, buf, size));
+				}
+			}
+
+			//Read from the file
+			_RETURN64(read_fn(pfd->ctx, pfd->file, buf, size));
+		}
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+int64_t smbcw_fwrite(int fd, char *buf, uint64_t size)
+{
+	_STATS_BEGIN(SMBCW_OP_WRITE);
+	_TRACE_FD(fd, size, 0);
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL) {
+		_STATS_HOST(pfd->ctx);
+
+		//Obtain the write function pointer
+		smbc_write_fn write_fn = backend_active->get_write(pfd->ctx);
+
+		//Write at the position seen by the user, not behind the read-ahead buffer
+		if (smbcw_discard_read_ahead(pfd) < 0)
+			_RETURN64(-1);
+
+		//Size and modification time are about to change
+		smbcw_invalidate_path(pfd->ctx, pfd->filename);
+
+		//Collect small writes in the write-behind buffer
+		if (size < pfd->wbuf_size)
+		{
+			if (pfd->wbuf_len + size > pfd->wbuf_size &&
+				smbcw_flush_write_buffer(pfd) < 0)
+				_RETURN64(-1);
+
+			if (!pfd->wbuf)
+				pfd->wbuf = malloc(pfd->wbuf_size);
+
+			if (pfd->wbuf)
+			{
+				memcpy(pfd->wbuf + pfd->wbuf_len, buf, size);
+				pfd->wbuf_len += size;
+				_RETURN64(size);
+			}
+		}
+
+		//Larger writes go to the server right away, after what has been buffered
+		if (smbcw_flush_write_buffer(pfd) < 0)
+			_RETURN64(-1);
+
+		//Write to the file
+		_RETURN64(write_fn(pfd->ctx, pfd->file, buf, size));
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+/**
+ * Reads (write = 0) or writes (write = 1) size bytes at offset and moves the file
+ * pointer back afterwards. libsmbclient keeps the file pointer locally, so only
+ * the read or write itself goes to the server.
+ */
+int64_t smbcw_pio(lp_smbcw_file pfd, char *buf, uint64_t size, int64_t offset,
+	int write)
+{
+	smbc_lseek_fn lseek_fn = backend_active->get_lseek(pfd->ctx);
+	smbc_read_fn read_fn = backend_active->get_read(pfd->ctx);
+	smbc_write_fn write_fn = backend_active->get_write(pfd->ctx);
+
+	if (!lseek_fn || !read_fn || !write_fn || offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	//Remember the file pointer, it includes the read-ahead buffer
+	off_t pos = lseek_fn(pfd->ctx, pfd->file, 0, SEEK_CUR);
+	if (pos < 0 || lseek_fn(pfd->ctx, pfd->file, offset, SEEK_SET) < 0)
+		return -1;
+
+	ssize_t ret = write ? write_fn(pfd->ctx, pfd->file, buf, size) :
+		read_fn(pfd->ctx, pfd->file, buf, size);
+	int err = errno;
+
+	if (lseek_fn(pfd->ctx, pfd->file, pos, SEEK_SET) < 0)
+		return -1;
+
+	errno = err;
+	return ret;
+}
+
+int64_t smbcw_pread(int fd, char *buf, uint64_t size, int64_t offset)
+{
+	_STATS_BEGIN(SMBCW_OP_PREAD);
+	_TRACE_FD(fd, size, offset);
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+	{
+		_STATS_HOST(pfd->ctx);
+
+		//Read what has been written before
+		if (smbcw_flush_write_buffer(pfd) < 0)
+			_RETURN(-1);
+
+		_RETURN64(smbcw_pio(pfd, buf, size, offset, 0));
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+int64_t smbcw_pwrite(int fd, char *buf, uint64_t size, int64_t offset)
+{
+	_STATS_BEGIN(SMBCW_OP_PWRITE);
+	_TRACE_FD(fd, size, offset);
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+	{
+		_STATS_HOST(pfd->ctx);
+
+		//Keep the order of the writes and do not serve stale data from the
+		//read-ahead buffer afterwards
+		if (smbcw_flush_write_buffer(pfd) < 0 || smbcw_discard_read_ahead(pfd) < 0)
+			_RETURN(-1);
+
+		smbcw_invalidate_path(pfd->ctx, pfd->filename);
+
+		_RETURN64(smbcw_pio(pfd, buf, size, offset, 1));
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+/**
+ * Returns the total length of the given buffers
+ */
+uint64_t smbcw_iov_len(const struct iovec *iov, int iovcnt)
+{
+	uint64_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	return len;
+}
+
+int64_t smbcw_preadv(int fd, const struct iovec *iov, int iovcnt, int64_t offset)
+{
+	if (iovcnt == 1)
+		return smbcw_pread(fd, iov[0].iov_base, iov[0].iov_len, offset);
+
+	//Read everything in one piece and scatter it afterwards
+	uint64_t len = smbcw_iov_len(iov, iovcnt);
+	char *buf = malloc(len > 0 ? len : 1);
+	if (!buf)
+		_RETURN_ERR(ENOMEM);
+
+	int64_t ret = smbcw_pread(fd, buf, len, offset);
+	int64_t done = 0;
+	int i;
+
+	for (i = 0; i < iovcnt && done < ret; i++) {
+		size_t count = iov[i].iov_len;
+		if (count > ret - done)
+			count = ret - done;
+
+		memcpy(iov[i].iov_base, buf + done, count);
+		done += count;
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+int64_t smbcw_pwritev(int fd, const struct iovec *iov, int iovcnt, int64_t offset)
+{
+	if (iovcnt == 1)
+		return smbcw_pwrite(fd, iov[0].iov_base, iov[0].iov_len, offset);
+
+	//Gather the buffers to send them in one piece
+	uint64_t len = smbcw_iov_len(iov, iovcnt);
+	char *buf = malloc(len > 0 ? len : 1);
+	if (!buf)
+		_RETURN_ERR(ENOMEM);
+
+	uint64_t done = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(buf + done, iov[i].iov_base, iov[i].iov_len);
+		done += iov[i].iov_len;
+	}
+
+	int64_t ret = smbcw_pwrite(fd, buf, len, offset);
+
+	free(buf);
+
+	return ret;
+}
+
+#ifdef HAVE_SMBC_SPLICE
+/**
+ * Progress callback of the server-side copy, lets the copy continue
+ */
+static int smbcw_splice_progress(off_t n, void *priv)
+{
+	return 1;
+}
+
+/**
+ * Lets the server copy size bytes (all remaining bytes if size < 0) from the
+ * current position of from to the current position of to. Both files have to
+ * be opened with the same context. Returns -2 if the server does not support
+ * copying.
+ */
+int64_t smbcw_splice(lp_smbcw_file from, lp_smbcw_file to, int64_t size)
+{
+	smbc_splice_fn splice_fn = backend_active->get_splice(from->ctx);
+	if (!splice_fn)
+		return -2;
+
+	//Determine the number of bytes remaining in the file
+	if (size < 0)
+	{
+		smbc_fstat_fn fstat_fn = backend_active->get_fstat(from->ctx);
+		smbc_lseek_fn lseek_fn = backend_active->get_lseek(from->ctx);
+		struct stat fstat;
+
+		off_t pos = lseek_fn(from->ctx, from->file, 0, SEEK_CUR);
+		if (pos < 0 || fstat_fn(from->ctx, from->file, &fstat) < 0)
+			return -1;
+
+		size = fstat.st_size > pos ? fstat.st_size - pos : 0;
+	}
+
+	off_t ret = splice_fn(from->ctx, from->file, to->file, size,
+		&smbcw_splice_progress, NULL);
+
+	if (ret < 0 && (errno == ENOTSUP || errno == EOPNOTSUPP || errno == ENOSYS ||
+		errno == EXDEV))
+		return -2;
+
+	return ret;
+}
+#endif
+
+/**
+ * Copies size bytes (all remaining bytes if size < 0) from the current position
+ * of from to the current position of to by reading and writing large blocks.
+ */
+int64_t smbcw_stream_copy(lp_smbcw_file from, lp_smbcw_file to, int64_t size)
+{
+	smbc_read_fn read_fn = backend_active->get_read(from->ctx);
+	smbc_write_fn write_fn = backend_active->get_write(to->ctx);
+	int64_t done = 0;
+
+	char *buf = malloc(DEFAULT_COPY_BUFFER_SIZE);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	while (size < 0 || done < size)
+	{
+		size_t count = DEFAULT_COPY_BUFFER_SIZE;
+		if (size >= 0 && size - done < count)
+			count = size - done;
+
+		ssize_t len = read_fn(from->ctx, from->file, buf, count);
+		if (len <= 0) {
+			if (len < 0)
+				done = -1;
+			break;
+		}
+
+		//Write the whole block
+		ssize_t written = 0;
+		while (written < len) {
+			ssize_t res = write_fn(to->ctx, to->file, buf + written, len - written);
+			if (res <= 0)
+				break;
+			written += res;
+		}
+
+		if (written < len) {
+			done = -1;
+			break;
+		}
+
+		done += len;
+	}
+
+	free(buf);
+
+	return done;
+}
+
+int64_t smbcw_fcopy(int fd_from, int fd_to, int64_t size)
+{
+	errno = EINVAL;
+	int64_t ret = -1;
+	_STATS_BEGIN(SMBCW_OP_FCOPY);
+	_TRACE_FD(fd_from, size, fd_to);
+
+	//Obtain the file descriptors and lock them
+	lp_smbcw_file to;
+	lp_smbcw_file from = smbcw_lock_ptr2(fd_from, fd_to, (void **)&to);
+	int _fd_locked = from ? fd_from : 0;
+	int _fd_locked2 = from ? fd_to : 0;
+	if (from && from->fd_check == FD_STRUCT_VAL && to && to->fd_check == FD_STRUCT_VAL)
+	{
+		//Both file pointers have to be where the user expects them
+		if (smbcw_flush_write_buffer(from) < 0 || smbcw_discard_read_ahead(from) < 0 ||
+			smbcw_flush_write_buffer(to) < 0 || smbcw_discard_read_ahead(to) < 0)
+			_RETURN64(-1);
+
+		ret = -2;
+
+#ifdef HAVE_SMBC_SPLICE
+		//Files on the same server are copied by the server itself
+		if (from->ctx == to->ctx)
+			ret = smbcw_splice(from, to, size);
+#endif
+
+		if (ret == -2)
+			ret = smbcw_stream_copy(from, to, size);
+
+		smbcw_invalidate_path(to->ctx, to->filename);
+	}
+
+	_RETURN64(ret);
+}
+
+int64_t smbcw_copy(char *url_from, char *url_to)
+{
+	int64_t ret = -1;
+	_STATS_BEGIN(SMBCW_OP_COPY);
+	_TRACE_URL(url_from, url_to);
+
+	//The open descriptor keeps the first context open while the second url is
+	//resolved
+	int fd_from = smbcw_fopen(url_from, "r");
+	if (fd_from <= 0) {
+		_STATS_END(-1);
+		return -1;
+	}
+
+	lp_smbcw_file from = smbcw_get_ptr(fd_from);
+	_STATS_HOST(from->ctx);
+
+	//Opening the destination truncates it, so it must not be the source. The
+	//filenames hold server and path but no credentials, so a file reached with
+	//other credentials is found as well. Servers usually ignore the case.
+	int same = 0;
+	lp_smbcw_urlcache_entry res_to = smbcw_lookup_url(url_to);
+	if (res_to) {
+		size_t len = smbcw_path_len(from->filename);
+		same = (len == smbcw_path_len(res_to->filename)) &&
+			strncasecmp(from->filename, res_to->filename, len) == 0;
+		connections_unref_ctx(res_to->ctx);
+		urlcache_release(res_to);
+	}
+
+	//Directories cannot be copied
+	smbcw_stat st;
+	if (same || (smbcw_fstat(fd_from, &st) == 0 && (st.s_mode & S_IFDIR))) {
+		smbcw_fclose(fd_from);
+		smbcw_errno = same ? EINVAL : EISDIR;
+		_STATS_END(-1);
+		return -1;
+	}
+
+	int fd_to = smbcw_fopen(url_to, "w");
+	int err = smbcw_errno;
+
+	if (fd_to > 0)
+	{
+		ret = smbcw_fcopy(fd_from, fd_to, -1);
+		err = smbcw_errno;
+
+		if (smbcw_fclose(fd_to) < 0 && ret >= 0) {
+			err = smbcw_errno;
+			ret = -1;
+		}
+	}
+
+	//Keep the error of the copy
+	smbcw_fclose(fd_from);
+	smbcw_errno = err;
+
+	_STATS_END(ret);
+	return ret;
+}
+
+int64_t smbcw_parallel_get(char *url, int lanes, int64_t chunk_size,
+	smbcw_consumer_fn consumer, void *priv)
+{
+	errno = EINVAL;
+	int64_t ret = -1;
+	_STATS_BEGIN(SMBCW_OP_PARALLEL_GET);
+	_TRACE_URL(url, NULL);
+	_TRACE_FD(-1, chunk_size, 0);
+	_TRACE_FLAGS(lanes);
+
+	if (lanes <= 0)
+		lanes = DEFAULT_TRANSFER_LANES;
+	if (chunk_size <= 0)
+		chunk_size = DEFAULT_TRANSFER_CHUNK_SIZE;
+
+	//Obtain the url context associated to this url
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
+
+	if (res)
+	{
+		_STATS_HOST(ctx);
+
+		smbc_stat_fn stat_fn = backend_active->get_stat(ctx);
+		struct stat fstat;
+
+		//The size decides how the file is split up between the lanes
+		if (consumer && stat_fn && stat_fn(ctx, res->filename, &fstat) == 0)
+			ret = transfer_get(ctx, res->filename, fstat.st_size, lanes, chunk_size,
+				consumer, priv);
+
+		smbcw_release_url(res, ctx);
+	}
+
+	_RETURN64(ret);
+}
+
+int64_t smbcw_parallel_put(char *url, int lanes, int64_t chunk_size,
+	smbcw_producer_fn producer, void *priv)
+{
+	errno = EINVAL;
+	int64_t ret = -1;
+	_STATS_BEGIN(SMBCW_OP_PARALLEL_PUT);
+	_TRACE_URL(url, NULL);
+	_TRACE_FD(-1, chunk_size, 0);
+	_TRACE_FLAGS(lanes);
+
+	if (lanes <= 0)
+		lanes = DEFAULT_TRANSFER_LANES;
+	if (chunk_size <= 0)
+		chunk_size = DEFAULT_TRANSFER_CHUNK_SIZE;
+
+	//Obtain the url context associated to this url
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
+
+	if (res)
+	{
+		_STATS_HOST(ctx);
+
+		smbc_open_fn open_fn = backend_active->get_open(ctx);
+		smbc_close_fn close_fn = backend_active->get_close(ctx);
+
+		//Create or truncate the file before the lanes write into it
+		SMBCFILE *file = NULL;
+		if (producer && open_fn && close_fn)
+			file = open_fn(ctx, res->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+		if (file)
+		{
+			close_fn(ctx, file);
+			ret = transfer_put(ctx, res->filename, lanes, chunk_size, producer, priv);
+		}
+
+		smbcw_invalidate_path(ctx, res->filename);
+
+		smbcw_release_url(res, ctx);
+	}
+
+	_RETURN64(ret);
+}
+
+int smbcw_fflush(int fd)
+{
+	_STATS_BEGIN(SMBCW_OP_FLUSH);
+	_TRACE_FD(fd, 0, 0);
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+	{
+		_STATS_HOST(pfd->ctx);
+		_RETURN(smbcw_flush_write_buffer(pfd));
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+int smbcw_set_write_buffer(int fd, int64_t size)
+{
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+	{
+		int ret = smbcw_flush_write_buffer(pfd);
+
+		//Read-only files are never buffered
+		if ((pfd->flags & O_ACCMODE) == O_RDONLY)
+			size = 0;
+
+		//Reallocate the buffer with the new size on the next write
+		free(pfd->wbuf);
+		pfd->wbuf = NULL;
+		pfd->wbuf_size = size > 0 ? size : 0;
+
+		_RETURN(ret);
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+int64_t smbcw_fseek(int fd, int64_t offset, int whence)
+{
+	_STATS_BEGIN(SMBCW_OP_SEEK);
+	_TRACE_FD(fd, 0, offset);
+	_TRACE_FLAGS(whence);
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL) {
+		_STATS_HOST(pfd->ctx);
+
+		//Obtain the seek function pointer
+		smbc_lseek_fn lseek_fn = backend_active->get_lseek(pfd->ctx);
+
+		//Buffered data belongs in front of the current position
+		if (smbcw_flush_write_buffer(pfd) < 0)
+			_RETURN64(-1);
+
+		//Relative seeks refer to the position seen by the user. Dropping the
+		//buffer this way saves the round trip of smbcw_discard_read_ahead.
+		if (pfd->prefetch) {
+			//Our own file handle has not moved since the prefetch thread took over
+			if (whence == SEEK_CUR) {
+				offset += prefetch_tell(pfd->prefetch);
+				whence = SEEK_SET;
+			}
+
+			prefetch_stop(pfd->prefetch);
+			pfd->prefetch = NULL;
+		} else if (whence == SEEK_CUR) {
+			offset -= pfd->rbuf_len - pfd->rbuf_pos;
+		}
+
+		pfd->rbuf_pos = 0;
+		pfd->rbuf_len = 0;
+		pfd->seq_reads = 0;
+		pfd->ra_fills = 0;
+
+		//Write to the file
+		_RETURN64(lseek_fn(pfd->ctx, pfd->file, offset, whence));
+	}
+
+	_RETURN_ERR(EINVAL);
+}
+
+int smbcw_fstat(int fd, smbcw_stat *stat)
+{
+	errno = EINVAL;
+	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_FSTAT);
+	_TRACE_FD(fd, 0, 0);
+	//Clear the stat value passed to this function
+	memset(stat, 0, sizeof(*stat));
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL) {
+		_STATS_HOST(pfd->ctx);
+
+		//Obtain the fstat function pointer
+		smbc_fstat_fn fstat_fn = backend_active->get_fstat(pfd->ctx);
+
+		//Let the server know about the full size of the file
+		if (smbcw_flush_write_buffer(pfd) < 0)
+			_RETURN(-1);
+
+		if (fstat_fn)
+		{
+			//Obtain the system internal file stat from smbc
+			struct stat fstat;
+
+			ret = fstat_fn(pfd->ctx, pfd->file, &fstat);
+
+			//Translate the system internal stat format into our own smbcw internal stat
+			//format.
+			if (ret >= 0)
+				smbcw_write_stat(&fstat, stat);
+
+			_STATS_END(ret);
+			_UNLOCK_FD;
+			return ret;
+		}
+	}
+
+	_RETURN(ret);
+}
+
+/**
+ * Checks whether the file is really readable - this is the only information
+ * which might be wrong as windows only has a READONLY flag - so files
+ * are always marked as readable although this might not be true when
+ * connecting to a Samba/UNIX server. Returns the permission bits which have to be
+ * cleared from the mode reported by the server.
+ */
+uint32_t smbcw_probe_access(char *url, uint32_t mode)
+{
+	int fd = smbcw_fopen(url, "r");
+	if (fd > 0) {
+		smbcw_fclose(fd);
+		return 0;
+	}
+
+	if (smbcw_geterr() != EACCES)
+		return 0;
+
+	// Check whether the file is a directory - if yes, the EACCES
+	// error might have been triggered although we have read access
+	// on the directory. If this is the case perform an "opendir"
+	// to validate. Unfortunately "opendir" takes much time - thats
+	// why it is placed inside the outer check.
+	if (mode & S_IFDIR)
+	{
+		fd = smbcw_opendir(url);
+		if (fd > 0) {
+			smbcw_closedir(fd);
+			return 0;
+		}
+
+		return (smbcw_geterr() == EACCES) ? 0777 : 0;
+	}
+
+	return 0555;
+}
+
+int smbcw_urlstat(char *url, smbcw_stat *stat)
+{
+	return smbcw_urlstat_ex(url, stat, SMBCW_STAT_DEFAULT);
+}
+
+/**
+ * Stat requested by smbcw_urlstat_ex from the metadata cache
+ */
+typedef struct {
+	smbcw_stat *stat;
+	int mode;
+	int host;
+} smbcw_stat_peek;
+
+/**
+ * Copies the cached stat of the file of the given url cache entry to the request
+ * if it can be returned as it is, see urlcache_peek
+ */
+static int smbcw_peek_stat(lp_smbcw_urlcache_entry entry, void *arg)
+{
+	smbcw_stat_peek *peek = arg;
+	smbcw_stat_entry cached;
+
+	if (!cache_get(&smbcw_stat_cache, entry->ctx, entry->filename,
+		smbcw_path_len(entry->filename), &cached))
+		return 0;
+
+	if (!cached.probed && !cached.listed && peek->mode != SMBCW_STAT_FAST)
+		return 0;
+
+	*peek->stat = cached.stat;
+	peek->host = connections_host_id(entry->ctx);
+
+	return 1;
+}
+
+int smbcw_urlstat_ex(char *url, smbcw_stat *stat, int mode)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_STAT);
+	_TRACE_URL(url, NULL);
+	_TRACE_FLAGS(mode);
+
+	if (mode == SMBCW_STAT_DEFAULT)
+		mode = smbcw_stat_mode;
+
 	//Clear the stat value passed to this function
 	memset(stat, 0, sizeof(*stat));
 
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
-	if (pfd && pfd->fd_check == FD_STRUCT_VAL) {
-		//Obtain the fstat function pointer
-		smbc_fstat_fn fstat_fn = smbc_getFunctionFstat(pfd->ctx);
+	//Stats the cache holds as they are returned need neither a reference on the
+	//context nor a context of the pool
+	smbcw_stat_peek peek = {stat, mode, 0};
+	if (urlcache_peek(url, &smbcw_peek_stat, &peek)) {
+		_stats_host = peek.host;
+		_RETURN(0);
+	}
 
-		if (fstat_fn)
+	//Obtain the url context associated to this url. A context of the pool is only
+	//checked out if the server has to be asked, stats served from the caches do
+	//without.
+	lp_smbcctx ctx = NULL;
+	lp_smbcw_urlcache_entry res = smbcw_lookup_url(url);
+
+	if (res)
+	{
+		_STATS_HOST(res->ctx);
+
+		size_t key_len = smbcw_path_len(res->filename);
+		int probed = 0;
+		int store = 0;
+
+		//Serve the stat from the metadata cache if possible
+		smbcw_stat_entry cached;
+		int missing;
+
+		if (cache_get(&smbcw_stat_cache, res->ctx, res->filename, key_len, &cached))
 		{
-			//Obtain the system internal file stat from smbc
-			struct stat fstat;
+			*stat = cached.stat;
+			probed = cached.probed || cached.listed;
+			ret = 0;
+		}
+		//Files recently found missing are not looked up again
+		else if (cache_get(&smbcw_neg_cache, res->ctx, res->filename, key_len,
+			&missing))
+		{
+			errno = missing;
+		}
+		else if ((ctx = connections_checkout_ctx(res->ctx)))
+		{
+			smbc_stat_fn stat_fn = backend_active->get_stat(ctx);
 
-			ret = fstat_fn(pfd->ctx, pfd->file, &fstat);
+			if (stat_fn)
+			{
+				struct stat fstat;
+
+				ret = stat_fn(ctx, res->filename, &fstat);
+
+				//Translate the system internal stat format into our own smbcw internal stat
+				//format.
+				if (ret >= 0) {
+					smbcw_write_stat(&fstat, stat);
+				} else if (errno == ENOENT) {
+					missing = ENOENT;
+					cache_put(&smbcw_neg_cache, res->ctx, res->filename, key_len, &missing);
+					errno = ENOENT;
+				}
+			}
 
-			//Translate the system internal stat format into our own smbcw internal stat
-			//format.
-			if (ret >= 0)
-				smbcw_write_stat(&fstat, stat);
+			store = 1;
+		}
 
-			return ret;
+		//Correct the permissions reported by the server, unless the caller is fine
+		//with them
+		if (ret >= 0 && !probed && mode != SMBCW_STAT_FAST)
+		{
+			int is_dir = (stat->s_mode & S_IFDIR) ? 1 : 0;
+			size_t parent_len = smbcw_parent_len(res->filename);
+			smbcw_probe_result probe;
+			uint32_t clear;
+
+			//Files inside of one directory usually share their permissions, so the
+			//probe result of one of them is reused for the others
+			memset(&probe, 0, sizeof(probe));
+			if (mode == SMBCW_STAT_CACHED)
+				cache_get(&smbcw_probe_cache, res->ctx, res->filename, parent_len, &probe);
+
+			if (probe.known[is_dir]) {
+				clear = probe.clear[is_dir];
+			} else {
+				clear = smbcw_probe_access(url, stat->s_mode);
+
+				//Another thread may have stored the other half in the meantime, which
+				//is probed again later on
+				if (mode == SMBCW_STAT_CACHED) {
+					probe.known[is_dir] = 1;
+					probe.clear[is_dir] = clear;
+					cache_put(&smbcw_probe_cache, res->ctx, res->filename, parent_len, &probe);
+				}
+			}
+
+			stat->s_mode &= ~clear;
+			probed = 1;
+			store = 1;
+		}
+
+		//Remember the result
+		if (ret >= 0 && store)
+		{
+			cached.stat = *stat;
+			cached.probed = probed;
+			cached.listed = 0;
+			cache_put(&smbcw_stat_cache, res->ctx, res->filename, key_len, &cached);
 		}
+
+		if (ctx)
+			connections_checkin_ctx(ctx);
+		connections_unref_ctx(res->ctx);
+		urlcache_release(res);
 	}
 
 	_RETURN(ret);
 }
 
-int smbcw_urlstat(char *url, smbcw_stat *stat)
+/**
+ * Milliseconds smbcw_urlstat_many waits for the workers to complete a stat before
+ * it executes the stats no worker has started yet itself
+ */
+#define STAT_MANY_STALL_MS 1000
+
+/**
+ * Position of an url in the submission order of smbcw_urlstat_many
+ */
+typedef struct {
+	lp_smbcctx ctx;
+	int rank;
+	int index;
+} smbcw_stat_order;
+
+static int smbcw_compare_stat_order(const void *a, const void *b)
+{
+	const smbcw_stat_order *x = a, *y = b;
+
+	if (x->rank != y->rank)
+		return x->rank < y->rank ? -1 : 1;
+	if (x->ctx != y->ctx)
+		return (uintptr_t)x->ctx < (uintptr_t)y->ctx ? -1 : 1;
+	return x->index - y->index;
+}
+
+int smbcw_urlstat_many(char **urls, int count, smbcw_stat *stats, int *errors)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_STAT_MANY);
+	_TRACE_FD(-1, count, 0);
+	int i, submitted = 0;
 
-	//Clear the stat value passed to this function
-	memset(stat, 0, sizeof(*stat));
+	if (count <= 0)
+		_RETURN(count == 0 ? 0 : -1);
 
-	//Obtain the url context associated to this url
-	lp_smbcw_url checked_url;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &checked_url);
+	smbcw_stat_order *order = malloc(count * sizeof(*order));
+	smbcw_async_queue *queue = smbcw_async_create();
 
-	if (ctx)
+	if (order && queue)
 	{
-		smbc_stat_fn stat_fn = smbc_getFunctionStat(ctx);
+		ret = 0;
 
-		if (stat_fn)
+		//Group the urls by their context. Taking the n-th url of every group before
+		//the n+1-th one spreads the workers over all servers instead of having them
+		//queue up for the contexts of one pool.
+		for (i = 0; i < count; i++)
 		{
-			struct stat fstat;
+			lp_smbcw_urlcache_entry res = smbcw_lookup_url(urls[i]);
 
-			char *fn = smbcw_url_gen_filename(checked_url);
-			ret = stat_fn(ctx, fn, &fstat);
+			order[i].ctx = res ? res->ctx : NULL;
+			order[i].rank = 0;
+			order[i].index = i;
 
-			free(fn);
+			if (res) {
+				connections_unref_ctx(res->ctx);
+				urlcache_release(res);
+			}
+		}
 
-			//Translate the system internal stat format into our own smbcw internal stat
-			//format.
-			if (ret >= 0)
-				smbcw_write_stat(&fstat, stat);
+		qsort(order, count, sizeof(*order), &smbcw_compare_stat_order);
+		for (i = 0; i < count; i++)
+			order[i].rank = (i > 0 && order[i - 1].ctx == order[i].ctx) ?
+				order[i - 1].rank + 1 : 0;
+		qsort(order, count, sizeof(*order), &smbcw_compare_stat_order);
+
+		for (i = 0; i < count; i++)
+		{
+			int index = order[i].index;
+
+			if (errors)
+				errors[index] = 0;
 
-			//Check whether the file is really readable - this is the only information
-			//which might be wrong as windows only has a READONLY flag - so files
-			//are always marked as readable although this might not be true when
-			//connecting to a Samba/UNIX server
-			int fd = smbcw_fopen(url, "r");
-			if (fd > 0) {
-				smbcw_fclose(fd);
+			if (smbcw_async_stat(queue, urls[index], &stats[index],
+				(void*)(intptr_t)index) > 0) {
+				submitted++;
 			} else {
-				if (smbcw_geterr() == EACCES)
-				{
-					// Check whether the file is a directory - if yes, the EACCES
-					// error might have been triggered although we have read access
-					// on the directory. If this is the case perform an "opendir"
-					// to validate. Unfortunately "opendir" takes much time - thats
-					// why it is placed inside the outer check.
-					if (stat->s_mode & S_IFDIR)
-					{
-						int fd = smbcw_opendir(url);
-						if (fd > 0) {
-							smbcw_closedir(fd);
-						} else {
-							if (smbcw_geterr() == EACCES)
-								stat->s_mode &= ~(0777);
-						}
-					}
-					else
-					{
-						stat->s_mode &= ~(0555);
-					}
-				}
+				memset(&stats[index], 0, sizeof(stats[index]));
+				if (errors)
+					errors[index] = errno;
 			}
 		}
 
-		smbcw_url_free(checked_url);
+		//Collect the results
+		while (submitted > 0)
+		{
+			smbcw_completion done[64];
+			int n = smbcw_async_wait(queue, done, 64, STAT_MANY_STALL_MS);
+
+			if (n < 0)
+				break;
+
+			//The workers are stuck, e.g. with the requests of other threads, so do
+			//the remaining stats on the context of the caller
+			if (n == 0) {
+				async_cancel(queue);
+				continue;
+			}
+
+			for (i = 0; i < n; i++)
+			{
+				int index = (intptr_t)done[i].priv;
+
+				if (done[i].result < 0 && done[i].err == ECANCELED) {
+					done[i].result = smbcw_urlstat(urls[index], &stats[index]);
+					done[i].err = smbcw_errno;
+				}
+
+				if (done[i].result >= 0)
+					ret++;
+				else if (errors)
+					errors[index] = done[i].err;
+			}
+
+			submitted -= n;
+		}
 	}
 
+	//Waits for requests which might still be in flight
+	smbcw_async_destroy(queue);
+	free(order);
+
 	_RETURN(ret);
 }
 
@@ -484,43 +1979,41 @@ int smbcw_rename(char *url_from, char* url_to)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_RENAME);
+	_TRACE_URL(url_from, url_to);
+
+	//Obtain the two url contexts associated to the given urls. The checkout of
+	//the first context makes sure obtaining the second one does not close it.
+	lp_smbcctx ctx_from, ctx_to = NULL;
+	lp_smbcw_urlcache_entry res_from = smbcw_resolve_url(url_from, &ctx_from);
+	if (res_from)
+		_STATS_HOST(ctx_from);
 
-	//Obtain the two url contexts associated to the given urls
-	lp_smbcw_url checked_url_from;
-	lp_smbcw_url checked_url_to;
+	lp_smbcw_urlcache_entry res_to = NULL;
 
-	lp_smbcctx ctx_from = smbcw_get_url_context(url_from, &checked_url_from);
-	lp_smbcctx ctx_to = smbcw_get_url_context(url_to, &checked_url_to);
+	if (res_from)
+		res_to = smbcw_resolve_url(url_to, &ctx_to);
 
 	//Currently smbc can only move files which are on the same share, so we check
 	//whether the two contexts are the same
-	if (ctx_from && (ctx_from == ctx_to))
+	if (res_from && res_to && (ctx_from == ctx_to))
 	{
-		smbc_rename_fn rename_fn = smbc_getFunctionRename(ctx_from);
+		smbc_rename_fn rename_fn = backend_active->get_rename(ctx_from);
 
 		if (rename_fn)
 		{
-			struct stat fstat;
-
-			//Get a clean version of the filename
-			char *fn_from = smbcw_url_gen_filename(checked_url_from);
-			char *fn_to = smbcw_url_gen_filename(checked_url_to);
-
 			//Call the rename function of smbcw
-			ret = rename_fn(ctx_from, fn_from, ctx_to, fn_to);
-			
-			//Free the filename strings and the url contexts
-			free(fn_from);
-			free(fn_to);
+			ret = rename_fn(ctx_from, res_from->filename, ctx_to, res_to->filename);
+
+			//A renamed directory takes all files below it along
+			smbcw_invalidate_tree(ctx_from, res_from->filename);
+			smbcw_invalidate_tree(ctx_to, res_to->filename);
 		}
 	}
 
-	//Free some structures which might still be initialized
-	if (checked_url_from)
-		smbcw_url_free(checked_url_from);
-
-	if (checked_url_to)
-		smbcw_url_free(checked_url_to);
+	//Release the resolved urls
+	smbcw_release_url(res_from, ctx_from);
+	smbcw_release_url(res_to, ctx_to);
 
 	_RETURN(ret);
 }
@@ -529,24 +2022,25 @@ int smbcw_unlink(char *url)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_UNLINK);
+	_TRACE_URL(url, NULL);
 
 	//Obtain the url context associated to this url
-	lp_smbcw_url checked_url;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &checked_url);
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
 
-	if (ctx)
+	if (res)
 	{
-		smbc_unlink_fn unlink_fn = smbc_getFunctionUnlink(ctx);
+		_STATS_HOST(ctx);
+
+		smbc_unlink_fn unlink_fn = backend_active->get_unlink(ctx);
 
 		if (unlink_fn)
-		{
-			char *fn = smbcw_url_gen_filename(checked_url);
-			ret = unlink_fn(ctx, fn);
+			ret = unlink_fn(ctx, res->filename);
 
-			free(fn);
-		}
+		smbcw_invalidate_path(ctx, res->filename);
 	
-		smbcw_url_free(checked_url);
+		smbcw_release_url(res, ctx);
 	}
 
 	_RETURN(ret);
@@ -556,24 +2050,25 @@ int smbcw_mkdir(char *url)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_MKDIR);
+	_TRACE_URL(url, NULL);
 
 	//Obtain the url context associated to this url
-	lp_smbcw_url checked_url;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &checked_url);
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
 
-	if (ctx)
+	if (res)
 	{
-		smbc_mkdir_fn mkdir_fn = smbc_getFunctionMkdir(ctx);
+		_STATS_HOST(ctx);
+
+		smbc_mkdir_fn mkdir_fn = backend_active->get_mkdir(ctx);
 
 		if (mkdir_fn)
-		{
-			char *fn = smbcw_url_gen_filename(checked_url);
-			ret = mkdir_fn(ctx, fn, 0);
+			ret = mkdir_fn(ctx, res->filename, 0);
 
-			free(fn);
-		}
+		smbcw_invalidate_path(ctx, res->filename);
 	
-		smbcw_url_free(checked_url);
+		smbcw_release_url(res, ctx);
 	}
 
 	_RETURN(ret);
@@ -583,24 +2078,25 @@ int smbcw_rmdir(char *url)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_RMDIR);
+	_TRACE_URL(url, NULL);
 
 	//Obtain the url context associated to this url
-	lp_smbcw_url checked_url;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &checked_url);
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
 
-	if (ctx)
+	if (res)
 	{
-		smbc_rmdir_fn rmdir_fn = smbc_getFunctionRmdir(ctx);
+		_STATS_HOST(ctx);
+
+		smbc_rmdir_fn rmdir_fn = backend_active->get_rmdir(ctx);
 
 		if (rmdir_fn)
-		{
-			char *fn = smbcw_url_gen_filename(checked_url);
-			ret = rmdir_fn(ctx, fn);
+			ret = rmdir_fn(ctx, res->filename);
 
-			free(fn);
-		}
+		smbcw_invalidate_tree(ctx, res->filename);
 	
-		smbcw_url_free(checked_url);
+		smbcw_release_url(res, ctx);
 	}
 
 	_RETURN(ret);
@@ -610,29 +2106,27 @@ int smbcw_opendir(char *url)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_OPENDIR);
+	_TRACE_URL(url, NULL);
 
-	lp_smbcw_url url_desc;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &url_desc);
-	if (ctx)
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
+	if (res)
 	{
-		smbc_opendir_fn opendir_fn = smbc_getFunctionOpendir(ctx);
+		_STATS_HOST(ctx);
+
+		smbc_opendir_fn opendir_fn = backend_active->get_opendir(ctx);
 
 		if (opendir_fn)
 		{
-			//Assemble the dirname smbc should open
-			char *fn = smbcw_url_gen_filename(url_desc);
-
 			//Obtain a pointer on the smbc file construct (which is also used for dirs)
-			lp_smbcfile file = opendir_fn(ctx, fn);
-
-			//Free the filename string again
-			free(fn);
+			lp_smbcfile file = opendir_fn(ctx, res->filename);
 
 			if (file)
 			{
 				//Create the file descriptor which will be returned to the user of the
 				//library
-				int id = smbcw_create_file_desc(ctx, file, NULL);
+				int id = smbcw_create_file_desc(ctx, file, res->filename, O_RDONLY, NULL);
 
 				if (id > 0)
 				{
@@ -640,14 +2134,14 @@ int smbcw_opendir(char *url)
 				} else {
 					//The context couldn't be created for whatever reason. Close the file
 					//descriptor again.
-					smbc_closedir_fn closedir_fn = smbc_getFunctionClosedir(ctx);
+					smbc_closedir_fn closedir_fn = backend_active->get_closedir(ctx);
 					closedir_fn(ctx, file);
 				}
 			}
-
-			//Free the url_descriptor
-			smbcw_url_free(url_desc);
 		}
+
+		//Release the resolved url
+		smbcw_release_url(res, ctx);
 	}
 
 	_RETURN(ret);
@@ -657,23 +2151,30 @@ int smbcw_closedir(int fd)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_CLOSEDIR);
+	_TRACE_FD(fd, 0, 0);
 
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
 	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
 	{
+		_STATS_HOST(pfd->ctx);
+
 		//Obtain the close function pointer
-		smbc_closedir_fn closedir_fn = smbc_getFunctionClosedir(pfd->ctx);
-		if (closedir_fn)
+		smbc_closedir_fn closedir_fn = backend_active->get_closedir(pfd->ctx);
+
+		//Remove the fd from the descriptor list first, only the thread which
+		//removed it closes and frees the directory
+		if (closedir_fn && smbcw_free_id(fd))
 		{
 			//Close the file
 			ret = closedir_fn(pfd->ctx, pfd->file);
 
-			//Free the memory reserved for the file descriptor
-			free(pfd);
+			//Allow the context to be used by other threads or closed again
+			connections_checkin_ctx(pfd->ctx);
 
-			//Remove the fd from the descriptor list
-			smbcw_free_id(fd);
+			//Free the memory reserved for the file descriptor
+			smbcw_free_file_desc(pfd);
 		}
 	}
 
@@ -684,16 +2185,20 @@ int smbcw_readdir(int fd, char **name)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_READDIR);
+	_TRACE_FD(fd, 0, 0);
 
 	//Set the output to NULL
 	*name = NULL;
 
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
 	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
 	{
+		_STATS_HOST(pfd->ctx);
+
 		//Obtain the readdir function pointer
-		smbc_readdir_fn readdir_fn = smbc_getFunctionReaddir(pfd->ctx);
+		smbc_readdir_fn readdir_fn = backend_active->get_readdir(pfd->ctx);
 		if (readdir_fn)
 		{
 			//Read an dir entry from the directory
@@ -710,17 +2215,169 @@ int smbcw_readdir(int fd, char **name)
 	_RETURN(ret);
 }
 
+/**
+ * Stores the stat of the directory entry name of the directory opened as pfd in
+ * the metadata cache, so smbcw_urlstat does not have to ask the server for it.
+ */
+void smbcw_cache_dirent_stat(lp_smbcw_file pfd, const char *name, smbcw_stat *stat)
+{
+	char buf[1024];
+	size_t dir_len = smbcw_path_len(pfd->filename);
+	size_t name_len = strlen(name);
+	size_t len = dir_len + 1 + name_len;
+
+	//"." and ".." are not addressed by these names in urls
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return;
+
+	char *key = (len < sizeof(buf)) ? buf : malloc(len + 1);
+	if (!key)
+		return;
+
+	memcpy(key, pfd->filename, dir_len);
+	key[dir_len] = '/';
+	memcpy(key + dir_len + 1, name, name_len);
+
+	//The entry exists, whatever the negative lookup cache says
+	lp_smbcctx ctx = connections_pool_ctx(pfd->ctx);
+	cache_remove(&smbcw_neg_cache, ctx, key, len);
+
+	//Keep an entry which has already been probed. The listing was just read, so
+	//stats of its entries are returned without probing them while they are cached.
+	smbcw_stat_entry cached;
+	if (!cache_get(&smbcw_stat_cache, ctx, key, len, &cached) || !cached.probed) {
+		cached.stat = *stat;
+		cached.probed = 0;
+		cached.listed = 1;
+		cache_put(&smbcw_stat_cache, ctx, key, len, &cached);
+	}
+
+	if (key != buf)
+		free(key);
+}
+
+/**
+ * Returns 1 if the smbc filename of a directory lies inside of a share, i.e. its
+ * listing contains files and directories rather than workgroups, servers or
+ * shares
+ */
+static int smbcw_lists_files(const char *fn)
+{
+	const char *p = strstr(fn, "://");
+
+	//Skip the server
+	p = p ? p + 3 : fn;
+	p = strchr(p, '/');
+
+	return p && p[1] && p[1] != '/';
+}
+
+int smbcw_readdirplus(int fd, char **name, smbcw_stat *stat)
+{
+	errno = EINVAL;
+	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_READDIR);
+	_TRACE_FD(fd, 0, 0);
+	_TRACE_FLAGS(1);
+
+	//Set the output to NULL
+	*name = NULL;
+	memset(stat, 0, sizeof(*stat));
+
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
+	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
+	{
+		_STATS_HOST(pfd->ctx);
+
+		struct stat fstat;
+
+#ifdef HAVE_SMBC_READDIRPLUS2
+		//libsmbclient only returns the attributes of files and directories inside
+		//of a share. Listings of workgroups, servers and shares only come through
+		//readdir.
+		if (!pfd->readdir_plus && !smbcw_lists_files(pfd->filename))
+			pfd->readdir_plus = -1;
+
+		//Obtain the readdirplus function pointer, which returns name and stat of
+		//each entry with a single directory enumeration
+		smbc_readdirplus2_fn readdirplus2_fn = (pfd->readdir_plus < 0) ? NULL :
+			backend_active->get_readdirplus2(pfd->ctx);
+		if (readdirplus2_fn)
+		{
+			const struct libsmb_file_info *info =
+				readdirplus2_fn(pfd->ctx, pfd->file, &fstat);
+
+			if (info != NULL)
+			{
+				pfd->readdir_plus = 1;
+				*name = info->name;
+				smbcw_write_stat(&fstat, stat);
+				smbcw_cache_dirent_stat(pfd, *name, stat);
+				_RETURN(0);
+			}
+
+			//The end of a listing readdirplus works for
+			if (pfd->readdir_plus > 0)
+				_RETURN(ret);
+
+			//Nothing at all, so it might not be a file listing after all. Costs an
+			//extra round trip for empty directories.
+			pfd->readdir_plus = -1;
+		}
+#endif
+
+		//Fall back to readdir and a stat per entry
+		smbc_readdir_fn readdir_fn = backend_active->get_readdir(pfd->ctx);
+		smbc_stat_fn stat_fn = backend_active->get_stat(pfd->ctx);
+		if (readdir_fn && stat_fn)
+		{
+			struct smbc_dirent *ent = readdir_fn(pfd->ctx, pfd->file);
+
+			if (ent != NULL)
+			{
+				*name = ent->name;
+
+				//Assemble the filename of the entry
+				size_t dir_len = smbcw_path_len(pfd->filename);
+				char *fn = malloc(dir_len + strlen(ent->name) + 2);
+				if (!fn) {
+					errno = ENOMEM;
+					_RETURN(ret);
+				}
+				memcpy(fn, pfd->filename, dir_len);
+				fn[dir_len] = '/';
+				strcpy(fn + dir_len + 1, ent->name);
+
+				if (stat_fn(pfd->ctx, fn, &fstat) >= 0) {
+					smbcw_write_stat(&fstat, stat);
+					smbcw_cache_dirent_stat(pfd, *name, stat);
+				}
+
+				free(fn);
+				_RETURN(0);
+			}
+		}
+	}
+
+	_RETURN(ret);
+}
+
 int smbcw_rewinddir(int fd)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_REWINDDIR);
+	_TRACE_FD(fd, 0, 0);
 
-	//Obtain the file descriptor
-	lp_smbcw_file pfd = smbcw_get_ptr(fd);
+	//Obtain the file descriptor and lock it
+	_LOCK_FD(fd);
 	if (pfd && pfd->fd_check == FD_STRUCT_VAL)
 	{
+		_STATS_HOST(pfd->ctx);
+
 		//Obtain the seekdir function pointer
-		smbc_lseekdir_fn lseekdir_fn = smbc_getFunctionLseekdir(pfd->ctx);
+		smbc_lseekdir_fn lseekdir_fn = backend_active->get_lseekdir(pfd->ctx);
 
 		if (lseekdir_fn)
 			//Seek to the beginning of the file
@@ -734,20 +2391,25 @@ int smbcw_chmod(char *url, int mode)
 {
 	errno = EINVAL;
 	int ret = -1;
+	_STATS_BEGIN(SMBCW_OP_CHMOD);
+	_TRACE_URL(url, NULL);
+	_TRACE_FD(-1, mode, 0);
 
-	lp_smbcw_url url_ctx;
-	lp_smbcctx ctx = smbcw_get_url_context(url, &url_ctx);
+	lp_smbcctx ctx;
+	lp_smbcw_urlcache_entry res = smbcw_resolve_url(url, &ctx);
 
-	if (ctx)
+	if (res)
 	{
-		smbc_chmod_fn chmod_fn = smbc_getFunctionChmod(ctx);
+		_STATS_HOST(ctx);
 
-		char *fn = smbcw_url_gen_filename(url_ctx);
+		smbc_chmod_fn chmod_fn = backend_active->get_chmod(ctx);
 
 		if (chmod_fn)
-			ret = chmod_fn(ctx, fn, mode);
+			ret = chmod_fn(ctx, res->filename, mode);
 
-		free(fn);
+		smbcw_invalidate_path(ctx, res->filename);
+
+		smbcw_release_url(res, ctx);
 	}
 
 	_RETURN(ret);
@@ -789,3 +2451,76 @@ int smbcw_geterr()
 {
 	return smbcw_errno;
 }
+
+void smbcw_get_cache_stats(smbcw_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	connections_get_stats(&stats->conn_hits, &stats->conn_misses,
+		&stats->conn_entries, &stats->conn_waits);
+	urlcache_get_stats(&stats->url_hits, &stats->url_misses,
+		&stats->url_entries);
+	cache_get_stats(&smbcw_stat_cache, &stats->stat_hits, &stats->stat_misses,
+		&stats->stat_entries);
+	cache_get_stats(&smbcw_neg_cache, &stats->neg_hits, &stats->neg_misses,
+		&stats->neg_entries);
+}
+
+void smbcw_set_stats(int enabled)
+{
+	__atomic_store_n(&stats_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+	smbcw_update_clock();
+}
+
+int smbcw_get_stats(smbcw_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	connections_get_stats(&stats->conn_hits, &stats->conn_misses, NULL, NULL);
+
+	return stats_get(stats);
+}
+
+void smbcw_free_stats(smbcw_stats *stats)
+{
+	free(stats->ops);
+	stats->ops = NULL;
+	stats->op_count = 0;
+}
+
+void smbcw_reset_stats()
+{
+	stats_reset();
+}
+
+void smbcw_set_roundtrip_log(int fd)
+{
+	__atomic_store_n(&stats_log_fd, fd, __ATOMIC_RELAXED);
+	smbcw_update_clock();
+}
+
+int smbcw_trace_start(const char *path)
+{
+	int ret = trace_start(path);
+	smbcw_update_clock();
+	_RETURN(ret);
+}
+
+void smbcw_trace_stop()
+{
+	trace_stop();
+	smbcw_update_clock();
+}
+
+int smbcw_set_slow_threshold(int cls, int64_t ms)
+{
+	errno = EINVAL;
+	int ret = slowlog_set_threshold(cls, ms > 0 ? ms * 1000000ull : 0);
+	smbcw_update_clock();
+	_RETURN(ret);
+}
+
+void smbcw_set_slow_log(int fd)
+{
+	slowlog_set_fd(fd);
+}
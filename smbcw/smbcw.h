@@ -20,7 +20,9 @@
 #ifndef _SMBCW_H
 #define _SMBCW_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 /**
  * MAX_DEBUG_LEVEL should be equal to SMBs MAX_DEBUG_LEVEL
@@ -45,6 +47,23 @@ typedef struct smbcw_stat{
 	uint32_t s_ctime;		/* time of last change */
 } smbcw_stat;
 
+/* Counters of the caches used internally by smbcw */
+typedef struct smbcw_cache_stats{
+	uint64_t conn_hits;		/* context lookups served by an existing context */
+	uint64_t conn_misses;	/* context lookups which created a new context */
+	uint64_t conn_entries;	/* contexts currently kept */
+	uint64_t conn_waits;	/* checkouts which waited for a context of a pool */
+	uint64_t url_hits;		/* urls resolved by the url cache */
+	uint64_t url_misses;	/* urls which had to be parsed and resolved */
+	uint64_t url_entries;	/* urls currently cached */
+	uint64_t stat_hits;		/* smbcw_urlstat calls served by the metadata cache */
+	uint64_t stat_misses;	/* smbcw_urlstat calls which asked the server */
+	uint64_t stat_entries;	/* files currently in the metadata cache */
+	uint64_t neg_hits;		/* smbcw_urlstat calls answered with a cached ENOENT */
+	uint64_t neg_misses;	/* metadata cache misses not in the negative cache */
+	uint64_t neg_entries;	/* missing files currently remembered */
+} smbcw_cache_stats;
+
 /* Inits smbcw. Returns -1 if an error occurred, 0 if the operation was successful. */
 extern int smbcw_init();
 
@@ -53,6 +72,96 @@ extern int smbcw_init();
  */
 extern void smbcw_finalize();
 
+/* Limits the number of SMB contexts (and thus server sessions) smbcw keeps open.
+   If max_contexts contexts are open, the least recently used one which is not
+   referenced by an open file or directory descriptor is closed before a new one
+   is created. Contexts idle for idle_timeout seconds are closed as well. Values
+   <= 0 disable the corresponding limit. */
+extern void smbcw_set_context_limits(int max_contexts, int idle_timeout);
+
+/* Sets the number of contexts smbcw may open for the same credentials (default
+   1) so that several threads can access a server at the same time. Every call
+   and every open file or directory descriptor checks out one of them for the
+   calling thread; a thread always gets the context it already holds, so all of
+   its descriptors stay on one session. If all contexts are held by other threads,
+   the call waits for one to become free if wait is set (the default) or fails
+   with EBUSY. It fails with EDEADLK instead of waiting for threads which in turn
+   wait for contexts the calling thread holds. A descriptor stays on the context
+   it was opened on. Several threads may use it, calls on one descriptor are
+   executed one after the other. The contexts of one pool count as one for
+   smbcw_set_context_limits. */
+extern void smbcw_set_pool(int size, int wait);
+
+/* Sets the number of urls for which the resolved context and filename are
+   cached. 0 disables the cache. */
+extern void smbcw_set_url_cache_size(int size);
+
+/* Sets the default mode of smbcw_urlstat, SMBCW_STAT_PROBE if not set. */
+extern void smbcw_set_stat_mode(int mode);
+
+/* Sets the number of seconds the probe results of SMBCW_STAT_CACHED are kept. */
+extern void smbcw_set_probe_cache_ttl(int ttl);
+
+/* Sets the number of files and the number of seconds smbcw_urlstat results are
+   cached for. Files modified through smbcw are dropped from the cache right
+   away. A size or ttl of 0 disables the cache. */
+extern void smbcw_set_stat_cache(int size, int ttl);
+
+/* Sets the size of the reads issued once a file is read sequentially. Smaller
+   smbcw_fread calls are served from a buffer of this size per file, which is
+   dropped on seek and write. 0 disables read-ahead, default is 1 MiB. */
+extern void smbcw_set_read_ahead(int64_t size);
+
+/* Sets the number of read-ahead sized blocks a background thread keeps ahead
+   of the reader of a file opened read-only, reading one block at a time.
+   Prefetching starts once the file turned out to be larger than one read-ahead
+   block and reads through an SMB session of the pool which only the background
+   threads use and which is kept for the following files. Memory per file is
+   bounded by blocks * read-ahead size. 0 disables prefetching, which is the
+   default. */
+extern void smbcw_set_prefetch(int blocks);
+
+/* Sets the size of the write-behind buffer of files opened for writing from now
+   on. Smaller smbcw_fwrite calls are collected in it and sent to the server when
+   it is full or on smbcw_fflush, smbcw_fseek, smbcw_fstat, smbcw_fread and
+   smbcw_fclose. 0 disables buffering, default is 64 KiB. */
+extern void smbcw_set_write_buffer_size(int64_t size);
+
+/* Sets the number of missing files and the number of seconds smbcw_urlstat
+   answers ENOENT for them without asking the server. Files created or renamed
+   through smbcw are dropped from the cache right away. A size or ttl of 0
+   disables the cache. */
+extern void smbcw_set_negative_cache(int size, int ttl);
+
+/* Drops all cached smbcw_urlstat results, including the negative ones. */
+extern void smbcw_clear_stat_cache();
+
+/* Backends smbcw accesses servers through */
+#define SMBCW_BACKEND_LIBSMBCLIENT 0
+#define SMBCW_BACKEND_FAKE 1
+
+/* Selects the backend, libsmbclient by default. Fails with EBUSY while contexts
+   of the current backend are open, so it has to be called before the first url
+   is accessed or after smbcw_finalize. */
+extern int smbcw_set_backend(int backend);
+
+/* Settings of SMBCW_BACKEND_FAKE, an in-process stand-in for a server which maps
+   smb://host/share/path onto root/share/path of the local file system. Each
+   call of a file function of libsmbclient counts as one round trip. */
+typedef struct smbcw_fake_config{
+	const char *root;		/* local directory, /tmp/smbcw_fake if NULL */
+	int latency_us;			/* time every round trip takes */
+	int bandwidth_mbps;	/* throughput of each context in MB/s, 0 = unlimited */
+	int fail_every;			/* every fail_every-th round trip fails, 0 = never */
+	int fail_errno;			/* error of the failing round trips, EIO if 0 */
+} smbcw_fake_config;
+
+/* Sets the settings of the fake backend. Must not be called while calls are in
+   progress. */
+extern void smbcw_fake_configure(const smbcw_fake_config *config);
+/* Returns the number of round trips the fake backend has served so far */
+extern uint64_t smbcw_fake_round_trips();
+
 /* Opens the file specified by url. Mode might be one of "r,w,a,x,r+,w+,a+,x+".
     r  : O_RDONLY
     r+ : O_RDWR
@@ -70,13 +179,85 @@ extern int smbcw_fclose(int fd);
 extern int64_t smbcw_fread(int fd, char *buf, uint64_t size);
 /* Writes size bytes from buf to fd */
 extern int64_t smbcw_fwrite(int fd, char *buf, uint64_t size);
+/* Reads size bytes at offset from fd to buf without moving the file pointer
+   used by smbcw_fread/smbcw_fwrite. Threads sharing fd may read different
+   ranges at the same time, the reads are sent one after the other. */
+extern int64_t smbcw_pread(int fd, char *buf, uint64_t size, int64_t offset);
+/* Writes size bytes from buf at offset to fd without moving the file pointer */
+extern int64_t smbcw_pwrite(int fd, char *buf, uint64_t size, int64_t offset);
+/* Same as smbcw_pread, but scatters the data read to the iovcnt buffers of iov.
+   All buffers are filled with a single read request. */
+extern int64_t smbcw_preadv(int fd, const struct iovec *iov, int iovcnt,
+	int64_t offset);
+/* Same as smbcw_pwrite, but gathers the data from the iovcnt buffers of iov.
+   All buffers are sent with a single write request. */
+extern int64_t smbcw_pwritev(int fd, const struct iovec *iov, int iovcnt,
+	int64_t offset);
+/* Copies size bytes (all remaining bytes if size < 0) from the current position
+   of fd_from to the current position of fd_to and returns the number of bytes
+   copied. If both files are opened on the same server with the same
+   credentials, the server copies the data itself (libsmbclient >= 4.3),
+   otherwise it is read and written in 4 MiB blocks. */
+extern int64_t smbcw_fcopy(int fd_from, int fd_to, int64_t size);
+/* Copies the file url_from to url_to, see smbcw_fcopy. Returns the number of
+   bytes copied or -1 if an error occurred. Fails with EINVAL if both urls name
+   the same file and with EISDIR if url_from is a directory. */
+extern int64_t smbcw_copy(char *url_from, char *url_to);
+
+/* Function receiving the data of smbcw_parallel_get in file order. Has to
+   return a value < 0 to abort the download. */
+typedef int (*smbcw_consumer_fn)(const char *buf, uint64_t len, void *priv);
+/* Function providing the data of smbcw_parallel_put. Has to fill buf with up to
+   len bytes and return their number, 0 at the end of the data or a value < 0 to
+   abort the upload. It is never called by two threads at the same time. */
+typedef int64_t (*smbcw_producer_fn)(char *buf, uint64_t len, void *priv);
+/* Downloads the file url with lanes parallel connections, each of them reading
+   chunks of chunk_size bytes, and passes the data to consumer in file order.
+   Values <= 0 select the defaults (4 lanes, 4 MiB chunks). Returns the number
+   of bytes passed to consumer or -1 if an error occurred. */
+extern int64_t smbcw_parallel_get(char *url, int lanes, int64_t chunk_size,
+	smbcw_consumer_fn consumer, void *priv);
+/* Uploads the data of producer to the file url, which is created or truncated,
+   with lanes parallel connections, each of them writing chunks of chunk_size
+   bytes at their offset. Returns the number of bytes written or -1. */
+extern int64_t smbcw_parallel_put(char *url, int lanes, int64_t chunk_size,
+	smbcw_producer_fn producer, void *priv);
+/* Sends the data buffered for fd to the server */
+extern int smbcw_fflush(int fd);
+/* Sets the size of the write-behind buffer of fd after flushing it. A size of 0
+   makes fd write-through: every smbcw_fwrite is sent to the server right away */
+extern int smbcw_set_write_buffer(int fd, int64_t size);
 /* Seeks offset bytes from whence (SEEK_SET, SEEK_CUR, SEEK_END) in fd */
 extern int64_t smbcw_fseek(int fd, int64_t offset, int whence);
 /* Writes the file stat structure of the opened file fd to stat */
 extern int smbcw_fstat(int fd, smbcw_stat *stat);
 
+/* Modes of smbcw_urlstat_ex. Windows only knows a READONLY flag, so the
+   permissions reported by the server might claim files to be readable which
+   aren't.
+    SMBCW_STAT_DEFAULT : use the mode set with smbcw_set_stat_mode
+    SMBCW_STAT_PROBE   : verify read access by opening each file (or directory)
+    SMBCW_STAT_FAST    : return the permissions reported by the server
+    SMBCW_STAT_CACHED  : like SMBCW_STAT_PROBE, but the probe result is reused for
+                         all files (or directories) inside of the same directory
+*/
+#define SMBCW_STAT_DEFAULT -1
+#define SMBCW_STAT_PROBE 0
+#define SMBCW_STAT_FAST 1
+#define SMBCW_STAT_CACHED 2
+
 /* Retrieves the file stat structure of a non opened file and writes it to stat */
 extern int smbcw_urlstat(char *url, smbcw_stat *stat);
+/* Same as smbcw_urlstat, but with the given stat mode */
+extern int smbcw_urlstat_ex(char *url, smbcw_stat *stat, int mode);
+/* Retrieves the stat of count urls at once and writes them to stats. The urls are
+   grouped by their context and handed to the workers of the asynchronous calls,
+   so several stats are in flight at the same time, see smbcw_set_async_workers.
+   If no stat completes for a second, e.g. while the workers are busy with the
+   requests of other threads, the calling thread does the remaining ones itself.
+   If errors is not NULL, the error code of each url is written to it (0 on
+   success). Returns the number of urls which could be stat'ed or -1. */
+extern int smbcw_urlstat_many(char **urls, int count, smbcw_stat *stats, int *errors);
 /* Renames the file specified by url_from to url_to */
 extern int smbcw_rename(char *url_from, char* url_to);
 /* Deletes the file specified by url */
@@ -97,13 +278,216 @@ extern int smbcw_closedir(int fd);
    valid until the next smbcw_readdir is called or smbcw_closedir or smbcw_rewinddir
    is called.*/
 extern int smbcw_readdir(int fd, char **name);
+/* Same as smbcw_readdir, but additionally writes the stat of the entry to stat.
+   With libsmbclient >= 4.12 name and stat of all entries are retrieved with a
+   single directory enumeration. The stat of each entry is put into the metadata
+   cache, so a following smbcw_urlstat on the entry is served locally, without
+   the probe of SMBCW_STAT_PROBE and SMBCW_STAT_CACHED while it is cached. */
+extern int smbcw_readdirplus(int fd, char **name, smbcw_stat *stat);
 /* Rewinds the directory pointer */
 extern int smbcw_rewinddir(int fd);
 
+/* Asynchronous calls. Requests are submitted to a queue created with
+   smbcw_async_create and executed by a pool of worker threads, each of them
+   checking out its own context of the connection pool. Every request completes
+   with a smbcw_completion in the queue it has been submitted to, and the file
+   descriptor returned by smbcw_async_fd becomes readable as long as completions
+   are waiting to be reaped, so it can be watched by an event loop. Buffers and
+   stat structures passed to a request have to stay valid until it completed.
+   All requests on one descriptor are executed in the order they were submitted
+   by the worker which opened it. */
+
+/* Operations of a smbcw_completion */
+#define SMBCW_ASYNC_OPEN 1
+#define SMBCW_ASYNC_READ 2
+#define SMBCW_ASYNC_WRITE 3
+#define SMBCW_ASYNC_STAT 4
+#define SMBCW_ASYNC_OPENDIR 5
+#define SMBCW_ASYNC_READDIR 6
+#define SMBCW_ASYNC_CLOSE 7
+#define SMBCW_ASYNC_CLOSEDIR 8
+
+/* Result of an asynchronous request */
+typedef struct smbcw_completion{
+	int64_t id;				/* id returned when the request was submitted */
+	int op;						/* SMBCW_ASYNC_* */
+	int64_t result;		/* return value of the corresponding synchronous call */
+	int err;					/* smbcw_geterr() of the call, 0 on success */
+	void *priv;				/* pointer passed when the request was submitted */
+} smbcw_completion;
+
+typedef struct smbcw_async_queue smbcw_async_queue;
+
+/* Sets the number of worker threads (default 4). Only has an effect before the
+   first request is submitted. Every worker uses a context of its own in addition
+   to the pool set with smbcw_set_pool, so it never waits for the contexts held
+   by the threads submitting requests. */
+extern void smbcw_set_async_workers(int workers);
+/* Creates a completion queue, returns NULL on failure */
+extern smbcw_async_queue *smbcw_async_create();
+/* Waits for all requests of queue, closes the descriptors opened through it
+   which are still open and frees it. Completions which have not been reaped
+   are dropped, see smbcw_async_pending. */
+extern void smbcw_async_destroy(smbcw_async_queue *queue);
+/* Returns a descriptor which can be polled for readability. It is readable as
+   long as completions are waiting in queue and must not be read or closed. */
+extern int smbcw_async_fd(smbcw_async_queue *queue);
+/* Returns the number of requests submitted to queue which have not been reaped */
+extern int smbcw_async_pending(smbcw_async_queue *queue);
+/* Moves up to max completions from queue to done without waiting and returns
+   their number */
+extern int smbcw_async_reap(smbcw_async_queue *queue, smbcw_completion *done,
+	int max);
+/* Like smbcw_async_reap, but waits up to timeout milliseconds (forever if < 0)
+   for the first completion. Returns 0 on timeout and -1 on error. */
+extern int smbcw_async_wait(smbcw_async_queue *queue, smbcw_completion *done,
+	int max, int timeout);
+
+/* The following functions submit a request and return its id (> 0) or -1 if it
+   could not be submitted. The result of the request is the one of the
+   synchronous call named. Descriptors used with them have to be opened by
+   smbcw_async_open or smbcw_async_opendir. */
+
+/* smbcw_fopen, the result is the new descriptor */
+extern int64_t smbcw_async_open(smbcw_async_queue *queue, char *url, char *mode,
+	void *priv);
+/* smbcw_fread into buf */
+extern int64_t smbcw_async_read(smbcw_async_queue *queue, int fd, char *buf,
+	uint64_t size, void *priv);
+/* smbcw_fwrite from buf */
+extern int64_t smbcw_async_write(smbcw_async_queue *queue, int fd, char *buf,
+	uint64_t size, void *priv);
+/* smbcw_urlstat into stat */
+extern int64_t smbcw_async_stat(smbcw_async_queue *queue, char *url,
+	smbcw_stat *stat, void *priv);
+/* smbcw_opendir, the result is the new descriptor */
+extern int64_t smbcw_async_opendir(smbcw_async_queue *queue, char *url, void *priv);
+/* smbcw_readdirplus, the name of the entry is copied to name. Fails with
+   ENAMETOOLONG if it does not fit into name_size bytes. */
+extern int64_t smbcw_async_readdir(smbcw_async_queue *queue, int fd, char *name,
+	size_t name_size, smbcw_stat *stat, void *priv);
+/* smbcw_fclose */
+extern int64_t smbcw_async_close(smbcw_async_queue *queue, int fd, void *priv);
+/* smbcw_closedir */
+extern int64_t smbcw_async_closedir(smbcw_async_queue *queue, int fd, void *priv);
+
 /* Returns the error code which has been set whenever any of the SMBCW functions
-   failed. */
+   failed. The error code is kept per thread. */
 extern int smbcw_geterr();
 
+/* Writes the current cache counters to stats */
+extern void smbcw_get_cache_stats(smbcw_cache_stats *stats);
+
+/* Operations the latencies are recorded for. Calls made internally, like the
+   smbcw_fopen of a probing smbcw_urlstat, are recorded as well. smbcw_preadv
+   and smbcw_pwritev are recorded as smbcw_pread and smbcw_pwrite. */
+#define SMBCW_OP_OPEN 0
+#define SMBCW_OP_CLOSE 1
+#define SMBCW_OP_READ 2
+#define SMBCW_OP_WRITE 3
+#define SMBCW_OP_PREAD 4
+#define SMBCW_OP_PWRITE 5
+#define SMBCW_OP_SEEK 6
+#define SMBCW_OP_FLUSH 7
+#define SMBCW_OP_FSTAT 8
+#define SMBCW_OP_STAT 9
+#define SMBCW_OP_STAT_MANY 10
+#define SMBCW_OP_RENAME 11
+#define SMBCW_OP_UNLINK 12
+#define SMBCW_OP_MKDIR 13
+#define SMBCW_OP_RMDIR 14
+#define SMBCW_OP_CHMOD 15
+#define SMBCW_OP_OPENDIR 16
+#define SMBCW_OP_CLOSEDIR 17
+#define SMBCW_OP_READDIR 18
+#define SMBCW_OP_REWINDDIR 19
+#define SMBCW_OP_COPY 20
+#define SMBCW_OP_FCOPY 21
+#define SMBCW_OP_PARALLEL_GET 22
+#define SMBCW_OP_PARALLEL_PUT 23
+#define SMBCW_OP_COUNT 24
+
+/* Latencies of one operation on one host. The percentiles and the maximum are
+   the upper bounds of histogram buckets, which are at most 12.5% wide. */
+typedef struct smbcw_op_stats{
+	int op;						/* SMBCW_OP_* */
+	const char *name;	/* name of the operation, e.g. "open" */
+	char host[256];		/* server name, empty for calls which failed before a server
+										   was known and for hosts beyond the first 64 */
+	uint64_t count;		/* number of calls */
+	uint64_t errors;	/* calls which returned an error */
+	uint64_t total_ns;	/* sum of the latencies of all calls */
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+	uint64_t round_trips;	/* calls of libsmbclient functions made by all calls */
+	uint64_t max_round_trips;	/* most libsmbclient calls made by one call */
+} smbcw_op_stats;
+
+/* Counters and latencies written by smbcw_get_stats */
+typedef struct smbcw_stats{
+	uint64_t bytes_read;		/* bytes returned by reads */
+	uint64_t bytes_written;	/* bytes accepted by writes */
+	uint64_t conn_hits;			/* context lookups served by an existing context */
+	uint64_t conn_misses;		/* context lookups which created a new context */
+	uint64_t descriptors_open;	/* file and directory descriptors currently open */
+	uint64_t contexts_alive;		/* SMB contexts currently existing */
+	int op_count;						/* number of elements of ops */
+	smbcw_op_stats *ops;		/* one element per operation and host called */
+} smbcw_stats;
+
+/* Enables or disables (default) recording latencies and bytes transferred.
+   Recording costs two clock reads and a few atomic additions per call, which is
+   a multiple of what parsing the url costs for calls served from the caches.
+   The round trip log, the trace and the slow log read the clock as well. */
+extern void smbcw_set_stats(int enabled);
+/* Writes the current counters and latencies to stats. The ops array has to be
+   freed with smbcw_free_stats. Returns -1 if it could not be allocated. */
+extern int smbcw_get_stats(smbcw_stats *stats);
+/* Frees the ops array of stats */
+extern void smbcw_free_stats(smbcw_stats *stats);
+/* Clears the latencies and byte counters */
+extern void smbcw_reset_stats();
+/* Writes one line per call with the operation, server, number of libsmbclient
+   calls (round trips), latency and result to fd, -1 disables it (default). Works
+   without smbcw_set_stats. The descriptor is not closed by smbcw. */
+extern void smbcw_set_roundtrip_log(int fd);
+
+/* Starts writing every call, with or without smbcw_set_stats, to a binary trace
+   file at path, "%p" is replaced by the process id. With "%p" forked children
+   write files of their own from their first call on, otherwise only this process
+   traces. Each record holds the operation, salted hashes of the paths without
+   credentials, size, offset, descriptor, thread, latency and result. Calls smbcw
+   makes internally are not recorded. test/trace_replay.c re-executes a trace. A
+   running trace is stopped first. Returns -1 if the file could not be created. */
+extern int smbcw_trace_start(const char *path);
+/* Writes the buffered records and closes the trace file. Also done by
+   smbcw_finalize. */
+extern void smbcw_trace_stop();
+
+/* Classes of operations with their own threshold of the slow log */
+#define SMBCW_SLOW_METADATA 0		/* stat, fstat, seek, rename, unlink, mkdir, rmdir, chmod */
+#define SMBCW_SLOW_READ 1				/* read, pread, copy, fcopy, parallel_get */
+#define SMBCW_SLOW_WRITE 2			/* write, pwrite, flush, parallel_put */
+#define SMBCW_SLOW_OPEN 3				/* open, close, opendir, closedir */
+#define SMBCW_SLOW_READDIR 4		/* readdir, readdirplus, rewinddir */
+#define SMBCW_SLOW_CLASS_COUNT 5
+
+/* Destination of smbcw_set_slow_log which sends the lines to syslog */
+#define SMBCW_SLOW_LOG_SYSLOG -2
+
+/* Logs every call of the class cls (SMBCW_SLOW_*) which takes ms milliseconds or
+   longer with operation, server, share, path (never user or password), bytes
+   transferred, duration and result. 0 disables the log of the class (default).
+   Works without smbcw_set_stats. Returns -1 if cls is invalid. */
+extern int smbcw_set_slow_threshold(int cls, int64_t ms);
+/* Sets the descriptor the slow log is written to, one line per call.
+   SMBCW_SLOW_LOG_SYSLOG (default) logs with syslog(LOG_WARNING), -1 drops the
+   lines. The descriptor is not closed by smbcw. */
+extern void smbcw_set_slow_log(int fd);
+
 //extern void smbcw_getattrs(char *url);
 
 #endif /* _SMBCW_H */
@@ -0,0 +1,721 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "smbcw.h"
+#include "smbcw_common.h"
+#include "smbcw_connections.h"
+#include "smbcw_async.h"
+
+#define ASYNC_FD_BUCKETS 256
+
+/**
+ * Request submitted by one of the smbcw_async_* calls. The completion is filled
+ * in by the worker and handed to the queue as it is.
+ */
+typedef struct t_smbcw_async_request {
+	smbcw_completion completion;
+	smbcw_async_queue *queue;
+
+	//Parameters of the call, url and mode are owned by the request
+	int fd;
+	char *url;
+	char *mode;
+	char *buf;
+	uint64_t size;
+	smbcw_stat *stat;
+
+	struct t_smbcw_async_request *next;
+} t_smbcw_async_request;
+
+/**
+ * Pointer on t_smbcw_async_request
+ */
+typedef t_smbcw_async_request *lp_smbcw_async_request;
+
+typedef struct {
+	pthread_t thread;
+	pthread_cond_t cond;
+	int index;
+
+	//Requests waiting to be executed by this worker
+	lp_smbcw_async_request head;
+	lp_smbcw_async_request tail;
+	int queued;
+} t_smbcw_async_worker;
+
+struct smbcw_async_queue {
+	//Signalled as long as done_head is not empty
+	int efd;
+
+	lp_smbcw_async_request done_head;
+	lp_smbcw_async_request done_tail;
+
+	//Requests which have not been reaped and which have not completed yet
+	int pending;
+	int running;
+
+	//Signalled whenever a request of this queue completed
+	pthread_cond_t cond;
+};
+
+/**
+ * Descriptor opened by a worker, requests on it have to be executed there
+ */
+typedef struct t_smbcw_async_fd {
+	int fd;
+	int worker;
+	int dir;
+	smbcw_async_queue *queue;
+	struct t_smbcw_async_fd *next;
+} t_smbcw_async_fd;
+
+/**
+ * Pointer on t_smbcw_async_fd
+ */
+typedef t_smbcw_async_fd *lp_smbcw_async_fd;
+
+/**
+ * Protects the workers, their request lists, the queues and the descriptor table
+ */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The workers are started with the first request and stopped by async_finalize
+ */
+static t_smbcw_async_worker *async_workers = NULL;
+static int async_worker_count = 0;
+static int async_workers_wanted = DEFAULT_ASYNC_WORKERS;
+static int async_stop = 0;
+
+static int64_t async_next_id = 1;
+
+static lp_smbcw_async_fd async_fds[ASYNC_FD_BUCKETS];
+
+/**
+ * Returns the link pointing on the table entry of fd or on the end of its bucket
+ */
+static lp_smbcw_async_fd *async_fd_link(int fd)
+{
+	lp_smbcw_async_fd *link = &async_fds[(unsigned int)fd % ASYNC_FD_BUCKETS];
+
+	while (*link && (*link)->fd != fd)
+		link = &(*link)->next;
+
+	return link;
+}
+
+/**
+ * Executes the call of a request in the calling worker thread
+ */
+static void async_execute(lp_smbcw_async_request req)
+{
+	smbcw_stat stat;
+	char *name;
+	int64_t ret = -1;
+
+	switch (req->completion.op)
+	{
+		case SMBCW_ASYNC_OPEN:
+			ret = smbcw_fopen(req->url, req->mode);
+			break;
+		case SMBCW_ASYNC_READ:
+			ret = smbcw_fread(req->fd, req->buf, req->size);
+			break;
+		case SMBCW_ASYNC_WRITE:
+			ret = smbcw_fwrite(req->fd, req->buf, req->size);
+			break;
+		case SMBCW_ASYNC_STAT:
+			ret = smbcw_urlstat(req->url, req->stat);
+			break;
+		case SMBCW_ASYNC_OPENDIR:
+			ret = smbcw_opendir(req->url);
+			break;
+		case SMBCW_ASYNC_READDIR:
+			ret = smbcw_readdirplus(req->fd, &name, req->stat ? req->stat : &stat);
+
+			//The name is only valid until the next call on the descriptor
+			if (ret >= 0 && strlen(name) >= req->size) {
+				req->completion.result = -1;
+				req->completion.err = ENAMETOOLONG;
+				return;
+			}
+			if (ret >= 0)
+				strcpy(req->buf, name);
+			break;
+		case SMBCW_ASYNC_CLOSE:
+			ret = smbcw_fclose(req->fd);
+			break;
+		case SMBCW_ASYNC_CLOSEDIR:
+			ret = smbcw_closedir(req->fd);
+			break;
+	}
+
+	req->completion.result = ret;
+	req->completion.err = (ret < 0) ? smbcw_geterr() : 0;
+}
+
+/**
+ * Hands an executed request to its queue. Has to be called with the lock held.
+ */
+static void async_complete(lp_smbcw_async_request req)
+{
+	smbcw_async_queue *queue = req->queue;
+	uint64_t one = 1;
+
+	req->next = NULL;
+	if (queue->done_tail)
+		queue->done_tail->next = req;
+	else
+		queue->done_head = req;
+	queue->done_tail = req;
+
+	queue->running--;
+	write(queue->efd, &one, sizeof(one));
+	pthread_cond_broadcast(&queue->cond);
+}
+
+/**
+ * Body of a worker thread
+ */
+static void *async_thread(void *arg)
+{
+	t_smbcw_async_worker *worker = arg;
+
+	//The threads submitting requests may hold all contexts of a pool, e.g. for
+	//an open file, while they wait for the result
+	connections_set_thread_private(1);
+
+	pthread_mutex_lock(&async_lock);
+
+	while (1)
+	{
+		lp_smbcw_async_request req = worker->head;
+
+		if (!req) {
+			if (async_stop)
+				break;
+			pthread_cond_wait(&worker->cond, &async_lock);
+			continue;
+		}
+
+		worker->head = req->next;
+		if (!worker->head)
+			worker->tail = NULL;
+		worker->queued--;
+
+		pthread_mutex_unlock(&async_lock);
+		async_execute(req);
+		pthread_mutex_lock(&async_lock);
+
+		int op = req->completion.op;
+
+		//Remember which worker holds the context of a new descriptor
+		if ((op == SMBCW_ASYNC_OPEN || op == SMBCW_ASYNC_OPENDIR) &&
+			req->completion.result > 0)
+		{
+			lp_smbcw_async_fd entry = malloc(sizeof(*entry));
+			if (entry) {
+				entry->fd = req->completion.result;
+				entry->worker = worker->index;
+				entry->dir = (op == SMBCW_ASYNC_OPENDIR);
+				entry->queue = req->queue;
+				entry->next = NULL;
+				*async_fd_link(entry->fd) = entry;
+			}
+		}
+
+		//Closing frees the descriptor, even if the close failed
+		if (op == SMBCW_ASYNC_CLOSE || op == SMBCW_ASYNC_CLOSEDIR)
+		{
+			lp_smbcw_async_fd *link = async_fd_link(req->fd);
+			lp_smbcw_async_fd entry = *link;
+			if (entry) {
+				*link = entry->next;
+				free(entry);
+			}
+		}
+
+		async_complete(req);
+	}
+
+	pthread_mutex_unlock(&async_lock);
+
+	return NULL;
+}
+
+/**
+ * Starts the workers. Has to be called with the lock held. Returns -1 if not a
+ * single worker could be started.
+ */
+static int async_start()
+{
+	int i;
+
+	async_workers = calloc(async_workers_wanted, sizeof(*async_workers));
+	if (!async_workers)
+		return -1;
+
+	for (i = 0; i < async_workers_wanted; i++)
+	{
+		t_smbcw_async_worker *worker = &async_workers[i];
+
+		pthread_cond_init(&worker->cond, NULL);
+		worker->index = i;
+
+		if (pthread_create(&worker->thread, NULL, &async_thread, worker) != 0) {
+			pthread_cond_destroy(&worker->cond);
+			break;
+		}
+	}
+
+	async_worker_count = i;
+	if (!async_worker_count) {
+		free(async_workers);
+		async_workers = NULL;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Frees a request which has not been passed to the caller
+ */
+static void async_free_request(lp_smbcw_async_request req)
+{
+	free(req->url);
+	free(req->mode);
+	free(req);
+}
+
+/**
+ * Appends a request to the list of the worker which has to execute it. Has to be
+ * called with the lock held. Returns the id of the request or -1, in which case
+ * the request has not been taken.
+ */
+static int64_t async_enqueue(lp_smbcw_async_request req)
+{
+	t_smbcw_async_worker *worker;
+	int i;
+
+	if (!async_workers && async_start() < 0)
+		return -1;
+
+	if (!req->url)
+	{
+		lp_smbcw_async_fd entry = *async_fd_link(req->fd);
+		if (!entry) {
+			errno = EBADF;
+			return -1;
+		}
+		worker = &async_workers[entry->worker];
+	}
+	else
+	{
+		worker = &async_workers[0];
+		for (i = 1; i < async_worker_count; i++)
+			if (async_workers[i].queued < worker->queued)
+				worker = &async_workers[i];
+	}
+
+	req->completion.id = async_next_id++;
+	req->next = NULL;
+	if (worker->tail)
+		worker->tail->next = req;
+	else
+		worker->head = req;
+	worker->tail = req;
+	worker->queued++;
+
+	req->queue->pending++;
+	req->queue->running++;
+
+	pthread_cond_signal(&worker->cond);
+
+	return req->completion.id;
+}
+
+/* See async.h */
+int async_cancel(smbcw_async_queue *queue)
+{
+	int i, cancelled = 0;
+
+	pthread_mutex_lock(&async_lock);
+
+	for (i = 0; i < async_worker_count; i++)
+	{
+		t_smbcw_async_worker *worker = &async_workers[i];
+		lp_smbcw_async_request *link = &worker->head;
+
+		worker->tail = NULL;
+		while (*link)
+		{
+			lp_smbcw_async_request req = *link;
+
+			if (req->queue != queue || !req->url) {
+				worker->tail = req;
+				link = &req->next;
+				continue;
+			}
+
+			*link = req->next;
+			worker->queued--;
+
+			req->completion.result = -1;
+			req->completion.err = ECANCELED;
+			async_complete(req);
+			cancelled++;
+		}
+	}
+
+	pthread_mutex_unlock(&async_lock);
+
+	return cancelled;
+}
+
+/**
+ * Allocates a request for the given operation
+ */
+static lp_smbcw_async_request async_request(smbcw_async_queue *queue, int op,
+	void *priv)
+{
+	if (!queue) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	lp_smbcw_async_request req = calloc(1, sizeof(*req));
+
+	if (req) {
+		req->queue = queue;
+		req->completion.op = op;
+		req->completion.priv = priv;
+	}
+
+	return req;
+}
+
+/**
+ * Submits the given request, which is freed if that fails
+ */
+static int64_t async_submit(lp_smbcw_async_request req)
+{
+	if (!req)
+		return -1;
+
+	pthread_mutex_lock(&async_lock);
+	int64_t id = async_enqueue(req);
+	int err = errno;
+	pthread_mutex_unlock(&async_lock);
+
+	if (id < 0) {
+		async_free_request(req);
+		errno = err;
+	}
+
+	return id;
+}
+
+/* See async.h */
+void async_finalize()
+{
+	int i;
+
+	pthread_mutex_lock(&async_lock);
+	async_stop = 1;
+	for (i = 0; i < async_worker_count; i++)
+		pthread_cond_signal(&async_workers[i].cond);
+	pthread_mutex_unlock(&async_lock);
+
+	for (i = 0; i < async_worker_count; i++) {
+		pthread_join(async_workers[i].thread, NULL);
+		pthread_cond_destroy(&async_workers[i].cond);
+	}
+
+	free(async_workers);
+	async_workers = NULL;
+	async_worker_count = 0;
+	async_stop = 0;
+
+	for (i = 0; i < ASYNC_FD_BUCKETS; i++)
+		while (async_fds[i]) {
+			lp_smbcw_async_fd next = async_fds[i]->next;
+			free(async_fds[i]);
+			async_fds[i] = next;
+		}
+}
+
+void smbcw_set_async_workers(int workers)
+{
+	pthread_mutex_lock(&async_lock);
+	if (!async_workers)
+		async_workers_wanted = workers > 0 ? workers : DEFAULT_ASYNC_WORKERS;
+	pthread_mutex_unlock(&async_lock);
+}
+
+smbcw_async_queue *smbcw_async_create()
+{
+	smbcw_async_queue *queue = calloc(1, sizeof(*queue));
+
+	if (queue)
+	{
+		queue->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (queue->efd < 0) {
+			free(queue);
+			return NULL;
+		}
+
+		pthread_cond_init(&queue->cond, NULL);
+	}
+
+	return queue;
+}
+
+void smbcw_async_destroy(smbcw_async_queue *queue)
+{
+	int i;
+
+	if (!queue)
+		return;
+
+	pthread_mutex_lock(&async_lock);
+
+	while (queue->running)
+		pthread_cond_wait(&queue->cond, &async_lock);
+
+	//Close the descriptors the caller left open on the workers holding them
+	for (i = 0; i < ASYNC_FD_BUCKETS; i++)
+	{
+		lp_smbcw_async_fd entry;
+
+		for (entry = async_fds[i]; entry; entry = entry->next)
+		{
+			if (entry->queue != queue)
+				continue;
+
+			lp_smbcw_async_request req = async_request(queue,
+				entry->dir ? SMBCW_ASYNC_CLOSEDIR : SMBCW_ASYNC_CLOSE, NULL);
+			if (req) {
+				req->fd = entry->fd;
+				if (async_enqueue(req) < 0)
+					async_free_request(req);
+			}
+		}
+	}
+
+	while (queue->running)
+		pthread_cond_wait(&queue->cond, &async_lock);
+
+	pthread_mutex_unlock(&async_lock);
+
+	while (queue->done_head) {
+		lp_smbcw_async_request next = queue->done_head->next;
+		async_free_request(queue->done_head);
+		queue->done_head = next;
+	}
+
+	close(queue->efd);
+	pthread_cond_destroy(&queue->cond);
+	free(queue);
+}
+
+int smbcw_async_fd(smbcw_async_queue *queue)
+{
+	return queue->efd;
+}
+
+int smbcw_async_pending(smbcw_async_queue *queue)
+{
+	pthread_mutex_lock(&async_lock);
+	int pending = queue->pending;
+	pthread_mutex_unlock(&async_lock);
+
+	return pending;
+}
+
+int smbcw_async_reap(smbcw_async_queue *queue, smbcw_completion *done, int max)
+{
+	int count = 0;
+
+	pthread_mutex_lock(&async_lock);
+
+	while (count < max && queue->done_head)
+	{
+		lp_smbcw_async_request req = queue->done_head;
+
+		queue->done_head = req->next;
+		if (!queue->done_head)
+			queue->done_tail = NULL;
+
+		done[count++] = req->completion;
+		async_free_request(req);
+	}
+
+	queue->pending -= count;
+
+	//Reset the event counter once all completions are gone
+	if (!queue->done_head) {
+		uint64_t value;
+		read(queue->efd, &value, sizeof(value));
+	}
+
+	pthread_mutex_unlock(&async_lock);
+
+	return count;
+}
+
+int smbcw_async_wait(smbcw_async_queue *queue, smbcw_completion *done, int max,
+	int timeout)
+{
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = queue->efd;
+	pfd.events = POLLIN;
+
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -1;
+
+	return smbcw_async_reap(queue, done, max);
+}
+
+int64_t smbcw_async_open(smbcw_async_queue *queue, char *url, char *mode,
+	void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_OPEN, priv);
+
+	if (req) {
+		req->url = strdup(url);
+		req->mode = strdup(mode);
+		if (!req->url || !req->mode) {
+			async_free_request(req);
+			return -1;
+		}
+	}
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_read(smbcw_async_queue *queue, int fd, char *buf,
+	uint64_t size, void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_READ, priv);
+
+	if (req) {
+		req->fd = fd;
+		req->buf = buf;
+		req->size = size;
+	}
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_write(smbcw_async_queue *queue, int fd, char *buf,
+	uint64_t size, void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_WRITE, priv);
+
+	if (req) {
+		req->fd = fd;
+		req->buf = buf;
+		req->size = size;
+	}
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_stat(smbcw_async_queue *queue, char *url, smbcw_stat *stat,
+	void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_STAT, priv);
+
+	if (req) {
+		req->stat = stat;
+		req->url = strdup(url);
+		if (!req->url) {
+			async_free_request(req);
+			return -1;
+		}
+	}
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_opendir(smbcw_async_queue *queue, char *url, void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_OPENDIR, priv);
+
+	if (req) {
+		req->url = strdup(url);
+		if (!req->url) {
+			async_free_request(req);
+			return -1;
+		}
+	}
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_readdir(smbcw_async_queue *queue, int fd, char *name,
+	size_t name_size, smbcw_stat *stat, void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_READDIR, priv);
+
+	if (req) {
+		req->fd = fd;
+		req->buf = name;
+		req->size = name_size;
+		req->stat = stat;
+	}
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_close(smbcw_async_queue *queue, int fd, void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_CLOSE, priv);
+
+	if (req)
+		req->fd = fd;
+
+	return async_submit(req);
+}
+
+int64_t smbcw_async_closedir(smbcw_async_queue *queue, int fd, void *priv)
+{
+	lp_smbcw_async_request req = async_request(queue, SMBCW_ASYNC_CLOSEDIR, priv);
+
+	if (req)
+		req->fd = fd;
+
+	return async_submit(req);
+}
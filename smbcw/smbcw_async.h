@@ -0,0 +1,45 @@
+#ifndef _ASYNC_H
+#define _ASYNC_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Worker threads behind the smbcw_async_* calls declared in smbcw.h. Each worker
+ * has its own request list. Requests on an url go to the worker with the
+ * fewest requests waiting, requests on a descriptor to the worker which opened
+ * it, as the descriptor keeps the context of that worker checked out.
+ */
+
+/**
+ * Takes the requests of queue which no worker has started yet off the request
+ * lists and completes them with result -1 and err ECANCELED, so that the caller
+ * may execute them itself. Requests on descriptors are left alone. Returns the
+ * number of cancelled requests.
+ */
+int async_cancel(smbcw_async_queue *queue);
+
+/**
+ * Stops the worker threads after the requests already submitted have been
+ * executed. Has to be called before the connections are finalized. The queues
+ * have to be destroyed before.
+ */
+void async_finalize();
+
+#endif /*_ASYNC_H*/
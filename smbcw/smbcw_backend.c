@@ -0,0 +1,321 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <libsmbclient.h>
+
+#include "smbcw.h"
+#include "smbcw_backend.h"
+#include "smbcw_connections.h"
+#include "smbcw_fake.h"
+
+/**
+ * Makes sure libsmbclient is told only once that it is used by several threads
+ */
+static pthread_once_t backend_thread_init = PTHREAD_ONCE_INIT;
+
+/**
+ * Prepares libsmbclient for being used with several contexts and threads
+ */
+static void backend_libsmbclient_init()
+{
+	//Contexts may be used by several threads, one at a time
+	pthread_once(&backend_thread_init, &smbc_thread_posix);
+
+	smbc_set_context(NULL);
+}
+
+/**
+ * The functions of libsmbclient itself
+ */
+t_smbcw_backend backend_libsmbclient = {
+	"libsmbclient",
+	&backend_libsmbclient_init,
+	&smbc_new_context,
+	&smbc_init_context,
+	&smbc_free_context,
+	&smbc_setDebug,
+	&smbc_getOptionUserData,
+	&smbc_setOptionUserData,
+	&smbc_setFunctionAuthDataWithContext,
+	&smbc_getFunctionOpen,
+	&smbc_getFunctionRead,
+	&smbc_getFunctionWrite,
+	&smbc_getFunctionLseek,
+	&smbc_getFunctionClose,
+	&smbc_getFunctionStat,
+	&smbc_getFunctionFstat,
+	&smbc_getFunctionUnlink,
+	&smbc_getFunctionRename,
+	&smbc_getFunctionMkdir,
+	&smbc_getFunctionRmdir,
+	&smbc_getFunctionChmod,
+	&smbc_getFunctionOpendir,
+	&smbc_getFunctionReaddir,
+	&smbc_getFunctionClosedir,
+	&smbc_getFunctionLseekdir,
+#ifdef HAVE_SMBC_READDIRPLUS2
+	&smbc_getFunctionReaddirPlus2,
+#endif
+#ifdef HAVE_SMBC_SPLICE
+	&smbc_getFunctionSplice,
+#endif
+};
+
+/**
+ * The backend selected with backend_select
+ */
+static lp_smbcw_backend backend_impl = &backend_libsmbclient;
+
+__thread uint64_t backend_round_trips = 0;
+
+/**
+ * Counts a call of a function of the selected backend
+ */
+#define _COUNT_CALL backend_round_trips++
+
+/**
+ * The functions of the counting layer. They count each call and forward it to
+ * the function of the selected backend.
+ */
+static SMBCFILE *counting_open(SMBCCTX *c, const char *fname, int flags,
+	mode_t mode)
+{
+	_COUNT_CALL;
+	return backend_impl->get_open(c)(c, fname, flags, mode);
+}
+
+static ssize_t counting_read(SMBCCTX *c, SMBCFILE *file, void *buf, size_t count)
+{
+	_COUNT_CALL;
+	return backend_impl->get_read(c)(c, file, buf, count);
+}
+
+static ssize_t counting_write(SMBCCTX *c, SMBCFILE *file, const void *buf,
+	size_t count)
+{
+	_COUNT_CALL;
+	return backend_impl->get_write(c)(c, file, buf, count);
+}
+
+static off_t counting_lseek(SMBCCTX *c, SMBCFILE *file, off_t offset, int whence)
+{
+	_COUNT_CALL;
+	return backend_impl->get_lseek(c)(c, file, offset, whence);
+}
+
+static int counting_close(SMBCCTX *c, SMBCFILE *file)
+{
+	_COUNT_CALL;
+	return backend_impl->get_close(c)(c, file);
+}
+
+static int counting_stat(SMBCCTX *c, const char *fname, struct stat *st)
+{
+	_COUNT_CALL;
+	return backend_impl->get_stat(c)(c, fname, st);
+}
+
+static int counting_fstat(SMBCCTX *c, SMBCFILE *file, struct stat *st)
+{
+	_COUNT_CALL;
+	return backend_impl->get_fstat(c)(c, file, st);
+}
+
+static int counting_unlink(SMBCCTX *c, const char *fname)
+{
+	_COUNT_CALL;
+	return backend_impl->get_unlink(c)(c, fname);
+}
+
+static int counting_rename(SMBCCTX *oc, const char *oname, SMBCCTX *nc,
+	const char *nname)
+{
+	_COUNT_CALL;
+	return backend_impl->get_rename(oc)(oc, oname, nc, nname);
+}
+
+static int counting_mkdir(SMBCCTX *c, const char *fname, mode_t mode)
+{
+	_COUNT_CALL;
+	return backend_impl->get_mkdir(c)(c, fname, mode);
+}
+
+static int counting_rmdir(SMBCCTX *c, const char *fname)
+{
+	_COUNT_CALL;
+	return backend_impl->get_rmdir(c)(c, fname);
+}
+
+static int counting_chmod(SMBCCTX *c, const char *fname, mode_t mode)
+{
+	_COUNT_CALL;
+	return backend_impl->get_chmod(c)(c, fname, mode);
+}
+
+static SMBCFILE *counting_opendir(SMBCCTX *c, const char *fname)
+{
+	_COUNT_CALL;
+	return backend_impl->get_opendir(c)(c, fname);
+}
+
+static struct smbc_dirent *counting_readdir(SMBCCTX *c, SMBCFILE *dir)
+{
+	_COUNT_CALL;
+	return backend_impl->get_readdir(c)(c, dir);
+}
+
+static int counting_closedir(SMBCCTX *c, SMBCFILE *dir)
+{
+	_COUNT_CALL;
+	return backend_impl->get_closedir(c)(c, dir);
+}
+
+static int counting_lseekdir(SMBCCTX *c, SMBCFILE *dir, off_t offset)
+{
+	_COUNT_CALL;
+	return backend_impl->get_lseekdir(c)(c, dir, offset);
+}
+
+#ifdef HAVE_SMBC_READDIRPLUS2
+static const struct libsmb_file_info *counting_readdirplus2(SMBCCTX *c,
+	SMBCFILE *dir, struct stat *st)
+{
+	_COUNT_CALL;
+	return backend_impl->get_readdirplus2(c)(c, dir, st);
+}
+#endif
+
+#ifdef HAVE_SMBC_SPLICE
+static off_t counting_splice(SMBCCTX *c, SMBCFILE *srcfile, SMBCFILE *dstfile,
+	off_t count, int (*splice_cb)(off_t n, void *priv), void *priv)
+{
+	_COUNT_CALL;
+	return backend_impl->get_splice(c)(c, srcfile, dstfile, count, splice_cb, priv);
+}
+#endif
+
+static void counting_init() { backend_impl->init(); }
+static SMBCCTX *counting_new_context() { return backend_impl->new_context(); }
+static SMBCCTX *counting_init_context(SMBCCTX *c) { return backend_impl->init_context(c); }
+static int counting_free_context(SMBCCTX *c, int shutdown_ctx) { return backend_impl->free_context(c, shutdown_ctx); }
+static void counting_set_debug(SMBCCTX *c, int debug) { backend_impl->set_debug(c, debug); }
+static void *counting_get_user_data(SMBCCTX *c) { return backend_impl->get_user_data(c); }
+static void counting_set_user_data(SMBCCTX *c, void *data) { backend_impl->set_user_data(c, data); }
+static void counting_set_auth_fn(SMBCCTX *c, smbc_get_auth_data_with_context_fn fn) { backend_impl->set_auth_fn(c, fn); }
+
+static smbc_open_fn counting_get_open(SMBCCTX *c) { return &counting_open; }
+static smbc_read_fn counting_get_read(SMBCCTX *c) { return &counting_read; }
+static smbc_write_fn counting_get_write(SMBCCTX *c) { return &counting_write; }
+static smbc_lseek_fn counting_get_lseek(SMBCCTX *c) { return &counting_lseek; }
+static smbc_close_fn counting_get_close(SMBCCTX *c) { return &counting_close; }
+static smbc_stat_fn counting_get_stat(SMBCCTX *c) { return &counting_stat; }
+static smbc_fstat_fn counting_get_fstat(SMBCCTX *c) { return &counting_fstat; }
+static smbc_unlink_fn counting_get_unlink(SMBCCTX *c) { return &counting_unlink; }
+static smbc_rename_fn counting_get_rename(SMBCCTX *c) { return &counting_rename; }
+static smbc_mkdir_fn counting_get_mkdir(SMBCCTX *c) { return &counting_mkdir; }
+static smbc_rmdir_fn counting_get_rmdir(SMBCCTX *c) { return &counting_rmdir; }
+static smbc_chmod_fn counting_get_chmod(SMBCCTX *c) { return &counting_chmod; }
+static smbc_opendir_fn counting_get_opendir(SMBCCTX *c) { return &counting_opendir; }
+static smbc_readdir_fn counting_get_readdir(SMBCCTX *c) { return &counting_readdir; }
+static smbc_closedir_fn counting_get_closedir(SMBCCTX *c) { return &counting_closedir; }
+static smbc_lseekdir_fn counting_get_lseekdir(SMBCCTX *c) { return &counting_lseekdir; }
+#ifdef HAVE_SMBC_READDIRPLUS2
+static smbc_readdirplus2_fn counting_get_readdirplus2(SMBCCTX *c) { return &counting_readdirplus2; }
+#endif
+#ifdef HAVE_SMBC_SPLICE
+static smbc_splice_fn counting_get_splice(SMBCCTX *c) { return &counting_splice; }
+#endif
+
+/**
+ * Table the modules call through, see backend_active
+ */
+static t_smbcw_backend backend_counting = {
+	"counting",
+	&counting_init,
+	&counting_new_context,
+	&counting_init_context,
+	&counting_free_context,
+	&counting_set_debug,
+	&counting_get_user_data,
+	&counting_set_user_data,
+	&counting_set_auth_fn,
+	&counting_get_open,
+	&counting_get_read,
+	&counting_get_write,
+	&counting_get_lseek,
+	&counting_get_close,
+	&counting_get_stat,
+	&counting_get_fstat,
+	&counting_get_unlink,
+	&counting_get_rename,
+	&counting_get_mkdir,
+	&counting_get_rmdir,
+	&counting_get_chmod,
+	&counting_get_opendir,
+	&counting_get_readdir,
+	&counting_get_closedir,
+	&counting_get_lseekdir,
+#ifdef HAVE_SMBC_READDIRPLUS2
+	&counting_get_readdirplus2,
+#endif
+#ifdef HAVE_SMBC_SPLICE
+	&counting_get_splice,
+#endif
+};
+
+lp_smbcw_backend backend_active = &backend_counting;
+
+/* See backend.h */
+int backend_select(int id)
+{
+	lp_smbcw_backend backend;
+	uint64_t contexts = 0;
+
+	switch (id) {
+		case SMBCW_BACKEND_LIBSMBCLIENT:
+			backend = &backend_libsmbclient;
+			break;
+		case SMBCW_BACKEND_FAKE:
+			backend = &backend_fake;
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	//Contexts must be freed by the backend which created them
+	connections_get_stats(NULL, NULL, &contexts, NULL);
+	if (contexts > 0 && backend != backend_impl) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	backend_impl = backend;
+	backend_impl->init();
+
+	return 0;
+}
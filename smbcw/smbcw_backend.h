@@ -0,0 +1,101 @@
+#ifndef _BACKEND_H
+#define _BACKEND_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include <libsmbclient.h>
+
+/**
+ * Dispatch table of the functions smbcw uses to talk to a server. Every module
+ * calls them through backend_active instead of calling libsmbclient directly, so
+ * a different implementation (see smbcw_fake.h) can be put in place. The members
+ * mirror the libsmbclient functions of the same name, the get_* members return
+ * the function of the given context.
+ */
+typedef struct {
+	const char *name;
+
+	//Called by connections_init before any context is created
+	void (*init)();
+
+	SMBCCTX *(*new_context)();
+	SMBCCTX *(*init_context)(SMBCCTX *ctx);
+	int (*free_context)(SMBCCTX *ctx, int shutdown_ctx);
+	void (*set_debug)(SMBCCTX *ctx, int debug);
+	void *(*get_user_data)(SMBCCTX *ctx);
+	void (*set_user_data)(SMBCCTX *ctx, void *user_data);
+	void (*set_auth_fn)(SMBCCTX *ctx, smbc_get_auth_data_with_context_fn fn);
+
+	smbc_open_fn (*get_open)(SMBCCTX *ctx);
+	smbc_read_fn (*get_read)(SMBCCTX *ctx);
+	smbc_write_fn (*get_write)(SMBCCTX *ctx);
+	smbc_lseek_fn (*get_lseek)(SMBCCTX *ctx);
+	smbc_close_fn (*get_close)(SMBCCTX *ctx);
+	smbc_stat_fn (*get_stat)(SMBCCTX *ctx);
+	smbc_fstat_fn (*get_fstat)(SMBCCTX *ctx);
+	smbc_unlink_fn (*get_unlink)(SMBCCTX *ctx);
+	smbc_rename_fn (*get_rename)(SMBCCTX *ctx);
+	smbc_mkdir_fn (*get_mkdir)(SMBCCTX *ctx);
+	smbc_rmdir_fn (*get_rmdir)(SMBCCTX *ctx);
+	smbc_chmod_fn (*get_chmod)(SMBCCTX *ctx);
+	smbc_opendir_fn (*get_opendir)(SMBCCTX *ctx);
+	smbc_readdir_fn (*get_readdir)(SMBCCTX *ctx);
+	smbc_closedir_fn (*get_closedir)(SMBCCTX *ctx);
+	smbc_lseekdir_fn (*get_lseekdir)(SMBCCTX *ctx);
+
+	//Functions of newer libsmbclient versions. They have to stay at the end, as
+	//only the files which include config.h see them.
+#ifdef HAVE_SMBC_READDIRPLUS2
+	smbc_readdirplus2_fn (*get_readdirplus2)(SMBCCTX *ctx);
+#endif
+#ifdef HAVE_SMBC_SPLICE
+	smbc_splice_fn (*get_splice)(SMBCCTX *ctx);
+#endif
+} t_smbcw_backend;
+
+/**
+ * Pointer on t_smbcw_backend
+ */
+typedef t_smbcw_backend *lp_smbcw_backend;
+
+/**
+ * The table all modules call through. It forwards every call to the backend
+ * selected with backend_select, libsmbclient by default, and counts the calls of
+ * the file functions in backend_round_trips.
+ */
+extern lp_smbcw_backend backend_active;
+
+/**
+ * Number of file function calls (open, read, stat, ...) the calling thread has
+ * made through backend_active so far. The difference before and after a public
+ * function is the number of round trips it needed.
+ */
+extern __thread uint64_t backend_round_trips;
+
+/**
+ * Makes the backend with the given id (SMBCW_BACKEND_*) the active one. Fails with
+ * EINVAL for unknown ids and with EBUSY if contexts of the current backend are
+ * still open. Returns 0 on success, -1 on failure.
+ */
+int backend_select(int id);
+
+#endif /*_BACKEND_H*/
@@ -0,0 +1,365 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "smbcw_common.h"
+#include "smbcw_cache.h"
+
+/**
+ * Returns the value stored behind the given entry
+ */
+#define CACHE_VALUE(entry) ((void*)((entry) + 1))
+
+/**
+ * Hashes the context pointer and the key
+ */
+static uint32_t cache_hash(SMBCCTX *ctx, const char *key, size_t key_len)
+{
+	uint32_t hash = SMBCW_HASH_INIT ^ (uint32_t)((uintptr_t)ctx >> 4);
+	size_t i;
+
+	for (i = 0; i < key_len; i++)
+		hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * Removes the given entry from the LRU list.
+ */
+static void cache_lru_unlink(lp_smbcw_cache cache, lp_smbcw_cache_entry entry)
+{
+	lp_smbcw_cache_entry prev = entry->lru_prev;
+	lp_smbcw_cache_entry next = entry->lru_next;
+
+	if (prev)
+		prev->lru_next = next;
+	else
+		cache->lru_head = next;
+
+	if (next)
+		next->lru_prev = prev;
+	else
+		cache->lru_tail = prev;
+
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+/**
+ * Inserts the given entry at the head of the LRU list.
+ */
+static void cache_lru_push(lp_smbcw_cache cache, lp_smbcw_cache_entry entry)
+{
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = entry;
+	cache->lru_head = entry;
+	if (!cache->lru_tail)
+		cache->lru_tail = entry;
+}
+
+/**
+ * Removes the given entry from the cache and frees it.
+ */
+static void cache_drop(lp_smbcw_cache cache, lp_smbcw_cache_entry entry)
+{
+	lp_smbcw_cache_entry *link =
+		&cache->buckets[entry->hash & (cache->bucket_count - 1)];
+
+	//Remove the entry from its bucket
+	while (*link && *link != entry)
+		link = (lp_smbcw_cache_entry*)&(*link)->next;
+	if (*link)
+		*link = entry->next;
+
+	cache_lru_unlink(cache, entry);
+	cache->count--;
+
+	if (cache->value_free)
+		cache->value_free(CACHE_VALUE(entry));
+	free(entry);
+}
+
+/**
+ * Searches the entry for the given context and key
+ */
+static lp_smbcw_cache_entry cache_find(lp_smbcw_cache cache, SMBCCTX *ctx,
+	const char *key, size_t key_len, uint32_t hash)
+{
+	lp_smbcw_cache_entry tmp = cache->buckets[hash & (cache->bucket_count - 1)];
+
+	while (tmp) {
+		if (tmp->hash == hash && tmp->ctx == ctx && tmp->key_len == key_len &&
+				memcmp(tmp->key, key, key_len) == 0)
+			return tmp;
+		tmp = tmp->next;
+	}
+
+	return NULL;
+}
+
+/* See cache.h */
+void cache_init(lp_smbcw_cache cache, size_t value_size,
+	void (*value_free)(void *value))
+{
+	memset(cache, 0, sizeof(*cache));
+	pthread_mutex_init(&cache->lock, NULL);
+
+	//Keep the key behind the value properly aligned
+	cache->value_size = value_size;
+	cache->value_space = (value_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	cache->value_free = value_free;
+}
+
+/**
+ * Drops all entries and the table. Has to be called with the lock held.
+ */
+static void cache_free_table(lp_smbcw_cache cache)
+{
+	while (cache->lru_tail)
+		cache_drop(cache, cache->lru_tail);
+
+	free(cache->buckets);
+	cache->buckets = NULL;
+	cache->bucket_count = 0;
+	cache->size = 0;
+}
+
+/* See cache.h */
+void cache_configure(lp_smbcw_cache cache, int size, int ttl)
+{
+	uint32_t bucket_count = 1;
+
+	pthread_mutex_lock(&cache->lock);
+
+	cache_free_table(cache);
+
+	if (size > 0 && ttl > 0)
+	{
+		while (bucket_count < size)
+			bucket_count <<= 1;
+
+		cache->buckets = malloc(bucket_count * sizeof(*cache->buckets));
+		if (cache->buckets) {
+			memset(cache->buckets, 0, bucket_count * sizeof(*cache->buckets));
+			cache->bucket_count = bucket_count;
+			cache->size = size;
+			cache->ttl = ttl;
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* See cache.h */
+void cache_finalize(lp_smbcw_cache cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	cache_free_table(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* See cache.h */
+int cache_get(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key, size_t key_len,
+	void *value)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (cache->size)
+	{
+		lp_smbcw_cache_entry entry = cache_find(cache, ctx, key, key_len,
+			cache_hash(ctx, key, key_len));
+
+		//Expired entries are dropped right away
+		if (entry && entry->expires <= time(NULL)) {
+			cache_drop(cache, entry);
+			entry = NULL;
+		}
+
+		if (entry) {
+			cache->hits++;
+
+			if (cache->lru_head != entry) {
+				cache_lru_unlink(cache, entry);
+				cache_lru_push(cache, entry);
+			}
+
+			//The entry may be replaced as soon as the lock is released
+			memcpy(value, CACHE_VALUE(entry), cache->value_size);
+			found = 1;
+		} else {
+			cache->misses++;
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return found;
+}
+
+/**
+ * Stores value for the given context and key. Has to be called with the lock held.
+ */
+static int cache_store(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key,
+	size_t key_len, const void *value)
+{
+	if (!cache->size)
+		return -1;
+
+	uint32_t hash = cache_hash(ctx, key, key_len);
+	lp_smbcw_cache_entry entry = cache_find(cache, ctx, key, key_len, hash);
+
+	if (entry) {
+		if (cache->lru_head != entry) {
+			cache_lru_unlink(cache, entry);
+			cache_lru_push(cache, entry);
+		}
+
+		if (cache->value_free)
+			cache->value_free(CACHE_VALUE(entry));
+	} else {
+		//Make room for the new entry
+		while (cache->count >= cache->size)
+			cache_drop(cache, cache->lru_tail);
+
+		//The entry is followed by the value and the key
+		entry = malloc(sizeof(*entry) + cache->value_space + key_len + 1);
+		if (!entry)
+			return -1;
+
+		memset(entry, 0, sizeof(*entry));
+		entry->ctx = ctx;
+		entry->key = (char*)CACHE_VALUE(entry) + cache->value_space;
+		entry->key_len = key_len;
+		memcpy(entry->key, key, key_len);
+		entry->key[key_len] = '\0';
+		entry->hash = hash;
+
+		lp_smbcw_cache_entry *bucket = &cache->buckets[hash & (cache->bucket_count - 1)];
+		entry->next = *bucket;
+		*bucket = entry;
+
+		cache_lru_push(cache, entry);
+		cache->count++;
+	}
+
+	memcpy(CACHE_VALUE(entry), value, cache->value_size);
+	entry->expires = time(NULL) + cache->ttl;
+
+	return 0;
+}
+
+/* See cache.h */
+int cache_put(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key, size_t key_len,
+	const void *value)
+{
+	pthread_mutex_lock(&cache->lock);
+	int ret = cache_store(cache, ctx, key, key_len, value);
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+/* See cache.h */
+void cache_remove(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key, size_t key_len)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	if (cache->size)
+	{
+		lp_smbcw_cache_entry entry = cache_find(cache, ctx, key, key_len,
+			cache_hash(ctx, key, key_len));
+
+		if (entry)
+			cache_drop(cache, entry);
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* See cache.h */
+void cache_invalidate_ctx(lp_smbcw_cache cache, SMBCCTX *ctx)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	lp_smbcw_cache_entry tmp = cache->lru_head;
+
+	while (tmp) {
+		lp_smbcw_cache_entry next = tmp->lru_next;
+		if (tmp->ctx == ctx)
+			cache_drop(cache, tmp);
+		tmp = next;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* See cache.h */
+void cache_invalidate_prefix(lp_smbcw_cache cache, SMBCCTX *ctx,
+	const char *prefix, size_t prefix_len)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	lp_smbcw_cache_entry tmp = cache->lru_head;
+
+	while (tmp) {
+		lp_smbcw_cache_entry next = tmp->lru_next;
+		if (tmp->ctx == ctx && tmp->key_len > prefix_len &&
+			tmp->key[prefix_len] == '/' && memcmp(tmp->key, prefix, prefix_len) == 0)
+			cache_drop(cache, tmp);
+		tmp = next;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* See cache.h */
+void cache_clear(lp_smbcw_cache cache)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	while (cache->lru_tail)
+		cache_drop(cache, cache->lru_tail);
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* See cache.h */
+void cache_get_stats(lp_smbcw_cache cache, uint64_t *hits, uint64_t *misses,
+	uint64_t *entries)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	if (hits)
+		*hits = cache->hits;
+	if (misses)
+		*misses = cache->misses;
+	if (entries)
+		*entries = cache->count;
+
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,139 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <libsmbclient.h>
+
+/**
+ * Generic cache which maps a context and a path like key onto a fixed size value.
+ * Entries expire after a configurable number of seconds and the least recently
+ * used entry is replaced when the cache is full. It is used for data smbcw
+ * remembers about files and directories on the server, e.g. their stat. Values
+ * are copied in and out under a lock, so a cache may be used by several threads
+ * at the same time.
+ */
+typedef struct {
+	SMBCCTX *ctx;
+	char *key;
+	size_t key_len;
+	time_t expires;
+
+	//Internally used by the cache
+	uint32_t hash;
+	void *next;
+	void *lru_prev;
+	void *lru_next;
+} t_smbcw_cache_entry;
+
+/**
+ * Pointer on t_smbcw_cache_entry
+ */
+typedef t_smbcw_cache_entry *lp_smbcw_cache_entry;
+
+typedef struct {
+	pthread_mutex_t lock;
+	lp_smbcw_cache_entry *buckets;
+	uint32_t bucket_count;
+	int size;
+	int count;
+	int ttl;
+	size_t value_size;
+	size_t value_space;
+	void (*value_free)(void *value);
+	lp_smbcw_cache_entry lru_head;
+	lp_smbcw_cache_entry lru_tail;
+	uint64_t hits;
+	uint64_t misses;
+} t_smbcw_cache;
+
+/**
+ * Pointer on t_smbcw_cache
+ */
+typedef t_smbcw_cache *lp_smbcw_cache;
+
+/**
+ * Initializes an empty, disabled cache for values of value_size bytes. If
+ * value_free is set, it is called for each value which is dropped.
+ */
+void cache_init(lp_smbcw_cache cache, size_t value_size,
+	void (*value_free)(void *value));
+
+/**
+ * Sets the maximum number of entries and the number of seconds an entry stays
+ * valid. A size or ttl <= 0 disables the cache. Empties the cache.
+ */
+void cache_configure(lp_smbcw_cache cache, int size, int ttl);
+
+/**
+ * Drops all entries and frees all memory used by the cache.
+ */
+void cache_finalize(lp_smbcw_cache cache);
+
+/**
+ * Copies the value stored for the given context and key to value and returns 1.
+ * Returns 0 if there is no such entry or it has expired.
+ */
+int cache_get(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key, size_t key_len,
+	void *value);
+
+/**
+ * Stores a copy of value for the given context and key, replacing the previous
+ * one. Either way the entry is valid for another ttl seconds. Returns -1 if the
+ * cache is disabled or out of memory, 0 otherwise.
+ */
+int cache_put(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key, size_t key_len,
+	const void *value);
+
+/**
+ * Drops the entry for the given context and key, if there is one.
+ */
+void cache_remove(lp_smbcw_cache cache, SMBCCTX *ctx, const char *key, size_t key_len);
+
+/**
+ * Drops all entries of the given context.
+ */
+void cache_invalidate_ctx(lp_smbcw_cache cache, SMBCCTX *ctx);
+
+/**
+ * Drops all entries of ctx whose key lies below the path prefix, i.e. starts with
+ * prefix followed by "/". prefix must not end with a slash.
+ */
+void cache_invalidate_prefix(lp_smbcw_cache cache, SMBCCTX *ctx,
+	const char *prefix, size_t prefix_len);
+
+/**
+ * Drops all entries.
+ */
+void cache_clear(lp_smbcw_cache cache);
+
+/**
+ * Returns the number of cache_get calls which found a valid entry (hits), the
+ * number of calls which did not (misses) and the number of entries. Any of the
+ * pointers may be NULL.
+ */
+void cache_get_stats(lp_smbcw_cache cache, uint64_t *hits, uint64_t *misses,
+	uint64_t *entries);
+
+#endif /*_CACHE_H*/
@@ -23,4 +23,52 @@
 #define DEFAULT_WORKGROUP "WORKGROUP"
 #define DEFAULT_PASSWORD ""
 
+/* Number of urls the url cache keeps by default */
+#define DEFAULT_URL_CACHE_SIZE 256
+
+/* Number of files and seconds smbcw_urlstat results are cached for */
+#define DEFAULT_STAT_CACHE_SIZE 4096
+#define DEFAULT_STAT_CACHE_TTL 2
+
+/* Number of directories and seconds the access probe results of smbcw_urlstat
+   are cached for in SMBCW_STAT_CACHED mode */
+#define DEFAULT_PROBE_CACHE_SIZE 1024
+#define DEFAULT_PROBE_CACHE_TTL 60
+
+/* Size of the reads issued for files which are read sequentially */
+#define DEFAULT_READ_AHEAD_SIZE (1024 * 1024)
+
+/* Size of the buffer small writes to a file are collected in */
+#define DEFAULT_WRITE_BUFFER_SIZE (64 * 1024)
+
+/* Size of the blocks smbcw_copy reads and writes if the server cannot copy */
+#define DEFAULT_COPY_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Number of connections and size of the chunks of smbcw_parallel_get/put */
+#define DEFAULT_TRANSFER_LANES 4
+#define DEFAULT_TRANSFER_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Number of threads executing the requests of the asynchronous calls */
+#define DEFAULT_ASYNC_WORKERS 4
+
+/* Number of missing files and seconds smbcw_urlstat remembers that they do not
+   exist */
+#define DEFAULT_NEG_CACHE_SIZE 1024
+#define DEFAULT_NEG_CACHE_TTL 2
+
+#include <stdint.h>
+
+/**
+ * Offset basis of the FNV-1a hash used by the smbcw caches
+ */
+#define SMBCW_HASH_INIT 2166136261u
+
+static inline uint32_t smbcw_hash_str(uint32_t hash, const char *str)
+{
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619u;
+
+	return hash;
+}
+
 #endif /*_SMBCW_COMMON_H*/
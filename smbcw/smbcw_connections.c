@@ -19,12 +19,20 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
 
 #include <libsmbclient.h>
 
 #include "smbcw_common.h"
 #include "smbcw_connections.h"
+#include "smbcw_backend.h"
 #include "smbcw_url.h"
+#include "smbcw_stats.h"
 
 /**
  * Alias for an pointer on SMBCCTX
@@ -32,13 +40,41 @@
 typedef SMBCCTX *lp_smbcctx;
 
 /**
- * List element internally used to keep the url descriptor and the corresponding
- * context together
+ * Element of the connection hash table internally used to keep the url descriptor
+ * and the corresponding context together
  */
 typedef struct {
 	lp_smbcw_url url;
 	lp_smbcctx ctx;
+	uint32_t hash;
 	void *next;
+
+	//Number of references (e.g. open descriptors) which keep the context alive
+	int refcount;
+	//Time the context has been handed out the last time
+	time_t last_used;
+	//Neighbours in the LRU list
+	void *lru_prev;
+	void *lru_next;
+	//Set for contexts created by connections_new_private_ctx, which are neither
+	//in the hash table nor in the LRU list
+	int is_private;
+	//The connection in the hash table heads the pool of contexts for its
+	//credentials. The other members are only linked to it, their references and
+	//LRU position are those of the head.
+	void *pool;
+	void *pool_next;
+	int pool_count;
+	//Thread which checked the context out and the number of its checkouts
+	pthread_t owner;
+	int checkouts;
+	//Set for pool members which are only used by their owner, see
+	//connections_set_thread_private
+	int reserved;
+	//Set once the connection has been removed from the table to be freed
+	int closing;
+	//Id of the server in the latency statistics, see stats_host_id
+	int host;
 } t_smbcw_connection;
 
 /**
@@ -47,74 +83,353 @@ typedef struct {
 typedef t_smbcw_connection *lp_smbcw_connection;
 
 /**
- * Global variable which holds the first element of the connections list.
+ * Initial number of buckets of the connection hash table. The table doubles its
+ * size whenever it holds more connections than buckets.
+ */
+#define CONNECTIONS_INITIAL_BUCKETS 16
+
+/**
+ * Global connection hash table. Every bucket holds a singly linked list of
+ * connections whose hash maps onto that bucket.
+ */
+lp_smbcw_connection *connection_buckets = NULL;
+uint32_t connection_bucket_count = 0;
+uint32_t connection_count = 0;
+
+/**
+ * LRU list of all connections. The head is the most recently, the tail the least
+ * recently used connection.
+ */
+lp_smbcw_connection connection_lru_head = NULL;
+lp_smbcw_connection connection_lru_tail = NULL;
+
+/**
+ * Maximum number of kept contexts and the number of seconds after which an unused
+ * context is closed. Zero disables the corresponding limit.
+ */
+int connection_max_contexts = 0;
+int connection_idle_timeout = 0;
+
+/**
+ * Maximum number of contexts per credentials and whether connections_checkout_ctx
+ * waits for a context to be checked in when all of them are in use
+ */
+int connection_pool_size = 1;
+int connection_pool_wait = 1;
+
+/**
+ * Set for threads which check out contexts of their own, see
+ * connections_set_thread_private
+ */
+static __thread int connection_thread_private = 0;
+
+/**
+ * Protects all connections and the variables of this module. The condition is
+ * signalled whenever a context is checked in.
  */
-lp_smbcw_connection first_connection = NULL;
+pthread_mutex_t connection_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t connection_cond = PTHREAD_COND_INITIALIZER;
 
 /**
- * Creates a new connection element and adds it to the connections list.
+ * Connections removed from the table which are freed by connections_unlock. The
+ * free callback must not be called with the lock held, as it locks the caches,
+ * which in turn add references to contexts while being locked.
  */
-lp_smbcw_connection connection_create()
+lp_smbcw_connection connection_closed = NULL;
+
+/**
+ * Function called whenever a context is freed
+ */
+void (*connection_free_callback)(SMBCCTX *ctx) = NULL;
+
+/**
+ * Statistic counters of connections_get_ctx
+ */
+uint64_t connection_hits = 0;
+uint64_t connection_misses = 0;
+uint64_t connection_waits = 0;
+
+/**
+ * Thread waiting in connections_checkout_ctx for a context of the given pool. The
+ * entries live on the stack of the waiting threads and are only accessed with
+ * the lock held.
+ */
+typedef struct t_connection_waiter {
+	pthread_t thread;
+	lp_smbcw_connection pool;
+	struct t_connection_waiter *next;
+} t_connection_waiter;
+
+t_connection_waiter *connection_waiters = NULL;
+int connection_waiter_count = 0;
+
+/**
+ * FNV-1a hash over a single url part. NULL and an empty string produce different
+ * hashes. If fold is set, the string is hashed case insensitive.
+ */
+static uint32_t connection_hash_str(uint32_t hash, const char *str, int fold)
+{
+	if (!str)
+		return (hash ^ 0xFF) * 16777619u;
+
+	while (*str) {
+		unsigned char c = *str++;
+		if (fold)
+			c = tolower(c);
+		hash = (hash ^ c) * 16777619u;
+	}
+
+	//Terminate each part so that "ab" + "c" and "a" + "bc" differ
+	return (hash ^ 0x00) * 16777619u;
+}
+
+/**
+ * Calculates the digest of the url parts connection_match compares: protocol,
+ * user, host (case folded) and password.
+ */
+static uint32_t connection_hash(lp_smbcw_url url)
+{
+	uint32_t hash = 2166136261u;
+
+	hash = connection_hash_str(hash, url->protocol, 0);
+	hash = connection_hash_str(hash, url->user, 0);
+	hash = connection_hash_str(hash, url->host, 1);
+	hash = connection_hash_str(hash, url->password, 0);
+
+	return hash;
+}
+
+/**
+ * Doubles the number of buckets of the connection hash table and redistributes
+ * all connections.
+ */
+static void connections_grow()
+{
+	uint32_t new_count = connection_bucket_count ?
+		connection_bucket_count * 2 : CONNECTIONS_INITIAL_BUCKETS;
+	lp_smbcw_connection *new_buckets = malloc(new_count * sizeof(*new_buckets));
+	uint32_t i;
+
+	//Keep the old table if no memory is left, lookups will only get slower
+	if (!new_buckets)
+		return;
+	memset(new_buckets, 0, new_count * sizeof(*new_buckets));
+
+	for (i = 0; i < connection_bucket_count; i++) {
+		lp_smbcw_connection tmp = connection_buckets[i];
+		while (tmp) {
+			lp_smbcw_connection next = tmp->next;
+			uint32_t idx = tmp->hash & (new_count - 1);
+			tmp->next = new_buckets[idx];
+			new_buckets[idx] = tmp;
+			tmp = next;
+		}
+	}
+
+	free(connection_buckets);
+	connection_buckets = new_buckets;
+	connection_bucket_count = new_count;
+}
+
+/**
+ * Removes the given connection from the LRU list.
+ */
+static void connection_lru_unlink(lp_smbcw_connection connection)
+{
+	lp_smbcw_connection prev = connection->lru_prev;
+	lp_smbcw_connection next = connection->lru_next;
+
+	if (prev)
+		prev->lru_next = next;
+	else if (connection_lru_head == connection)
+		connection_lru_head = next;
+
+	if (next)
+		next->lru_prev = prev;
+	else if (connection_lru_tail == connection)
+		connection_lru_tail = prev;
+
+	connection->lru_prev = NULL;
+	connection->lru_next = NULL;
+}
+
+/**
+ * Marks the given connection as used right now and moves it to the head of the
+ * LRU list.
+ */
+static void connection_touch(lp_smbcw_connection connection)
+{
+	connection->last_used = time(NULL);
+
+	if (connection_lru_head == connection)
+		return;
+
+	connection_lru_unlink(connection);
+	connection->lru_next = connection_lru_head;
+	if (connection_lru_head)
+		connection_lru_head->lru_prev = connection;
+	connection_lru_head = connection;
+	if (!connection_lru_tail)
+		connection_lru_tail = connection;
+}
+
+/**
+ * Creates a new connection element with the given hash and adds it to the
+ * connection hash table. Returns NULL if no memory is left.
+ */
+lp_smbcw_connection connection_create(uint32_t hash)
 {
 	lp_smbcw_connection result;
 
+	//Make sure there is a table and it is not overloaded
+	if (connection_count >= connection_bucket_count)
+		connections_grow();
+
+	//Without a table the first allocation failed
+	if (!connection_bucket_count) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
 	//Create a new connection structure and initialize it with zeros.
 	result = malloc(sizeof(*result));
+	if (!result) {
+		errno = ENOMEM;
+		return NULL;
+	}
 	memset(result, 0, sizeof(*result));
+	result->hash = hash;
+	result->pool_count = 1;
 
-	//Append this new connection to the connections list
-	if (first_connection) {
-		//Go to the end of the connection list and set the last item to the new one
-		lp_smbcw_connection tmp = first_connection;
-		while (tmp->next)
-			tmp = tmp->next;
-		tmp->next = result;
-	} else {
-		first_connection = result;
-	}
+	//Prepend this new connection to its bucket
+	uint32_t idx = hash & (connection_bucket_count - 1);
+	result->next = connection_buckets[idx];
+	connection_buckets[idx] = result;
+	connection_count++;
+
+	//Put it at the head of the LRU list
+	connection_touch(result);
 
 	return result;
 }
 
 /**
- * Frees the given connection element and removes it from the connections list.
- *
- * @param connection is a pointer to the connection element which should be freed.
+ * Removes the given connection element from the connection hash table and the LRU
+ * list. Has to be called with the lock held.
  */
-void connection_free(lp_smbcw_connection connection)
+static void connection_unlink(lp_smbcw_connection connection)
 {
-	//Iterate over the connection list and remove this item
-	lp_smbcw_connection tmp = first_connection;
+	//Iterate over the bucket of the connection and remove this item
+	uint32_t idx = connection->hash & (connection_bucket_count - 1);
+	lp_smbcw_connection tmp = connection_buckets[idx];
 	lp_smbcw_connection last = NULL;
 	while (tmp != connection && tmp != NULL) {
 		last = tmp;
 		tmp = tmp->next;
 	}
 
-	//If tmp is NULL, the item is not in the list
+	//If tmp is NULL, the item is not in the table
 	if (tmp != NULL) {
-		//If last is NULL, this is the first item
+		//If last is NULL, this is the first item of the bucket
 		if (last != NULL) {
 			//Remove this item from the chain
 			last->next = tmp->next;
 		} else {
 			//Set the first item to the next item
-			first_connection = first_connection->next;
+			connection_buckets[idx] = tmp->next;
 		}
+		connection_count--;
 	}
 
+	connection_lru_unlink(connection);
+	connection->next = NULL;
+	connection->closing = 1;
+}
+
+/**
+ * Frees a connection element removed by connection_unlink along with the contexts
+ * of its pool.
+ *
+ * @param connection is a pointer to the connection element which should be freed.
+ */
+static void connection_destroy(lp_smbcw_connection connection)
+{
 	//Free the url if this field is set
 	if (connection->url)
 		smbcw_url_free(connection->url);
 
 	//Free the SMBCW
-	if (connection->ctx)
-		smbc_free_context(connection->ctx, 1);
+	if (connection->ctx) {
+		if (connection_free_callback)
+			connection_free_callback(connection->ctx);
+		backend_active->free_context(connection->ctx, 1);
+		stats_ctx_freed();
+	}
+
+	//Free the other contexts of the pool, nothing is cached for them
+	while (connection->pool_next) {
+		lp_smbcw_connection member = connection->pool_next;
+		connection->pool_next = member->pool_next;
+		backend_active->free_context(member->ctx, 1);
+		stats_ctx_freed();
+		smbcw_url_free(member->url);
+		free(member);
+	}
 
 	//Free this item
 	free(connection);
 }
 
+/**
+ * Removes the given connection element from the table and frees it. The free
+ * callback is not called for a connection whose context has not been handed out.
+ */
+static void connection_free(lp_smbcw_connection connection)
+{
+	connection_unlink(connection);
+	connection_destroy(connection);
+}
+
+/**
+ * Removes the given connection from the table and schedules it to be freed by
+ * connections_unlock. Has to be called with the lock held.
+ */
+static void connection_close(lp_smbcw_connection connection)
+{
+	connection_unlink(connection);
+	connection->next = connection_closed;
+	connection_closed = connection;
+}
+
+/**
+ * Releases the lock and frees the connections closed while it was held.
+ */
+static void connections_unlock()
+{
+	lp_smbcw_connection closed = connection_closed;
+	connection_closed = NULL;
+
+	pthread_mutex_unlock(&connection_lock);
+
+	while (closed) {
+		lp_smbcw_connection next = closed->next;
+		connection_destroy(closed);
+		closed = next;
+	}
+}
+
+/**
+ * Compares two url parts which both might be NULL.
+ */
+static int connection_str_equal(const char *a, const char *b, int fold)
+{
+	if (a == b)
+		return 1;
+	if (!a || !b)
+		return 0;
+	return (fold ? strcasecmp(a, b) : strcmp(a, b)) == 0;
+}
+
 /**
  * Checks whether the url data (host, password, user) of the given connection matches
  * the given url data. If this is the case, the function returns 1, else 0.
@@ -124,24 +439,27 @@ int connection_match(lp_smbcw_connection connection, lp_smbcw_url url)
 	//Check whether the url part of the connection is actually set. Then compare
 	//the two pointers of each part as they both could be zero.
 	return ((connection->url != NULL) && 
-			((connection->url->user == url->user) || (strcmp(connection->url->user, url->user) == 0)) &&
-			((connection->url->host == url->host) || (strcasecmp(connection->url->host, url->host) == 0)) &&
-			((connection->url->password == url->password) || (strcmp(connection->url->password, url->password) == 0)) &&
-			((connection->url->protocol == url->protocol) || (strcmp(connection->url->protocol, url->protocol) == 0))
+			connection_str_equal(connection->url->user, url->user, 0) &&
+			connection_str_equal(connection->url->host, url->host, 1) &&
+			connection_str_equal(connection->url->password, url->password, 0) &&
+			connection_str_equal(connection->url->protocol, url->protocol, 0)
 	       ) ? 1 : 0;
 }
 
 /**
- * Does the same as the connection_match function, but iterates over the complete
- * connections list. Returns NULL if no item matching the url data is found else
- * the matching connection item is returned.
+ * Does the same as the connection_match function, but only looks at the bucket
+ * the given hash maps onto. Returns NULL if no item matching the url data is found
+ * else the matching connection item is returned.
  */
-lp_smbcw_connection connections_match(lp_smbcw_url url)
+lp_smbcw_connection connections_match(lp_smbcw_url url, uint32_t hash)
 {
-	lp_smbcw_connection tmp = first_connection;
+	if (!connection_bucket_count)
+		return NULL;
+
+	lp_smbcw_connection tmp = connection_buckets[hash & (connection_bucket_count - 1)];
 
 	while (tmp != NULL) {
-		if (connection_match(tmp, url))
+		if (tmp->hash == hash && connection_match(tmp, url))
 			return tmp;
 		tmp = tmp->next;
 	}
@@ -149,19 +467,181 @@ lp_smbcw_connection connections_match(lp_smbcw_url url)
 	return NULL;
 }
 
+/**
+ * Closes contexts which have been idle for longer than connection_idle_timeout and
+ * least recently used contexts until at most connection_max_contexts - reserve are
+ * left. Contexts which are still referenced and the connection keep are never
+ * closed.
+ */
+static void connections_evict(lp_smbcw_connection keep, int reserve)
+{
+	time_t now = time(NULL);
+	lp_smbcw_connection tmp = connection_lru_tail;
+
+	while (tmp) {
+		lp_smbcw_connection prev = tmp->lru_prev;
+		int idle = (connection_idle_timeout > 0) &&
+			(now - tmp->last_used >= connection_idle_timeout);
+		int over = (connection_max_contexts > 0) &&
+			(connection_count + reserve > connection_max_contexts);
+
+		//The list is ordered by last_used, nothing left to do
+		if (!idle && !over)
+			break;
+
+		if (tmp != keep && tmp->refcount <= 0)
+			connection_close(tmp);
+
+		tmp = prev;
+	}
+}
+
+/**
+ * Returns the connection in the hash table the given context belongs to, which
+ * holds the references and the LRU position of the whole pool, or NULL for
+ * private contexts.
+ */
+static lp_smbcw_connection connection_head(SMBCCTX *ctx)
+{
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+
+	if (!con || con->is_private)
+		return NULL;
+
+	return con->pool ? con->pool : con;
+}
+
 /* See connections.h */
 void connections_init()
 {
-	smbc_set_context(NULL);
+	backend_active->init();
 	connections_finalize();
 }
 
 /* See connections.h */
 void connections_finalize()
 {
-	//Iterate over the connections list and free each one
-	while (first_connection != NULL)
-		connection_free(first_connection);
+	uint32_t i;
+
+	pthread_mutex_lock(&connection_lock);
+
+	//Iterate over the connection hash table and free each connection
+	for (i = 0; i < connection_bucket_count; i++)
+		while (connection_buckets[i] != NULL)
+			connection_close(connection_buckets[i]);
+
+	free(connection_buckets);
+	connection_buckets = NULL;
+	connection_bucket_count = 0;
+	connection_count = 0;
+
+	connections_unlock();
+}
+
+/* See connections.h */
+void connections_set_limits(int max_contexts, int idle_timeout)
+{
+	pthread_mutex_lock(&connection_lock);
+	connection_max_contexts = max_contexts > 0 ? max_contexts : 0;
+	connection_idle_timeout = idle_timeout > 0 ? idle_timeout : 0;
+	pthread_mutex_unlock(&connection_lock);
+}
+
+/* See connections.h */
+void connections_set_pool(int size, int wait)
+{
+	pthread_mutex_lock(&connection_lock);
+	connection_pool_size = size > 0 ? size : 1;
+	connection_pool_wait = wait;
+
+	//Waiting threads might get a new context now or have to fail
+	pthread_cond_broadcast(&connection_cond);
+	pthread_mutex_unlock(&connection_lock);
+}
+
+/* See connections.h */
+void connections_set_free_callback(void (*callback)(SMBCCTX *ctx))
+{
+	connection_free_callback = callback;
+}
+
+/* See connections.h */
+void connections_use_ctx(SMBCCTX *ctx)
+{
+	pthread_mutex_lock(&connection_lock);
+
+	lp_smbcw_connection con = connection_head(ctx);
+	if (con) {
+		connection_touch(con);
+		connections_evict(con, 0);
+	}
+
+	connections_unlock();
+}
+
+/* See connections.h */
+int connections_ref_ctx(SMBCCTX *ctx)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&connection_lock);
+
+	lp_smbcw_connection con = connection_head(ctx);
+	if (con) {
+		if (con->closing)
+			ret = -1;
+		else
+			con->refcount++;
+	}
+
+	pthread_mutex_unlock(&connection_lock);
+
+	return ret;
+}
+
+/**
+ * Removes a reference from the given pool head. Has to be called with the lock
+ * held.
+ */
+static void connection_unref(lp_smbcw_connection con)
+{
+	if (con->refcount > 0) {
+		con->refcount--;
+
+		//The context counts as used until the last reference is dropped
+		if (con->refcount == 0)
+			connection_touch(con);
+	}
+}
+
+/* See connections.h */
+void connections_unref_ctx(SMBCCTX *ctx)
+{
+	pthread_mutex_lock(&connection_lock);
+
+	lp_smbcw_connection con = connection_head(ctx);
+	if (con)
+		connection_unref(con);
+
+	pthread_mutex_unlock(&connection_lock);
+}
+
+/* See connections.h */
+void connections_get_stats(uint64_t *hits, uint64_t *misses, uint64_t *entries,
+	uint64_t *waits)
+{
+	pthread_mutex_lock(&connection_lock);
+
+	if (hits)
+		*hits = connection_hits;
+	if (misses)
+		*misses = connection_misses;
+	if (entries)
+		*entries = connection_count;
+	if (waits)
+		*waits = connection_waits;
+
+	pthread_mutex_unlock(&connection_lock);
 }
 
 /**
@@ -173,7 +653,7 @@ void smbc_auth_callback(SMBCCTX *c, const char *srv, const char *shr, char *wg,
 	int wglen, char *un, int unlen, char *pw, int pwlen)
 {
 	//Get the pointer to the connection from the context user data
-	lp_smbcw_connection con = (lp_smbcw_connection)smbc_getOptionUserData(c);
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(c);
 
 	//Set the workgroup to the default dummy workgroup
 	if (wg) {
@@ -208,49 +688,342 @@ void smbc_auth_callback(SMBCCTX *c, const char *srv, const char *shr, char *wg,
 	}
 }
 
-/* See connections.h */
-SMBCCTX * connections_get_ctx(lp_smbcw_url url)
+/**
+ * Creates and initializes the context of the given connection. Frees the
+ * connection and returns NULL if this fails.
+ */
+static lp_smbcctx connection_init_ctx(lp_smbcw_connection con)
+{
+	//Create a new context
+	lp_smbcctx ctx = backend_active->new_context();
+	backend_active->set_debug(ctx, 0);
+	
+	//Initialize the newly created context
+	if (!backend_active->init_context(ctx)) {
+		//For some reason the initialization of the context failed. Do some cleanup
+
+		//Free the connection
+		if (con->is_private || con->pool) {
+			smbcw_url_free(con->url);
+			free(con);
+		} else {
+			connection_free(con);
+		}
+
+		//Free the context variable
+		backend_active->free_context(ctx, 1);
+		return NULL;
+	}
+
+	//Attach the context to the url
+	con->ctx = ctx;
+	con->host = stats_host_id(con->url->host);
+	stats_ctx_created();
+
+	//Set the user data parameter in order to be able to access the connection
+	//structure inside of the context callback functions
+	backend_active->set_user_data(ctx, con);
+
+	//Set the authentification callack
+	backend_active->set_auth_fn(ctx, &smbc_auth_callback);
+
+	return ctx;
+}
+
+/**
+ * Does the work of connections_get_ctx with the lock held
+ */
+static SMBCCTX * connection_get_ctx(lp_smbcw_url url)
 {
 	lp_smbcw_connection con;
+	uint32_t hash = connection_hash(url);
 
-	//Iterate over the connections and search one which matches the given url
-	con = connections_match(url);
+	//Search the connection hash table for a connection which matches the given url
+	con = connections_match(url, hash);
 
 	//If a connection has been found, simply set it as the current smbc_context
 	if (con && con->ctx) {
+		connection_hits++;
+		connection_touch(con);
+		con->refcount++;
+
+		//Close contexts which have been idle for too long
+		connections_evict(con, 0);
+
 		return con->ctx;
 	} else {
+		connection_misses++;
+
+		//Make room for the new context
+		connections_evict(NULL, 1);
+
 		//Create a new connection
-		con = connection_create();
+		con = connection_create(hash);
+		if (!con)
+			return NULL;
 		con->url = smbcw_url_dup(url);
 
-		//Create a new context
-		lp_smbcctx ctx = smbc_new_context();
-		smbc_setDebug(ctx, 0);
-		
-		//Initialize the newly created context
-		if (!smbc_init_context(ctx)) {
-			//For some reason the initialization of the context failed. Do some cleanup
+		lp_smbcctx ctx = connection_init_ctx(con);
+		if (ctx)
+			con->refcount++;
 
-			//Free the connection
-			connection_free(con);
+		return ctx;
+	}
+}
 
-			//Free the context variable
-			smbc_free_context(ctx, 1);
-			return NULL;
+/* See connections.h */
+SMBCCTX * connections_get_ctx(lp_smbcw_url url)
+{
+	SMBCCTX *ctx;
+
+	pthread_mutex_lock(&connection_lock);
+	ctx = connection_get_ctx(url);
+	connections_unlock();
+
+	return ctx;
+}
+
+/**
+ * Adds a new context to the pool headed by the given connection. Reserved
+ * contexts do not count towards the size of the pool. Has to be called with the
+ * lock held. Returns NULL if the context could not be created.
+ */
+static lp_smbcw_connection connection_add_member(lp_smbcw_connection head,
+	int reserved)
+{
+	lp_smbcw_connection con = malloc(sizeof(*con));
+	if (!con) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(con, 0, sizeof(*con));
+	con->pool = head;
+	con->hash = head->hash;
+	con->url = smbcw_url_dup(head->url);
+	con->reserved = reserved;
+
+	if (!connection_init_ctx(con))
+		return NULL;
+
+	con->pool_next = head->pool_next;
+	head->pool_next = con;
+	if (!reserved)
+		head->pool_count++;
+
+	return con;
+}
+
+/**
+ * Returns 1 if the thread self would wait forever for a context of the pool
+ * headed by head: every context of it is held by self or by a thread which in
+ * turn waits forever for another pool. A thread holding contexts of two pools
+ * and another thread holding them the other way round would otherwise wait for
+ * each other. Has to be called with the lock held.
+ */
+static int connection_deadlocks(lp_smbcw_connection head, pthread_t self,
+	int depth)
+{
+	lp_smbcw_connection member;
+	t_connection_waiter *waiter;
+
+	//A chain longer than the number of waiting threads contains a cycle of them
+	if (depth > connection_waiter_count)
+		return 1;
+
+	//The pool may still grow
+	if (head->pool_count < connection_pool_size)
+		return 0;
+
+	for (member = head; member; member = member->pool_next)
+	{
+		if (member->reserved)
+			continue;
+		if (member->checkouts == 0)
+			return 0;
+		if (pthread_equal(member->owner, self))
+			continue;
+
+		for (waiter = connection_waiters; waiter; waiter = waiter->next)
+			if (pthread_equal(waiter->thread, member->owner))
+				break;
+
+		//The holder is running and will check the context in some time
+		if (!waiter || !connection_deadlocks(waiter->pool, self, depth + 1))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* See connections.h */
+SMBCCTX * connections_checkout_ctx(SMBCCTX *ctx)
+{
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+	lp_smbcw_connection tmp, found = NULL;
+	pthread_t self = pthread_self();
+
+	if (!con || con->is_private) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&connection_lock);
+
+	//The reference keeps the pool alive while waiting and is then kept by the
+	//checkout
+	lp_smbcw_connection head = con->pool ? con->pool : con;
+	head->refcount++;
+
+	while (!found)
+	{
+		//A thread always gets the context it already holds, otherwise it could
+		//wait for itself. Any free context is taken otherwise. Threads with
+		//private contexts keep theirs and never take one of the others. A private
+		//context nothing is checked out of may be taken over by another private
+		//thread, e.g. from a thread which ended.
+		lp_smbcw_connection idle = NULL;
+		for (tmp = head; tmp && !found; tmp = tmp->pool_next) {
+			if (tmp->reserved != connection_thread_private)
+				continue;
+			if ((tmp->checkouts > 0 || tmp->reserved) &&
+				pthread_equal(tmp->owner, self))
+				found = tmp;
+			else if (tmp->checkouts == 0 && !idle)
+				idle = tmp;
 		}
 
-		//Attach the context to the url
-		con->ctx = ctx;
+		if (!found)
+			found = idle;
 
-		//Set the user data parameter in order to be able to access the connection
-		//structure inside of the context callback functions
-		smbc_setOptionUserData(ctx, con);
+		//Grow the pool
+		if (!found && (connection_thread_private ||
+			head->pool_count < connection_pool_size)) {
+			found = connection_add_member(head, connection_thread_private);
+			if (!found)
+				break;
+		}
 
-		//Set the authentification callack
-		smbc_setFunctionAuthDataWithContext(ctx, &smbc_auth_callback);
+		if (!found)
+		{
+			if (!connection_pool_wait) {
+				errno = EBUSY;
+				break;
+			}
 
-		return ctx;
+			if (connection_deadlocks(head, self, 0)) {
+				errno = EDEADLK;
+				break;
+			}
+
+			t_connection_waiter waiter = {self, head, connection_waiters};
+			connection_waiters = &waiter;
+			connection_waiter_count++;
+
+			connection_waits++;
+			pthread_cond_wait(&connection_cond, &connection_lock);
+
+			t_connection_waiter **link = &connection_waiters;
+			while (*link != &waiter)
+				link = &(*link)->next;
+			*link = waiter.next;
+			connection_waiter_count--;
+		}
+	}
+
+	if (found) {
+		found->owner = self;
+		found->checkouts++;
+		connection_touch(head);
+
+		//Close contexts which have been idle for too long
+		connections_evict(head, 0);
+	} else {
+		int err = errno;
+		connection_unref(head);
+		errno = err;
+	}
+
+	connections_unlock();
+
+	return found ? found->ctx : NULL;
+}
+
+/* See connections.h */
+void connections_checkin_ctx(SMBCCTX *ctx)
+{
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+
+	if (!con || con->is_private)
+		return;
+
+	pthread_mutex_lock(&connection_lock);
+
+	if (con->checkouts > 0) {
+		con->checkouts--;
+		connection_unref(con->pool ? con->pool : con);
+
+		//Wake up threads waiting for a context
+		if (con->checkouts == 0)
+			pthread_cond_broadcast(&connection_cond);
+	}
+
+	pthread_mutex_unlock(&connection_lock);
+}
+
+/* See connections.h */
+SMBCCTX * connections_pool_ctx(SMBCCTX *ctx)
+{
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+
+	if (con && con->pool)
+		return ((lp_smbcw_connection)con->pool)->ctx;
+
+	return ctx;
+}
+
+/* See connections.h */
+int connections_host_id(SMBCCTX *ctx)
+{
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+
+	return con ? con->host : 0;
+}
+
+/* See connections.h */
+void connections_set_thread_private(int enabled)
+{
+	connection_thread_private = enabled ? 1 : 0;
+}
+
+/* See connections.h */
+SMBCCTX * connections_new_private_ctx(SMBCCTX *ctx)
+{
+	lp_smbcw_connection parent = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+
+	if (!parent || !parent->url)
+		return NULL;
+
+	//Create a connection structure outside of the hash table, the auth callback
+	//takes the credentials from its url
+	lp_smbcw_connection con = malloc(sizeof(*con));
+	memset(con, 0, sizeof(*con));
+	con->is_private = 1;
+	con->hash = parent->hash;
+	con->url = smbcw_url_dup(parent->url);
+
+	return connection_init_ctx(con);
+}
+
+/* See connections.h */
+void connections_free_private_ctx(SMBCCTX *ctx)
+{
+	lp_smbcw_connection con = (lp_smbcw_connection)backend_active->get_user_data(ctx);
+
+	if (con && con->is_private) {
+		backend_active->free_context(ctx, 1);
+		stats_ctx_freed();
+		smbcw_url_free(con->url);
+		free(con);
 	}
 }
 
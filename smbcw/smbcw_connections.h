@@ -20,12 +20,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
 #include <libsmbclient.h>
 #include "smbcw_url.h"
 
 /**
  * Initializes the SMBCW connection handling. Has to be called before any other 
- * connections_* function is called. SMBC has not to be initialized yet.
+ * connections_* function is called. SMBC has not to be initialized yet. All other
+ * functions but connections_finalize may be called by several threads at the same
+ * time.
  */
 void connections_init();
 
@@ -44,8 +47,123 @@ void connections_finalize();
  *  if no such context exists, a new one will be created. The context authentification
  *  function gets automatically connected to an callback which then fills out the
  *  authentification data according to the values in the url.
+ *
+ * The context is returned with a reference added, see connections_ref_ctx.
  */
 SMBCCTX * connections_get_ctx(lp_smbcw_url url);
 
+/**
+ * Reserves a context of the pool ctx belongs to for the calling thread. Every
+ * pool holds up to the number of contexts set with connections_set_pool for the
+ * credentials of the context returned by connections_get_ctx. A thread which
+ * already holds a context of the pool gets the same one again, so its files stay
+ * on one session. If all contexts are held by other threads, the call waits for
+ * one to be checked in or fails with errno set to EBUSY, see connections_set_pool.
+ * It fails with EDEADLK instead of waiting if the holders wait for contexts the
+ * calling thread holds, e.g. when two threads open files on two servers in
+ * opposite order.
+ * Each checkout keeps the pool open like a reference and has to be ended by
+ * connections_checkin_ctx. Returns NULL on failure.
+ */
+SMBCCTX * connections_checkout_ctx(SMBCCTX *ctx);
+
+/**
+ * Ends a checkout of connections_checkout_ctx. A context is free for other threads
+ * once all checkouts of its holder have been ended.
+ */
+void connections_checkin_ctx(SMBCCTX *ctx);
+
+/**
+ * Returns the context connections_get_ctx returns for the credentials of the given
+ * context. All contexts of a pool access the same files, so data cached for them
+ * should be stored for this context.
+ */
+SMBCCTX * connections_pool_ctx(SMBCCTX *ctx);
+
+/**
+ * Returns the id the server of the given context has in the latency statistics,
+ * see stats_host_id.
+ */
+int connections_host_id(SMBCCTX *ctx);
+
+/**
+ * Sets the maximum number of contexts per pool (at least 1, the default) and
+ * whether connections_checkout_ctx waits (wait != 0, the default) or fails when
+ * all of them are checked out. The contexts of a pool count as one context for
+ * the limits of connections_set_limits.
+ */
+void connections_set_pool(int size, int wait);
+
+/**
+ * Lets connections_checkout_ctx give the calling thread a context of each pool
+ * which no other thread uses, e.g. for a worker which must not wait for the
+ * threads it works for. These contexts do not count towards the pool size set
+ * with connections_set_pool and are freed along with their pool. While nothing
+ * is checked out of such a context, another thread of this kind may take it
+ * over, so threads started for a single task reuse the sessions of the ones
+ * before them.
+ */
+void connections_set_thread_private(int enabled);
+
+/**
+ * Creates a new context with the same credentials as the given one, which is only
+ * used by the caller, e.g. by a background thread. The context is not subject
+ * to the limits set with connections_set_limits and has to be freed with
+ * connections_free_private_ctx. Returns NULL if the context could not be created.
+ */
+SMBCCTX * connections_new_private_ctx(SMBCCTX *ctx);
+
+/**
+ * Frees a context created by connections_new_private_ctx.
+ */
+void connections_free_private_ctx(SMBCCTX *ctx);
+
+/**
+ * Limits the number of kept contexts. Whenever a new context is needed and
+ * max_contexts contexts are already open, the least recently used contexts are
+ * closed. Contexts not used for idle_timeout seconds are closed as well. Contexts
+ * referenced by connections_ref_ctx are never closed. A value <= 0 disables the
+ * corresponding limit.
+ */
+void connections_set_limits(int max_contexts, int idle_timeout);
+
+/**
+ * Registers a function which is called right before a context is freed, e.g. to
+ * drop cached data which refers to the context.
+ */
+void connections_set_free_callback(void (*callback)(SMBCCTX *ctx));
+
+/**
+ * Marks the given context as used, just like a connections_get_ctx call returning
+ * it would do. Has to be called whenever a context obtained earlier (e.g. from a
+ * cache) is used again.
+ */
+void connections_use_ctx(SMBCCTX *ctx);
+
+/**
+ * Adds a reference to the given context, e.g. for an open file descriptor. A
+ * referenced context is not closed by the limits set with connections_set_limits.
+ * Fails with -1 if the context is already being closed by another thread, which
+ * is possible as long as the caller holds no reference, e.g. for a context taken
+ * from a cache. A context is only freed after the free callback returned, so the
+ * caches may call this function with their lock held.
+ */
+int connections_ref_ctx(SMBCCTX *ctx);
+
+/**
+ * Removes a reference previously added with connections_ref_ctx.
+ */
+void connections_unref_ctx(SMBCCTX *ctx);
+
+/**
+ * Returns the number of connections_get_ctx calls which could be served by an
+ * existing context (hits), the number of calls which had to create a new one
+ * (misses), the number of connections currently kept and the number of times
+ * connections_checkout_ctx had to wait for a context. Any of the pointers may be
+ * NULL.
+ */
+void connections_get_stats(uint64_t *hits, uint64_t *misses, uint64_t *entries,
+	uint64_t *waits);
+
 #endif /*_CONNECTIONS_H*/
 
@@ -19,125 +19,297 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "smbcw_descriptor.h"
 
-typedef struct{
-	int id;
-	void *ptr;
-	void *next;
-} smbcw_id_entry;
+/**
+ * An id consists of a slot index in the lower SMBCW_ID_SLOT_BITS and the
+ * generation of that slot above it. The generation is incremented whenever a slot
+ * is released, so an id which has already been freed is not accepted anymore,
+ * even if its slot has been reused in the meantime. The generation never becomes
+ * zero, which guarantees that every valid id is > 0.
+ */
+#define SMBCW_ID_SLOT_BITS 20
+#define SMBCW_ID_GEN_BITS 11
+#define SMBCW_ID_SLOT_MASK ((1 << SMBCW_ID_SLOT_BITS) - 1)
+#define SMBCW_ID_GEN_MASK ((1 << SMBCW_ID_GEN_BITS) - 1)
 
-typedef smbcw_id_entry *lp_smbcw_id_entry;
+/**
+ * The slots are stored in chunks of fixed size. A chunk never moves once it has
+ * been allocated, so growing the table does not invalidate any slot.
+ */
+#define SMBCW_ID_CHUNK_BITS 10
+#define SMBCW_ID_CHUNK_SIZE (1 << SMBCW_ID_CHUNK_BITS)
+#define SMBCW_ID_MAX_CHUNKS (1 << (SMBCW_ID_SLOT_BITS - SMBCW_ID_CHUNK_BITS))
+#define SMBCW_ID_MAX_SLOTS (SMBCW_ID_MAX_CHUNKS * SMBCW_ID_CHUNK_SIZE)
 
-lp_smbcw_id_entry first_entry = NULL;
+/**
+ * Released slots are reused in the order they were released, and only once at
+ * least this many of them are waiting. A slot therefore goes through at least
+ * SMBCW_ID_REUSE_MIN other releases before its next use, and the generation of
+ * a slot only wraps after about 2^(SMBCW_ID_GEN_BITS + 10) released ids, even
+ * if a single file is opened and closed over and over.
+ */
+#define SMBCW_ID_REUSE_MIN 1024
 
 /**
- * Search in the linked list whether the given id does already exist
+ * The lock of a slot serializes the calls on the descriptor registered in it,
+ * see smbcw_lock_ptr. Slots are never freed while ids are in use, so it may be
+ * locked even if the descriptor is freed at the same time.
  */
-int smbcw_id_exists(int id)
-{
-	lp_smbcw_id_entry tmp = first_entry;
+typedef struct {
+	void *ptr;
+	int gen;
+	int next_free;
+	pthread_mutex_t lock;
+} smbcw_id_slot;
 
-	while (tmp) {
-		if (tmp->id == id)
-			return 1;
-		tmp = tmp->next;
-	}
+typedef smbcw_id_slot *lp_smbcw_id_slot;
 
-	return 0;
+/**
+ * Chunk table, number of slots which have ever been handed out, head and tail
+ * of the list of released slots (-1 if empty) and its length.
+ */
+static lp_smbcw_id_slot id_chunks[SMBCW_ID_MAX_CHUNKS];
+static int id_slot_count = 0;
+static int id_first_free = -1;
+static int id_last_free = -1;
+static int id_free_count = 0;
+
+/**
+ * Serializes smbcw_gen_id and smbcw_free_id. smbcw_get_ptr does not lock: the
+ * writers publish the chunk pointers, the slot count and the slot fields with
+ * atomic stores, chunks are never freed while ids are in use, and a lookup checks
+ * the generation of the slot before and after reading the pointer.
+ */
+static pthread_mutex_t id_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the slot with the given index. The index has to be smaller than
+ * id_slot_count.
+ */
+static lp_smbcw_id_slot smbcw_id_slot_at(int idx)
+{
+	return &id_chunks[idx >> SMBCW_ID_CHUNK_BITS][idx & (SMBCW_ID_CHUNK_SIZE - 1)];
 }
 
 int smbcw_gen_id(void *ptr)
 {
-	//Allocate memory for a new id entry
-	lp_smbcw_id_entry new = malloc(sizeof(*new));
+	lp_smbcw_id_slot slot;
+	int idx, id, i;
 
-	//Initialize the newly allocated memory with zeros
-	memset(new, 0, sizeof(*new));
+	pthread_mutex_lock(&id_lock);
 
-	//Associate the new list element with the given pointer
-	new->ptr = ptr;
-
-	//Generate a rather random id by calculating the address of the pointer mod the
-	//size of the resulting id
-	int mod_mask = (1 << ((sizeof(new->id) * 8) - 2));
-	new->id = *((int*)(&ptr)) % mod_mask;
-	if (new->id < 1)
-		new->id = 1;
-
-	//Check whether this id already exists
-	int cnt = 0;
-	while (smbcw_id_exists(new->id) && (cnt < mod_mask))
+	if (id_first_free >= 0 &&
+		(id_free_count >= SMBCW_ID_REUSE_MIN || id_slot_count >= SMBCW_ID_MAX_SLOTS))
 	{
-		new->id = ((new-> id + 1) % mod_mask);
-		if (new->id < 1)
-			new->id = 1;
-		++cnt;
+		//Reuse the least recently released slot
+		idx = id_first_free;
+		slot = smbcw_id_slot_at(idx);
+		id_first_free = slot->next_free;
+		if (id_first_free < 0)
+			id_last_free = -1;
+		id_free_count--;
 	}
+	else
+	{
+		//Return -1 if all slots are exhausted
+		if (id_slot_count >= SMBCW_ID_MAX_SLOTS) {
+			pthread_mutex_unlock(&id_lock);
+			return -1;
+		}
 
-	//Return -1 if all ids are exhausted
-	if (cnt >= mod_mask) {
-		free(new);
+		idx = id_slot_count;
 
-		return -1;
+		//Allocate a new chunk if the slot is the first one inside of it
+		int chunk = idx >> SMBCW_ID_CHUNK_BITS;
+		if (!id_chunks[chunk])
+		{
+			lp_smbcw_id_slot slots = malloc(SMBCW_ID_CHUNK_SIZE * sizeof(smbcw_id_slot));
+			if (!slots) {
+				pthread_mutex_unlock(&id_lock);
+				return -1;
+			}
+			memset(slots, 0, SMBCW_ID_CHUNK_SIZE * sizeof(smbcw_id_slot));
+			for (i = 0; i < SMBCW_ID_CHUNK_SIZE; i++)
+				pthread_mutex_init(&slots[i].lock, NULL);
+			__atomic_store_n(&id_chunks[chunk], slots, __ATOMIC_RELEASE);
+		}
+
+		slot = smbcw_id_slot_at(idx);
+		__atomic_store_n(&slot->gen, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&id_slot_count, id_slot_count + 1, __ATOMIC_RELEASE);
 	}
 
-	//Append the new item to the list
-	if (!first_entry)
+	//Associate the slot with the given pointer
+	__atomic_store_n(&slot->ptr, ptr, __ATOMIC_RELEASE);
+	slot->next_free = -1;
+
+	id = (slot->gen << SMBCW_ID_SLOT_BITS) | idx;
+
+	pthread_mutex_unlock(&id_lock);
+
+	return id;
+}
+
+int smbcw_free_id(int id)
+{
+	int idx = id & SMBCW_ID_SLOT_MASK;
+	int gen = (id >> SMBCW_ID_SLOT_BITS) & SMBCW_ID_GEN_MASK;
+	int freed = 0;
+
+	if (id <= 0)
+		return 0;
+
+	pthread_mutex_lock(&id_lock);
+
+	lp_smbcw_id_slot slot = idx < id_slot_count ? smbcw_id_slot_at(idx) : NULL;
+	if (slot && slot->gen == gen && slot->ptr)
 	{
-		first_entry = new;
+		//Invalidate all ids referring to this slot by advancing the generation
+		int next_gen = (slot->gen + 1) & SMBCW_ID_GEN_MASK;
+		__atomic_store_n(&slot->ptr, NULL, __ATOMIC_RELEASE);
+		__atomic_store_n(&slot->gen, next_gen ? next_gen : 1, __ATOMIC_RELEASE);
+
+		//Append the slot to the free list
+		slot->next_free = -1;
+		if (id_last_free >= 0)
+			smbcw_id_slot_at(id_last_free)->next_free = idx;
+		else
+			id_first_free = idx;
+		id_last_free = idx;
+		id_free_count++;
+		freed = 1;
 	}
-	else
-	{
-		lp_smbcw_id_entry tmp = first_entry;
-		while (tmp->next) {
-			tmp = tmp->next;
-		}
 
-		tmp->next = new;
+	pthread_mutex_unlock(&id_lock);
+
+	return freed;
+}
+
+void* smbcw_get_ptr(int id)
+{
+	int idx = id & SMBCW_ID_SLOT_MASK;
+	int gen = (id >> SMBCW_ID_SLOT_BITS) & SMBCW_ID_GEN_MASK;
+
+	if (id <= 0 || idx >= __atomic_load_n(&id_slot_count, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	lp_smbcw_id_slot chunk = __atomic_load_n(&id_chunks[idx >> SMBCW_ID_CHUNK_BITS],
+		__ATOMIC_ACQUIRE);
+	lp_smbcw_id_slot slot = &chunk[idx & (SMBCW_ID_CHUNK_SIZE - 1)];
+	if (__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != gen)
+		return NULL;
+
+	void *ptr = __atomic_load_n(&slot->ptr, __ATOMIC_ACQUIRE);
+
+	//The slot might have been freed and reused while the pointer was read
+	if (__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != gen)
+		return NULL;
+
+	return ptr;
+}
+
+void* smbcw_lock_ptr(int id)
+{
+	int idx = id & SMBCW_ID_SLOT_MASK;
+	int gen = (id >> SMBCW_ID_SLOT_BITS) & SMBCW_ID_GEN_MASK;
+
+	if (id <= 0 || idx >= __atomic_load_n(&id_slot_count, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	lp_smbcw_id_slot chunk = __atomic_load_n(&id_chunks[idx >> SMBCW_ID_CHUNK_BITS],
+		__ATOMIC_ACQUIRE);
+	lp_smbcw_id_slot slot = &chunk[idx & (SMBCW_ID_CHUNK_SIZE - 1)];
+
+	pthread_mutex_lock(&slot->lock);
+
+	//The id might have been freed while waiting for the lock
+	void *ptr = __atomic_load_n(&slot->ptr, __ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != gen || !ptr) {
+		pthread_mutex_unlock(&slot->lock);
+		return NULL;
 	}
 
-	return new->id;
+	return ptr;
 }
 
-void smbcw_free_id(int id)
+void smbcw_unlock_ptr(int id)
 {
-	//Remove the element from the linked list and delete it
-	lp_smbcw_id_entry tmp = first_entry;
-	lp_smbcw_id_entry prev = NULL;
-	while (tmp)
-	{
-		if (tmp->id == id)
-		{
-			if (prev)
-				prev->next = tmp->next;
-			else
-				first_entry = first_entry->next;
+	int idx = id & SMBCW_ID_SLOT_MASK;
+
+	lp_smbcw_id_slot chunk = __atomic_load_n(&id_chunks[idx >> SMBCW_ID_CHUNK_BITS],
+		__ATOMIC_ACQUIRE);
+	pthread_mutex_unlock(&chunk[idx & (SMBCW_ID_CHUNK_SIZE - 1)].lock);
+}
+
+void* smbcw_lock_ptr2(int id1, int id2, void **ptr2)
+{
+	int idx1 = id1 & SMBCW_ID_SLOT_MASK;
+	int idx2 = id2 & SMBCW_ID_SLOT_MASK;
+	void *ptr1;
 
-			free(tmp);
+	*ptr2 = NULL;
 
-			return;
+	//Both ids refer to the same slot, which can only be locked once
+	if (idx1 == idx2) {
+		ptr1 = smbcw_lock_ptr(id1);
+		if (ptr1 && id1 != id2) {
+			smbcw_unlock_ptr(id1);
+			return NULL;
 		}
+		*ptr2 = ptr1;
+		return ptr1;
+	}
+
+	//Lock the slots in the order of their index, so two threads locking the same
+	//pair the other way round do not wait for each other
+	int first = idx1 < idx2 ? id1 : id2;
+	int second = idx1 < idx2 ? id2 : id1;
 
-		prev = tmp;
-		tmp = tmp->next;
+	void *ptr_first = smbcw_lock_ptr(first);
+	if (!ptr_first)
+		return NULL;
+
+	void *ptr_second = smbcw_lock_ptr(second);
+	if (!ptr_second) {
+		smbcw_unlock_ptr(first);
+		return NULL;
 	}
+
+	*ptr2 = (first == id1) ? ptr_second : ptr_first;
+	return (first == id1) ? ptr_first : ptr_second;
 }
 
-void* smbcw_get_ptr(int id)
+void smbcw_unlock_ptr2(int id1, int id2)
 {
-	//Search for an entry with the given id and return it
-	lp_smbcw_id_entry tmp = first_entry;
-	while (tmp)
-	{
-		if (tmp->id == id)
-			 return tmp->ptr;
+	smbcw_unlock_ptr(id1);
+	if ((id1 & SMBCW_ID_SLOT_MASK) != (id2 & SMBCW_ID_SLOT_MASK))
+		smbcw_unlock_ptr(id2);
+}
+
+void smbcw_free_all_ids()
+{
+	int i, j;
 
-		tmp = tmp->next;
+	pthread_mutex_lock(&id_lock);
+
+	//Lookups must not run anymore, the chunks are freed
+	__atomic_store_n(&id_slot_count, 0, __ATOMIC_RELEASE);
+	for (i = 0; i < SMBCW_ID_MAX_CHUNKS; i++)
+	{
+		if (id_chunks[i])
+			for (j = 0; j < SMBCW_ID_CHUNK_SIZE; j++)
+				pthread_mutex_destroy(&id_chunks[i][j].lock);
+		free(id_chunks[i]);
+		id_chunks[i] = NULL;
 	}
 
-	return NULL;
-}
+	id_first_free = -1;
+	id_last_free = -1;
+	id_free_count = 0;
 
+	pthread_mutex_unlock(&id_lock);
+}
 
@@ -21,14 +21,19 @@
 */
 
 /**
- * Generates an id which can be passed to an external application
+ * Generates an id which can be passed to an external application. Ids are always
+ * greater than zero, -1 is returned if no more ids are available. Generating,
+ * freeing and resolving ids are constant time operations. All functions may be
+ * called by several threads at the same time, smbcw_get_ptr never blocks.
  */
 int smbcw_gen_id(void *ptr);
 
 /**
- * Frees the memory used for managing the given id
+ * Frees the memory used for managing the given id. Returns 1 if the id was
+ * removed by this call, 0 if it was invalid or already freed by another
+ * thread. Only the caller which removed the id may free what it pointed to.
  */
-void smbcw_free_id(int id);
+int smbcw_free_id(int id);
 
 /**
  * Returns the pointer the given id is connected with. Returns NULL if the ID
@@ -36,5 +41,40 @@ void smbcw_free_id(int id);
  */
 void* smbcw_get_ptr(int id);
 
+/**
+ * Same as smbcw_get_ptr, but locks the id first, waiting for other threads
+ * holding it locked. Returns NULL without holding the lock if the id isn't
+ * registered (anymore). Otherwise the lock has to be released with
+ * smbcw_unlock_ptr, which is also possible after the id has been freed. As
+ * long as every thread uses a pointer only while holding its id locked and
+ * frees it only after freeing the id, the pointer is never freed while in use.
+ */
+void* smbcw_lock_ptr(int id);
+
+/**
+ * Releases the lock of an id taken by smbcw_lock_ptr
+ */
+void smbcw_unlock_ptr(int id);
+
+/**
+ * Locks two ids like smbcw_lock_ptr, in an order which does not depend on the
+ * order of the arguments. Returns the pointer of id1 and writes the one of id2
+ * to ptr2, or returns NULL without holding a lock if one of them isn't
+ * registered. id1 and id2 may be the same. The locks have to be released with
+ * smbcw_unlock_ptr2.
+ */
+void* smbcw_lock_ptr2(int id1, int id2, void **ptr2);
+
+/**
+ * Releases the locks taken by smbcw_lock_ptr2
+ */
+void smbcw_unlock_ptr2(int id1, int id2);
+
+/**
+ * Frees all memory used by the descriptor table. All ids become invalid. Must not
+ * be called while other threads still use the table.
+ */
+void smbcw_free_all_ids();
+
 #endif /*_DESC_H*/
 
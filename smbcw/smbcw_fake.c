@@ -0,0 +1,502 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <libsmbclient.h>
+
+#include "smbcw.h"
+#include "smbcw_fake.h"
+
+/**
+ * Default directory the shares are mapped into
+ */
+#define FAKE_DEFAULT_ROOT "/tmp/smbcw_fake"
+
+/**
+ * Context of the fake backend
+ */
+typedef struct {
+	void *user_data;
+} t_fake_ctx;
+
+/**
+ * File or directory opened by the fake backend
+ */
+typedef struct {
+	int fd;
+	DIR *dir;
+	int shares;		//listing of the shares of a server, which has no attributes
+	char path[1024];
+	struct libsmb_file_info info;
+	struct smbc_dirent *ent;
+} t_fake_file;
+
+/**
+ * Current settings, see smbcw_fake_configure
+ */
+char fake_root[512] = FAKE_DEFAULT_ROOT;
+int fake_latency_us = 0;
+int fake_bandwidth_mbps = 0;
+int fake_fail_every = 0;
+int fake_fail_errno = EIO;
+int fake_configured = 0;
+
+/**
+ * Number of round trips served so far, only accessed atomically
+ */
+uint64_t fake_round_trips = 0;
+
+/**
+ * Counts a round trip and waits as long as it takes. Returns -1 and sets errno if
+ * the round trip is one of those which are supposed to fail.
+ */
+static int fake_round_trip()
+{
+	uint64_t count = __atomic_add_fetch(&fake_round_trips, 1, __ATOMIC_RELAXED);
+
+	if (fake_latency_us > 0)
+		usleep(fake_latency_us);
+
+	if (fake_fail_every > 0 && count % fake_fail_every == 0) {
+		errno = fake_fail_errno;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Waits as long as moving count bytes takes with the configured bandwidth.
+ * Contexts wait independently of each other, like sessions limited by their TCP
+ * window.
+ */
+static void fake_transfer(size_t count)
+{
+	if (fake_bandwidth_mbps > 0)
+		usleep(count / fake_bandwidth_mbps);
+}
+
+/**
+ * Translates an smbc filename into the local path
+ */
+static void fake_path(const char *fname, char *path)
+{
+	const char *p = strstr(fname, "://");
+
+	//Skip protocol and host
+	p = p ? p + 3 : fname;
+	p = strchr(p, '/');
+
+	snprintf(path, 1024, "%s/%s", fake_root, p ? p + 1 : "");
+}
+
+/**
+ * Returns 1 if the smbc filename names a server (or nothing) rather than a share
+ * or a path on it
+ */
+static int fake_is_server(const char *fname)
+{
+	const char *p = strstr(fname, "://");
+
+	p = p ? p + 3 : fname;
+	p = strchr(p, '/');
+
+	return !p || !p[1] || p[1] == '/';
+}
+
+static SMBCFILE *fake_open(SMBCCTX *c, const char *fname, int flags, mode_t mode)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return NULL;
+	fake_path(fname, path);
+
+	int fd = open(path, flags, 0644);
+	if (fd < 0)
+		return NULL;
+
+	t_fake_file *file = calloc(1, sizeof(*file));
+	file->fd = fd;
+	strcpy(file->path, path);
+	return (SMBCFILE*)file;
+}
+
+static ssize_t fake_read(SMBCCTX *c, SMBCFILE *f, void *buf, size_t count)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	if (fake_round_trip() < 0)
+		return -1;
+
+	ssize_t ret = read(file->fd, buf, count);
+	if (ret > 0)
+		fake_transfer(ret);
+	return ret;
+}
+
+static ssize_t fake_write(SMBCCTX *c, SMBCFILE *f, const void *buf, size_t count)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	if (fake_round_trip() < 0)
+		return -1;
+
+	fake_transfer(count);
+	return write(file->fd, buf, count);
+}
+
+static off_t fake_lseek(SMBCCTX *c, SMBCFILE *f, off_t offset, int whence)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	//libsmbclient keeps the file pointer itself and only asks the server for the
+	//file size
+	if (whence == SEEK_END && fake_round_trip() < 0)
+		return -1;
+
+	return lseek(file->fd, offset, whence);
+}
+
+#ifdef HAVE_SMBC_SPLICE
+static off_t fake_splice(SMBCCTX *c, SMBCFILE *src, SMBCFILE *dst, off_t count,
+	int (*splice_cb)(off_t n, void *priv), void *priv)
+{
+	t_fake_file *srcfile = (t_fake_file*)src;
+	t_fake_file *dstfile = (t_fake_file*)dst;
+	char buf[65536];
+	off_t done = 0;
+
+	//The server copies up to 16 MiB per request
+	while (done < count)
+	{
+		if (done % (16 * 1024 * 1024) == 0 && fake_round_trip() < 0)
+			return -1;
+
+		ssize_t len = read(srcfile->fd, buf, count - done < sizeof(buf) ?
+			count - done : sizeof(buf));
+		if (len <= 0 || write(dstfile->fd, buf, len) != len)
+			break;
+		done += len;
+
+		if (splice_cb && !splice_cb(done, priv))
+			break;
+	}
+
+	return done;
+}
+#endif
+
+static int fake_close(SMBCCTX *c, SMBCFILE *f)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	//The handle is gone even if the server does not answer
+	int ret = fake_round_trip();
+	if (close(file->fd) < 0)
+		ret = -1;
+
+	free(file);
+	return ret;
+}
+
+static int fake_stat(SMBCCTX *c, const char *fname, struct stat *st)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return -1;
+	fake_path(fname, path);
+
+	return stat(path, st);
+}
+
+static int fake_fstat(SMBCCTX *c, SMBCFILE *f, struct stat *st)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	if (fake_round_trip() < 0)
+		return -1;
+
+	return fstat(file->fd, st);
+}
+
+static int fake_unlink(SMBCCTX *c, const char *fname)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return -1;
+	fake_path(fname, path);
+
+	return unlink(path);
+}
+
+static int fake_rename(SMBCCTX *oc, const char *oname, SMBCCTX *nc,
+	const char *nname)
+{
+	char opath[1024], npath[1024];
+
+	if (fake_round_trip() < 0)
+		return -1;
+	fake_path(oname, opath);
+	fake_path(nname, npath);
+
+	return rename(opath, npath);
+}
+
+static int fake_mkdir(SMBCCTX *c, const char *fname, mode_t mode)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return -1;
+	fake_path(fname, path);
+
+	return mkdir(path, 0755);
+}
+
+static int fake_rmdir(SMBCCTX *c, const char *fname)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return -1;
+	fake_path(fname, path);
+
+	return rmdir(path);
+}
+
+static int fake_chmod(SMBCCTX *c, const char *fname, mode_t mode)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return -1;
+	fake_path(fname, path);
+
+	return chmod(path, mode);
+}
+
+static SMBCFILE *fake_opendir(SMBCCTX *c, const char *fname)
+{
+	char path[1024];
+
+	if (fake_round_trip() < 0)
+		return NULL;
+	fake_path(fname, path);
+
+	DIR *dir = opendir(path);
+	if (!dir)
+		return NULL;
+
+	t_fake_file *file = calloc(1, sizeof(*file));
+	file->fd = -1;
+	file->dir = dir;
+	file->shares = fake_is_server(fname);
+	file->ent = malloc(sizeof(struct smbc_dirent) + 256);
+	strcpy(file->path, path);
+	return (SMBCFILE*)file;
+}
+
+static struct smbc_dirent *fake_readdir(SMBCCTX *c, SMBCFILE *f)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	if (fake_round_trip() < 0)
+		return NULL;
+
+	struct dirent *ent = readdir(file->dir);
+	if (!ent)
+		return NULL;
+
+	strcpy(file->ent->name, ent->d_name);
+	return file->ent;
+}
+
+#ifdef HAVE_SMBC_READDIRPLUS2
+static const struct libsmb_file_info *fake_readdirplus2(SMBCCTX *c, SMBCFILE *f,
+	struct stat *st)
+{
+	t_fake_file *file = (t_fake_file*)f;
+	char path[2048];
+
+	if (fake_round_trip() < 0)
+		return NULL;
+
+	//Like libsmbclient, only file listings come with attributes
+	if (file->shares)
+		return NULL;
+
+	struct dirent *ent = readdir(file->dir);
+	if (!ent)
+		return NULL;
+
+	//The server sends the attributes along with the names, no extra round trip
+	snprintf(path, sizeof(path), "%s/%s", file->path, ent->d_name);
+	stat(path, st);
+
+	strcpy(file->ent->name, ent->d_name);
+	file->info.name = file->ent->name;
+	file->info.size = st->st_size;
+	return &file->info;
+}
+#endif
+
+static int fake_closedir(SMBCCTX *c, SMBCFILE *f)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	int ret = fake_round_trip();
+
+	closedir(file->dir);
+	free(file->ent);
+	free(file);
+	return ret;
+}
+
+static int fake_lseekdir(SMBCCTX *c, SMBCFILE *f, off_t offset)
+{
+	t_fake_file *file = (t_fake_file*)f;
+
+	if (fake_round_trip() < 0)
+		return -1;
+
+	rewinddir(file->dir);
+	return 0;
+}
+
+/**
+ * Takes the settings from $FAKE_SMB_ROOT, $FAKE_SMB_LATENCY_US,
+ * $FAKE_SMB_SESSION_MBPS and $FAKE_SMB_FAIL_EVERY unless smbcw_fake_configure has
+ * been called before
+ */
+static void fake_init()
+{
+	smbcw_fake_config config;
+	const char *env;
+
+	if (fake_configured)
+		return;
+
+	memset(&config, 0, sizeof(config));
+	config.root = getenv("FAKE_SMB_ROOT");
+	if ((env = getenv("FAKE_SMB_LATENCY_US")))
+		config.latency_us = atoi(env);
+	if ((env = getenv("FAKE_SMB_SESSION_MBPS")))
+		config.bandwidth_mbps = atoi(env);
+	if ((env = getenv("FAKE_SMB_FAIL_EVERY")))
+		config.fail_every = atoi(env);
+
+	smbcw_fake_configure(&config);
+}
+
+static SMBCCTX *fake_new_context() { return calloc(1, sizeof(t_fake_ctx)); }
+static SMBCCTX *fake_init_context(SMBCCTX *c) { return c; }
+static int fake_free_context(SMBCCTX *c, int shutdown_ctx) { free(c); return 0; }
+static void fake_set_debug(SMBCCTX *c, int debug) { }
+static void *fake_get_user_data(SMBCCTX *c) { return ((t_fake_ctx*)c)->user_data; }
+static void fake_set_user_data(SMBCCTX *c, void *data) { ((t_fake_ctx*)c)->user_data = data; }
+static void fake_set_auth_fn(SMBCCTX *c, smbc_get_auth_data_with_context_fn fn) { }
+
+static smbc_open_fn fake_get_open(SMBCCTX *c) { return &fake_open; }
+static smbc_read_fn fake_get_read(SMBCCTX *c) { return &fake_read; }
+static smbc_write_fn fake_get_write(SMBCCTX *c) { return &fake_write; }
+static smbc_lseek_fn fake_get_lseek(SMBCCTX *c) { return &fake_lseek; }
+static smbc_close_fn fake_get_close(SMBCCTX *c) { return &fake_close; }
+static smbc_stat_fn fake_get_stat(SMBCCTX *c) { return &fake_stat; }
+static smbc_fstat_fn fake_get_fstat(SMBCCTX *c) { return &fake_fstat; }
+static smbc_unlink_fn fake_get_unlink(SMBCCTX *c) { return &fake_unlink; }
+static smbc_rename_fn fake_get_rename(SMBCCTX *c) { return &fake_rename; }
+static smbc_mkdir_fn fake_get_mkdir(SMBCCTX *c) { return &fake_mkdir; }
+static smbc_rmdir_fn fake_get_rmdir(SMBCCTX *c) { return &fake_rmdir; }
+static smbc_chmod_fn fake_get_chmod(SMBCCTX *c) { return &fake_chmod; }
+static smbc_opendir_fn fake_get_opendir(SMBCCTX *c) { return &fake_opendir; }
+static smbc_readdir_fn fake_get_readdir(SMBCCTX *c) { return &fake_readdir; }
+static smbc_closedir_fn fake_get_closedir(SMBCCTX *c) { return &fake_closedir; }
+static smbc_lseekdir_fn fake_get_lseekdir(SMBCCTX *c) { return &fake_lseekdir; }
+#ifdef HAVE_SMBC_READDIRPLUS2
+static smbc_readdirplus2_fn fake_get_readdirplus2(SMBCCTX *c) { return &fake_readdirplus2; }
+#endif
+#ifdef HAVE_SMBC_SPLICE
+static smbc_splice_fn fake_get_splice(SMBCCTX *c) { return &fake_splice; }
+#endif
+
+t_smbcw_backend backend_fake = {
+	"fake",
+	&fake_init,
+	&fake_new_context,
+	&fake_init_context,
+	&fake_free_context,
+	&fake_set_debug,
+	&fake_get_user_data,
+	&fake_set_user_data,
+	&fake_set_auth_fn,
+	&fake_get_open,
+	&fake_get_read,
+	&fake_get_write,
+	&fake_get_lseek,
+	&fake_get_close,
+	&fake_get_stat,
+	&fake_get_fstat,
+	&fake_get_unlink,
+	&fake_get_rename,
+	&fake_get_mkdir,
+	&fake_get_rmdir,
+	&fake_get_chmod,
+	&fake_get_opendir,
+	&fake_get_readdir,
+	&fake_get_closedir,
+	&fake_get_lseekdir,
+#ifdef HAVE_SMBC_READDIRPLUS2
+	&fake_get_readdirplus2,
+#endif
+#ifdef HAVE_SMBC_SPLICE
+	&fake_get_splice,
+#endif
+};
+
+void smbcw_fake_configure(const smbcw_fake_config *config)
+{
+	snprintf(fake_root, sizeof(fake_root), "%s",
+		config->root ? config->root : FAKE_DEFAULT_ROOT);
+	fake_latency_us = config->latency_us > 0 ? config->latency_us : 0;
+	fake_bandwidth_mbps = config->bandwidth_mbps > 0 ? config->bandwidth_mbps : 0;
+	fake_fail_every = config->fail_every > 0 ? config->fail_every : 0;
+	fake_fail_errno = config->fail_errno ? config->fail_errno : EIO;
+	fake_configured = 1;
+}
+
+uint64_t smbcw_fake_round_trips()
+{
+	return __atomic_load_n(&fake_round_trips, __ATOMIC_RELAXED);
+}
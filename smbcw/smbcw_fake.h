@@ -0,0 +1,34 @@
+#ifndef _FAKE_H
+#define _FAKE_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "smbcw_backend.h"
+
+/**
+ * Backend which serves the shares from a local directory, see
+ * smbcw_fake_configure. It lets tests and benchmarks run without a Samba server
+ * and simulates latency, limited bandwidth and failing requests
+ * deterministically. All functions may be called by several threads at the same
+ * time.
+ */
+extern t_smbcw_backend backend_fake;
+
+#endif /*_FAKE_H*/
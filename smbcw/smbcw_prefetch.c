@@ -0,0 +1,256 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "smbcw_common.h"
+#include "smbcw_connections.h"
+#include "smbcw_backend.h"
+#include "smbcw_prefetch.h"
+
+/**
+ * Body of the prefetch thread. Opens the file, reads it into the next free block
+ * until the end of the file is reached, a read fails or the thread is stopped and
+ * closes it again.
+ */
+static void *prefetch_thread(void *arg)
+{
+	lp_smbcw_prefetch prefetch = arg;
+	SMBCFILE *file = NULL;
+	smbc_close_fn close_fn = NULL;
+
+	//Read through a context of the pool which only this thread uses, as the reader
+	//may hold all others. The pool keeps it for the next prefetched file, so the
+	//session is only set up once.
+	connections_set_thread_private(1);
+	SMBCCTX *ctx = connections_checkout_ctx(prefetch->ctx);
+
+	if (ctx)
+	{
+		smbc_open_fn open_fn = backend_active->get_open(ctx);
+		smbc_lseek_fn lseek_fn = backend_active->get_lseek(ctx);
+		close_fn = backend_active->get_close(ctx);
+
+		if (open_fn && lseek_fn && close_fn)
+			file = open_fn(ctx, prefetch->filename, O_RDONLY, 0);
+
+		if (file && prefetch->offset > 0 &&
+			lseek_fn(ctx, file, prefetch->offset, SEEK_SET) < 0) {
+			close_fn(ctx, file);
+			file = NULL;
+		}
+	}
+
+	smbc_read_fn read_fn = file ? backend_active->get_read(ctx) : NULL;
+
+	//Tell prefetch_start whether the file could be opened
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->started = read_fn ? 1 : -1;
+	pthread_cond_broadcast(&prefetch->cond);
+
+	while (read_fn && !prefetch->stop && !prefetch->eof)
+	{
+		//Wait until the reader has consumed a block
+		if (prefetch->filled >= prefetch->block_count) {
+			pthread_cond_wait(&prefetch->cond, &prefetch->lock);
+			continue;
+		}
+
+		//The reader never touches the blocks behind the filled ones, so the block
+		//can be read without holding the lock
+		t_smbcw_prefetch_block *block = &prefetch->blocks[
+			(prefetch->head + prefetch->filled) % prefetch->block_count];
+		pthread_mutex_unlock(&prefetch->lock);
+
+		ssize_t count = read_fn(ctx, file, block->data, prefetch->block_size);
+		int err = errno;
+
+		pthread_mutex_lock(&prefetch->lock);
+
+		if (count > 0) {
+			block->len = count;
+			prefetch->filled++;
+		} else {
+			prefetch->eof = 1;
+			if (count < 0)
+				prefetch->err = err;
+		}
+
+		//Wake up the reader
+		pthread_cond_broadcast(&prefetch->cond);
+	}
+
+	pthread_mutex_unlock(&prefetch->lock);
+
+	if (file)
+		close_fn(ctx, file);
+	if (ctx)
+		connections_checkin_ctx(ctx);
+
+	return NULL;
+}
+
+/**
+ * Frees the blocks of the given prefetcher and the prefetcher itself
+ */
+static void prefetch_free(lp_smbcw_prefetch prefetch)
+{
+	int i;
+
+	if (prefetch->blocks) {
+		for (i = 0; i < prefetch->block_count; i++)
+			free(prefetch->blocks[i].data);
+		free(prefetch->blocks);
+	}
+
+	free(prefetch->filename);
+	free(prefetch);
+}
+
+/* See smbcw_prefetch.h */
+lp_smbcw_prefetch prefetch_start(SMBCCTX *ctx, const char *filename, int64_t offset,
+	int block_count, size_t block_size)
+{
+	int i;
+
+	if (block_count <= 0 || block_size == 0)
+		return NULL;
+
+	lp_smbcw_prefetch prefetch = malloc(sizeof(*prefetch));
+	if (!prefetch)
+		return NULL;
+	memset(prefetch, 0, sizeof(*prefetch));
+	prefetch->ctx = ctx;
+	prefetch->block_count = block_count;
+	prefetch->block_size = block_size;
+	prefetch->offset = offset;
+
+	prefetch->filename = strdup(filename);
+	if (!prefetch->filename)
+		goto fail;
+
+	//Reserve the blocks
+	prefetch->blocks = calloc(block_count, sizeof(t_smbcw_prefetch_block));
+	if (!prefetch->blocks)
+		goto fail;
+	for (i = 0; i < block_count; i++) {
+		prefetch->blocks[i].data = malloc(block_size);
+		if (!prefetch->blocks[i].data)
+			goto fail;
+	}
+
+	pthread_mutex_init(&prefetch->lock, NULL);
+	pthread_cond_init(&prefetch->cond, NULL);
+
+	if (pthread_create(&prefetch->thread, NULL, &prefetch_thread, prefetch) != 0) {
+		pthread_cond_destroy(&prefetch->cond);
+		pthread_mutex_destroy(&prefetch->lock);
+		goto fail;
+	}
+
+	//Wait for the thread to open the file once more
+	pthread_mutex_lock(&prefetch->lock);
+	while (!prefetch->started)
+		pthread_cond_wait(&prefetch->cond, &prefetch->lock);
+	pthread_mutex_unlock(&prefetch->lock);
+
+	if (prefetch->started < 0) {
+		prefetch_stop(prefetch);
+		return NULL;
+	}
+
+	return prefetch;
+
+fail:
+	prefetch_free(prefetch);
+	return NULL;
+}
+
+/* See smbcw_prefetch.h */
+int64_t prefetch_read(lp_smbcw_prefetch prefetch, char *buf, uint64_t size)
+{
+	int64_t ret = 0;
+
+	pthread_mutex_lock(&prefetch->lock);
+
+	//Wait for the thread to complete a block
+	while (prefetch->filled == 0 && !prefetch->eof)
+		pthread_cond_wait(&prefetch->cond, &prefetch->lock);
+
+	if (prefetch->filled > 0)
+	{
+		t_smbcw_prefetch_block *block = &prefetch->blocks[prefetch->head];
+		size_t count = block->len - prefetch->pos;
+		if (count > size)
+			count = size;
+
+		memcpy(buf, block->data + prefetch->pos, count);
+		prefetch->pos += count;
+		prefetch->offset += count;
+		ret = count;
+
+		//Hand the block back to the thread once it has been consumed
+		if (prefetch->pos >= block->len) {
+			prefetch->pos = 0;
+			prefetch->head = (prefetch->head + 1) % prefetch->block_count;
+			prefetch->filled--;
+			pthread_cond_broadcast(&prefetch->cond);
+		}
+	}
+	else if (prefetch->err)
+	{
+		errno = prefetch->err;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return ret;
+}
+
+/* See smbcw_prefetch.h */
+int64_t prefetch_tell(lp_smbcw_prefetch prefetch)
+{
+	pthread_mutex_lock(&prefetch->lock);
+	int64_t offset = prefetch->offset;
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return offset;
+}
+
+/* See smbcw_prefetch.h */
+void prefetch_stop(lp_smbcw_prefetch prefetch)
+{
+	//Tell the thread to stop and wait for its current read to finish
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->stop = 1;
+	pthread_cond_broadcast(&prefetch->cond);
+	pthread_mutex_unlock(&prefetch->lock);
+
+	pthread_join(prefetch->thread, NULL);
+
+	pthread_cond_destroy(&prefetch->cond);
+	pthread_mutex_destroy(&prefetch->lock);
+
+	prefetch_free(prefetch);
+}
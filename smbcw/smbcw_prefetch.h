@@ -0,0 +1,107 @@
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <libsmbclient.h>
+
+/**
+ * Block of a file read by the prefetch thread
+ */
+typedef struct {
+	char *data;
+	size_t len;
+} t_smbcw_prefetch_block;
+
+/**
+ * Prefetcher of a file which is read sequentially. A background thread reads the
+ * file block by block through a handle of its own and keeps up to block_count
+ * blocks ahead of the reader, so the reader does not wait for the server as long
+ * as it is slower than the network. One read is in flight at a time, as a
+ * context only executes one request at a time. Memory use is bounded by
+ * block_count * block_size.
+ */
+typedef struct {
+	SMBCCTX *ctx;
+	char *filename;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	t_smbcw_prefetch_block *blocks;
+	int block_count;
+	size_t block_size;
+
+	//Index of the block the reader is in, number of blocks completed by the thread
+	//and read position in the current block
+	int head;
+	int filled;
+	size_t pos;
+
+	//File offset of the next byte handed to the reader
+	int64_t offset;
+
+	//Set by the thread to 1 once the file is open, to -1 if that failed
+	int started;
+
+	//Set by the thread when the end of the file is reached or a read failed
+	int eof;
+	int err;
+	//Set by the reader to stop the thread
+	int stop;
+} t_smbcw_prefetch;
+
+/**
+ * Pointer on t_smbcw_prefetch
+ */
+typedef t_smbcw_prefetch *lp_smbcw_prefetch;
+
+/**
+ * Starts prefetching the file with the given smbc filename from offset on. The
+ * thread reads through a context of the pool of ctx which no other thread uses,
+ * see connections_set_thread_private, and which is reused for the following
+ * files. Returns NULL if the file could not be opened or the thread could not be
+ * started.
+ */
+lp_smbcw_prefetch prefetch_start(SMBCCTX *ctx, const char *filename, int64_t offset,
+	int block_count, size_t block_size);
+
+/**
+ * Copies up to size bytes prefetched to buf and returns their number. Waits for
+ * the thread if no block is ready. Returns 0 at the end of the file and -1 with
+ * errno set if the thread failed to read the file.
+ */
+int64_t prefetch_read(lp_smbcw_prefetch prefetch, char *buf, uint64_t size);
+
+/**
+ * Returns the file offset of the next byte prefetch_read would return.
+ */
+int64_t prefetch_tell(lp_smbcw_prefetch prefetch);
+
+/**
+ * Stops the prefetch thread, which closes the file and checks its context in, and
+ * frees prefetch.
+ */
+void prefetch_stop(lp_smbcw_prefetch prefetch);
+
+#endif /*_PREFETCH_H*/
@@ -0,0 +1,195 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "smbcw.h"
+#include "smbcw_slowlog.h"
+#include "smbcw_stats.h"
+#include "smbcw_url.h"
+
+/**
+ * Class of each operation, indexed by SMBCW_OP_*
+ */
+static const int slowlog_classes[SMBCW_OP_COUNT] = {
+	SMBCW_SLOW_OPEN,			//open
+	SMBCW_SLOW_OPEN,			//close
+	SMBCW_SLOW_READ,			//read
+	SMBCW_SLOW_WRITE,			//write
+	SMBCW_SLOW_READ,			//pread
+	SMBCW_SLOW_WRITE,			//pwrite
+	SMBCW_SLOW_METADATA,	//seek
+	SMBCW_SLOW_WRITE,			//flush
+	SMBCW_SLOW_METADATA,	//fstat
+	SMBCW_SLOW_METADATA,	//stat
+	SMBCW_SLOW_METADATA,	//stat_many
+	SMBCW_SLOW_METADATA,	//rename
+	SMBCW_SLOW_METADATA,	//unlink
+	SMBCW_SLOW_METADATA,	//mkdir
+	SMBCW_SLOW_METADATA,	//rmdir
+	SMBCW_SLOW_METADATA,	//chmod
+	SMBCW_SLOW_OPEN,			//opendir
+	SMBCW_SLOW_OPEN,			//closedir
+	SMBCW_SLOW_READDIR,		//readdir
+	SMBCW_SLOW_READDIR,		//rewinddir
+	SMBCW_SLOW_READ,			//copy
+	SMBCW_SLOW_READ,			//fcopy
+	SMBCW_SLOW_READ,			//parallel_get
+	SMBCW_SLOW_WRITE			//parallel_put
+};
+
+uint64_t slowlog_min_ns = UINT64_MAX;
+
+/**
+ * Threshold of each class in ns, 0 if disabled
+ */
+uint64_t slowlog_thresholds[SMBCW_SLOW_CLASS_COUNT];
+
+/**
+ * Descriptor the lines are written to
+ */
+int slowlog_fd = SMBCW_SLOW_LOG_SYSLOG;
+
+/**
+ * Serializes the updates of the thresholds
+ */
+pthread_mutex_t slowlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* See slowlog.h */
+int slowlog_set_threshold(int cls, uint64_t ns)
+{
+	uint64_t min = UINT64_MAX;
+	int i;
+
+	if (cls < 0 || cls >= SMBCW_SLOW_CLASS_COUNT)
+		return -1;
+
+	pthread_mutex_lock(&slowlog_lock);
+
+	__atomic_store_n(&slowlog_thresholds[cls], ns, __ATOMIC_RELAXED);
+	for (i = 0; i < SMBCW_SLOW_CLASS_COUNT; i++)
+		if (slowlog_thresholds[i] && slowlog_thresholds[i] < min)
+			min = slowlog_thresholds[i];
+	__atomic_store_n(&slowlog_min_ns, min, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&slowlog_lock);
+
+	return 0;
+}
+
+/* See slowlog.h */
+void slowlog_set_fd(int fd)
+{
+	__atomic_store_n(&slowlog_fd, fd, __ATOMIC_RELAXED);
+}
+
+/**
+ * Appends str to the line at *pos, control characters are replaced by "?" so
+ * a file name cannot start a line of its own
+ */
+static void slowlog_append(char *line, size_t size, size_t *pos, const char *str)
+{
+	for (; *str && *pos < size - 1; str++)
+		line[(*pos)++] = ((unsigned char)*str < 0x20 || *str == 0x7f) ? '?' : *str;
+	line[*pos] = 0;
+}
+
+/* See slowlog.h */
+void slowlog_record(int op, uint64_t ns, int64_t ret, int err, const char *url,
+	int host)
+{
+	int saved_errno = errno;
+	int fd = __atomic_load_n(&slowlog_fd, __ATOMIC_RELAXED);
+	t_smbcw_url parts;
+	const char *host_name = NULL, *share = NULL, *path = NULL;
+	char *buf = NULL, *slash;
+	char line[1024], num[128];
+	size_t pos = 0;
+
+	if (op < 0 || op >= SMBCW_OP_COUNT || fd == -1)
+		return;
+
+	uint64_t threshold = __atomic_load_n(&slowlog_thresholds[slowlog_classes[op]],
+		__ATOMIC_RELAXED);
+	if (!threshold || ns < threshold)
+		return;
+
+	//Split the url into server, share and path, user and password are dropped
+	if (url && (buf = malloc(SMBCW_URL_BUF_SIZE(strlen(url)))) &&
+		smbcw_url_parse(&parts, url, buf, SMBCW_URL_BUF_SIZE(strlen(url))) == 0 &&
+		parts.host && parts.host[0])
+	{
+		host_name = parts.host;
+		share = parts.path;
+		slash = strchr(parts.path, '/');
+		if (slash) {
+			*slash = 0;
+			path = slash + 1;
+		}
+	}
+	if (!host_name)
+		host_name = stats_host_name(host);
+
+	snprintf(num, sizeof(num), "smbcw: slow %s on ", stats_op_name(op));
+	slowlog_append(line, sizeof(line), &pos, num);
+	slowlog_append(line, sizeof(line), &pos, host_name ? host_name : "-");
+	slowlog_append(line, sizeof(line), &pos, ", share ");
+	slowlog_append(line, sizeof(line), &pos, share && share[0] ? share : "-");
+	slowlog_append(line, sizeof(line), &pos, ", path /");
+	slowlog_append(line, sizeof(line), &pos, path ? path : "");
+
+	snprintf(num, sizeof(num), ": %.1f ms", ns / 1e6);
+	slowlog_append(line, sizeof(line), &pos, num);
+
+	switch (op) {
+		case SMBCW_OP_READ: case SMBCW_OP_PREAD: case SMBCW_OP_WRITE:
+		case SMBCW_OP_PWRITE: case SMBCW_OP_COPY: case SMBCW_OP_FCOPY:
+		case SMBCW_OP_PARALLEL_GET: case SMBCW_OP_PARALLEL_PUT:
+			snprintf(num, sizeof(num), ", %lld bytes", (long long)(ret > 0 ? ret : 0));
+			slowlog_append(line, sizeof(line), &pos, num);
+			break;
+	}
+
+	if (ret < 0)
+		snprintf(num, sizeof(num), ", result %lld, error %d", (long long)ret, err);
+	else
+		snprintf(num, sizeof(num), ", result %lld", (long long)ret);
+	slowlog_append(line, sizeof(line), &pos, num);
+
+	free(buf);
+
+	if (fd == SMBCW_SLOW_LOG_SYSLOG) {
+		syslog(LOG_WARNING, "%s", line);
+	} else {
+		//A single write keeps the lines of several threads apart
+		if (pos == sizeof(line) - 1)
+			pos--;
+		line[pos++] = '\n';
+		write(fd, line, pos);
+	}
+
+	errno = saved_errno;
+}
@@ -0,0 +1,60 @@
+#ifndef _SLOWLOG_H
+#define _SLOWLOG_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+/**
+ * Log of calls which took longer than the threshold of their class of operations
+ * (SMBCW_SLOW_*), see smbcw_set_slow_threshold. The log is written from the
+ * _STATS_END macro of smbcw.c with the duration measured by stats_record, so
+ * while all thresholds are disabled it costs one comparison per call.
+ */
+
+/**
+ * Lowest enabled threshold in ns, UINT64_MAX while all are disabled. Calls
+ * shorter than it are not passed to slowlog_record.
+ */
+extern uint64_t slowlog_min_ns;
+
+/**
+ * Sets the threshold of the class cls (SMBCW_SLOW_*) to ns, 0 disables it.
+ * Returns -1 if cls is invalid.
+ */
+int slowlog_set_threshold(int cls, uint64_t ns);
+
+/**
+ * Sets the descriptor the log is written to, SMBCW_SLOW_LOG_SYSLOG for syslog
+ * (default) or -1 to drop the lines.
+ */
+void slowlog_set_fd(int fd);
+
+/**
+ * Logs a call of type op (SMBCW_OP_*) which took ns nanoseconds and returned ret
+ * if it exceeds the threshold of its class. url is the url or smbc file name the
+ * call used, only server, share and path of it are written. host is the stats
+ * host id, used if url is NULL. err is the smbcw error of failed calls. Does not
+ * change errno.
+ */
+void slowlog_record(int op, uint64_t ns, int64_t ret, int err, const char *url,
+	int host);
+
+#endif /*_SLOWLOG_H*/
@@ -0,0 +1,443 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "smbcw_stats.h"
+
+/**
+ * Latencies below 16 ns get a bucket of their own, every following power of two
+ * is split into 8 buckets. Latencies of 2^40 ns (about 18 minutes) and more
+ * share the last bucket.
+ */
+#define STATS_LINEAR 16
+#define STATS_SUB_BITS 3
+#define STATS_MAX_EXP 40
+#define STATS_BUCKETS (STATS_LINEAR + (STATS_MAX_EXP - STATS_SUB_BITS) * \
+	(1 << STATS_SUB_BITS))
+
+/**
+ * Histogram of the latencies of one operation on one host
+ */
+typedef struct {
+	uint64_t total_ns;
+	uint64_t errors;
+	uint64_t round_trips;
+	uint64_t max_round_trips;
+	uint64_t buckets[STATS_BUCKETS];
+} t_stats_hist;
+
+/**
+ * Pointer on t_stats_hist
+ */
+typedef t_stats_hist *lp_stats_hist;
+
+/**
+ * Names of the operations, indexed by SMBCW_OP_*
+ */
+static const char *stats_op_names[SMBCW_OP_COUNT] = {
+	"open", "close", "read", "write", "pread", "pwrite", "seek", "flush", "fstat",
+	"stat", "stat_many", "rename", "unlink", "mkdir", "rmdir", "chmod", "opendir",
+	"closedir", "readdir", "rewinddir", "copy", "fcopy", "parallel_get",
+	"parallel_put"
+};
+
+int stats_enabled = 0;
+
+/**
+ * File descriptor every call is logged to, -1 if disabled
+ */
+int stats_log_fd = -1;
+
+/**
+ * Histograms by operation and host id, created by stats_record when they are
+ * needed for the first time
+ */
+lp_stats_hist stats_hist[SMBCW_OP_COUNT][STATS_MAX_HOSTS];
+
+/**
+ * Registered host names. Id 0 stands for unknown and all hosts which did not fit
+ * into the table.
+ */
+char *stats_hosts[STATS_MAX_HOSTS];
+int stats_host_count = 1;
+
+/**
+ * Byte counters and gauges, only accessed atomically
+ */
+uint64_t stats_bytes_read = 0;
+uint64_t stats_bytes_written = 0;
+int64_t stats_fds = 0;
+int64_t stats_ctxs = 0;
+
+/**
+ * Protects the host table
+ */
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the bucket of the given latency
+ */
+static int stats_bucket(uint64_t ns)
+{
+	if (ns < STATS_LINEAR)
+		return ns;
+
+	int exp = 63 - __builtin_clzll(ns);
+	if (exp > STATS_MAX_EXP)
+		return STATS_BUCKETS - 1;
+
+	return STATS_LINEAR + (exp - 4) * (1 << STATS_SUB_BITS) +
+		((ns >> (exp - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1));
+}
+
+/**
+ * Returns the highest latency which falls into the given bucket
+ */
+static uint64_t stats_bucket_max(int bucket)
+{
+	if (bucket < STATS_LINEAR)
+		return bucket;
+
+	int exp = (bucket - STATS_LINEAR) / (1 << STATS_SUB_BITS) + 4;
+	uint64_t sub = (bucket - STATS_LINEAR) % (1 << STATS_SUB_BITS);
+
+	return (((1 << STATS_SUB_BITS) + sub + 1) << (exp - STATS_SUB_BITS)) - 1;
+}
+
+/* See stats.h */
+uint64_t stats_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* See stats.h */
+int stats_host_id(const char *host)
+{
+	int i, id = 0;
+
+	if (!host)
+		return 0;
+
+	pthread_mutex_lock(&stats_lock);
+
+	for (i = 1; i < stats_host_count; i++)
+		if (strcasecmp(stats_hosts[i], host) == 0)
+			break;
+
+	if (i < stats_host_count) {
+		id = i;
+	} else if (stats_host_count < STATS_MAX_HOSTS) {
+		stats_hosts[stats_host_count] = strdup(host);
+		if (stats_hosts[stats_host_count])
+			id = stats_host_count++;
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+
+	return id;
+}
+
+/* See stats.h */
+const char *stats_host_name(int host)
+{
+	//Registered names never change
+	if (host <= 0 || host >= STATS_MAX_HOSTS)
+		return NULL;
+	return __atomic_load_n(&stats_hosts[host], __ATOMIC_ACQUIRE);
+}
+
+/* See stats.h */
+const char *stats_op_name(int op)
+{
+	return (op >= 0 && op < SMBCW_OP_COUNT) ? stats_op_names[op] : "unknown";
+}
+
+/**
+ * Returns the histogram of op on host, creates it if it does not exist yet.
+ * Returns NULL if it could not be created.
+ */
+static lp_stats_hist stats_get_hist(int op, int host)
+{
+	lp_stats_hist hist = __atomic_load_n(&stats_hist[op][host], __ATOMIC_ACQUIRE);
+
+	if (!hist)
+	{
+		lp_stats_hist created = calloc(1, sizeof(*created));
+		if (!created)
+			return NULL;
+
+		//Another thread might have been faster
+		if (__atomic_compare_exchange_n(&stats_hist[op][host], &hist, created, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			hist = created;
+		else
+			free(created);
+	}
+
+	return hist;
+}
+
+/* See stats.h */
+void stats_log(int op, int host, uint64_t ns, int64_t ret, uint64_t round_trips)
+{
+	int err = errno;
+	char line[512];
+	int len;
+
+	if (op < 0 || op >= SMBCW_OP_COUNT || host < 0 || host >= STATS_MAX_HOSTS)
+		return;
+
+	//Registered names never change
+	len = snprintf(line, sizeof(line),
+		"smbcw: %s %s: %llu round trips, %llu us, result %lld\n",
+		stats_op_names[op], host ? stats_hosts[host] : "-",
+		(unsigned long long)round_trips, (unsigned long long)(ns / 1000),
+		(long long)ret);
+
+	//A single write keeps the lines of several threads apart
+	if (len > 0)
+		write(stats_log_fd, line, len < sizeof(line) ? len : sizeof(line) - 1);
+
+	errno = err;
+}
+
+/* See stats.h */
+void stats_record(int op, int host, uint64_t ns, int64_t ret,
+	uint64_t round_trips)
+{
+	int err = errno;
+
+	if (op < 0 || op >= SMBCW_OP_COUNT || host < 0 || host >= STATS_MAX_HOSTS)
+		return;
+
+	lp_stats_hist hist = stats_get_hist(op, host);
+
+	if (hist)
+	{
+		__atomic_fetch_add(&hist->buckets[stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&hist->total_ns, ns, __ATOMIC_RELAXED);
+		if (ret < 0)
+			__atomic_fetch_add(&hist->errors, 1, __ATOMIC_RELAXED);
+
+		//Calls served from the caches make no round trips
+		if (round_trips)
+		{
+			__atomic_fetch_add(&hist->round_trips, round_trips, __ATOMIC_RELAXED);
+			uint64_t max = __atomic_load_n(&hist->max_round_trips, __ATOMIC_RELAXED);
+			while (round_trips > max && !__atomic_compare_exchange_n(
+				&hist->max_round_trips, &max, round_trips, 1, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED));
+		}
+	}
+
+	if (ret > 0)
+	{
+		switch (op) {
+			case SMBCW_OP_READ:
+			case SMBCW_OP_PREAD:
+			case SMBCW_OP_PARALLEL_GET:
+				__atomic_fetch_add(&stats_bytes_read, ret, __ATOMIC_RELAXED);
+				break;
+			case SMBCW_OP_WRITE:
+			case SMBCW_OP_PWRITE:
+			case SMBCW_OP_PARALLEL_PUT:
+				__atomic_fetch_add(&stats_bytes_written, ret, __ATOMIC_RELAXED);
+				break;
+		}
+	}
+
+	errno = err;
+}
+
+/* See stats.h */
+void stats_fd_opened()
+{
+	__atomic_fetch_add(&stats_fds, 1, __ATOMIC_RELAXED);
+}
+
+/* See stats.h */
+void stats_fd_closed()
+{
+	__atomic_fetch_sub(&stats_fds, 1, __ATOMIC_RELAXED);
+}
+
+/* See stats.h */
+void stats_ctx_created()
+{
+	__atomic_fetch_add(&stats_ctxs, 1, __ATOMIC_RELAXED);
+}
+
+/* See stats.h */
+void stats_ctx_freed()
+{
+	__atomic_fetch_sub(&stats_ctxs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Writes count, latency sum, percentiles and maximum of the given histogram to
+ * op_stats
+ */
+static void stats_summarize(lp_stats_hist hist, smbcw_op_stats *op_stats)
+{
+	static const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+	uint64_t *results[4] = {&op_stats->p50_ns, &op_stats->p90_ns,
+		&op_stats->p99_ns, &op_stats->p999_ns};
+	uint64_t buckets[STATS_BUCKETS];
+	uint64_t seen = 0;
+	int i, q = 0;
+
+	//Work on a copy, the counts may change while we are looking at them
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		buckets[i] = __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+		op_stats->count += buckets[i];
+	}
+	op_stats->total_ns = __atomic_load_n(&hist->total_ns, __ATOMIC_RELAXED);
+	op_stats->errors = __atomic_load_n(&hist->errors, __ATOMIC_RELAXED);
+	op_stats->round_trips = __atomic_load_n(&hist->round_trips, __ATOMIC_RELAXED);
+	op_stats->max_round_trips = __atomic_load_n(&hist->max_round_trips,
+		__ATOMIC_RELAXED);
+
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		if (!buckets[i])
+			continue;
+
+		seen += buckets[i];
+		op_stats->max_ns = stats_bucket_max(i);
+
+		while (q < 4 && seen >= quantiles[q] * op_stats->count)
+			*results[q++] = op_stats->max_ns;
+	}
+}
+
+/* See stats.h */
+int stats_get(smbcw_stats *stats)
+{
+	char *hosts[STATS_MAX_HOSTS];
+	int op, host, host_count;
+
+	stats->bytes_read = __atomic_load_n(&stats_bytes_read, __ATOMIC_RELAXED);
+	stats->bytes_written = __atomic_load_n(&stats_bytes_written, __ATOMIC_RELAXED);
+	stats->descriptors_open = __atomic_load_n(&stats_fds, __ATOMIC_RELAXED);
+	stats->contexts_alive = __atomic_load_n(&stats_ctxs, __ATOMIC_RELAXED);
+	stats->op_count = 0;
+	stats->ops = NULL;
+
+	//Registered names never change, so they can be used without the lock
+	pthread_mutex_lock(&stats_lock);
+	host_count = stats_host_count;
+	memcpy(hosts, stats_hosts, sizeof(hosts));
+	pthread_mutex_unlock(&stats_lock);
+
+	stats->ops = calloc(SMBCW_OP_COUNT * host_count, sizeof(*stats->ops));
+	if (!stats->ops) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (op = 0; op < SMBCW_OP_COUNT; op++)
+	{
+		for (host = 0; host < host_count; host++)
+		{
+			lp_stats_hist hist = __atomic_load_n(&stats_hist[op][host],
+				__ATOMIC_ACQUIRE);
+			smbcw_op_stats *op_stats = &stats->ops[stats->op_count];
+
+			if (!hist)
+				continue;
+
+			stats_summarize(hist, op_stats);
+			if (op_stats->count == 0) {
+				memset(op_stats, 0, sizeof(*op_stats));
+				continue;
+			}
+
+			op_stats->op = op;
+			op_stats->name = stats_op_names[op];
+			strncpy(op_stats->host, host ? hosts[host] : "",
+				sizeof(op_stats->host) - 1);
+			stats->op_count++;
+		}
+	}
+
+	return 0;
+}
+
+/* See stats.h */
+void stats_reset()
+{
+	int op, host, i;
+
+	for (op = 0; op < SMBCW_OP_COUNT; op++)
+	{
+		for (host = 0; host < STATS_MAX_HOSTS; host++)
+		{
+			lp_stats_hist hist = __atomic_load_n(&stats_hist[op][host],
+				__ATOMIC_ACQUIRE);
+
+			if (!hist)
+				continue;
+
+			for (i = 0; i < STATS_BUCKETS; i++)
+				__atomic_store_n(&hist->buckets[i], 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&hist->total_ns, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&hist->errors, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&hist->round_trips, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&hist->max_round_trips, 0, __ATOMIC_RELAXED);
+		}
+	}
+
+	__atomic_store_n(&stats_bytes_read, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats_bytes_written, 0, __ATOMIC_RELAXED);
+}
+
+/* See stats.h */
+void stats_finalize()
+{
+	int op, host;
+
+	for (op = 0; op < SMBCW_OP_COUNT; op++)
+	{
+		for (host = 0; host < STATS_MAX_HOSTS; host++)
+		{
+			free(stats_hist[op][host]);
+			stats_hist[op][host] = NULL;
+		}
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	for (host = 1; host < stats_host_count; host++)
+		free(stats_hosts[host]);
+	stats_host_count = 1;
+	pthread_mutex_unlock(&stats_lock);
+
+	stats_reset();
+}
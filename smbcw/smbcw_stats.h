@@ -0,0 +1,112 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "smbcw.h"
+
+/**
+ * Latency histograms per operation and host and the counters behind
+ * smbcw_get_stats. A histogram has 8 buckets per power of two, so percentiles
+ * are accurate to 12.5%. Histograms are created on first use and only updated
+ * with atomic operations, all functions may be called by several threads at the
+ * same time.
+ */
+
+/**
+ * Maximum number of hosts histograms are kept for. Operations on further hosts
+ * are recorded for host 0, which stands for all other hosts.
+ */
+#define STATS_MAX_HOSTS 64
+
+/**
+ * Set while operations are recorded, see smbcw_set_stats
+ */
+extern int stats_enabled;
+
+/**
+ * File descriptor each recorded call is logged to, -1 (default) if calls are not
+ * logged, see smbcw_set_roundtrip_log
+ */
+extern int stats_log_fd;
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds
+ */
+uint64_t stats_clock();
+
+/**
+ * Returns the id of the given host name, which is registered if it is not known
+ * yet. Returns 0 if host is NULL or no more hosts can be registered.
+ */
+int stats_host_id(const char *host);
+
+/**
+ * Returns the name of the registered host, NULL for host 0
+ */
+const char *stats_host_name(int host);
+
+/**
+ * Returns the name of the operation op (SMBCW_OP_*), e.g. "stat"
+ */
+const char *stats_op_name(int op);
+
+/**
+ * Records an operation of type op (SMBCW_OP_*) on host which took ns nanoseconds,
+ * made round_trips calls to the backend and returned ret. Negative return values
+ * are counted as errors, the return values of reads and writes as bytes. Only
+ * called while stats_enabled is set. Does not change errno.
+ */
+void stats_record(int op, int host, uint64_t ns, int64_t ret,
+	uint64_t round_trips);
+
+/**
+ * Writes one line about an operation (see stats_record) to stats_log_fd. Only
+ * called while stats_log_fd is set. Does not change errno.
+ */
+void stats_log(int op, int host, uint64_t ns, int64_t ret, uint64_t round_trips);
+
+/**
+ * Update the gauges of open descriptors and existing contexts. These are kept
+ * even while recording is disabled.
+ */
+void stats_fd_opened();
+void stats_fd_closed();
+void stats_ctx_created();
+void stats_ctx_freed();
+
+/**
+ * Fills stats, except for the connection counters, see smbcw_get_stats
+ */
+int stats_get(smbcw_stats *stats);
+
+/**
+ * Clears all histograms and byte counters
+ */
+void stats_reset();
+
+/**
+ * Frees the histograms and the host table
+ */
+void stats_finalize();
+
+#endif /*_STATS_H*/
@@ -0,0 +1,366 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "smbcw.h"
+#include "smbcw_trace.h"
+#include "smbcw_stats.h"
+
+/**
+ * Number of records buffered before they are written to the file
+ */
+#define TRACE_BUFFER_RECORDS 1024
+
+int trace_enabled = 0;
+
+__thread int trace_depth = 0;
+
+/**
+ * Number of the calling thread in the trace file trace_thread_file, which is
+ * compared with trace_file to number the threads again in every new file
+ */
+__thread uint16_t trace_thread = 0;
+__thread unsigned int trace_thread_file = 0;
+
+/**
+ * State of the running trace, protected by trace_lock. trace_path is the path
+ * passed to trace_start, trace_file counts the files opened. trace_reopen is set
+ * in a forked child, which writes a file of its own from its first call on.
+ */
+char *trace_path = NULL;
+int trace_fd = -1;
+int trace_reopen = 0;
+unsigned int trace_file = 0;
+uint64_t trace_start_ns = 0;
+uint64_t trace_salt = 0;
+uint16_t trace_threads = 0;
+t_trace_record trace_buffer[TRACE_BUFFER_RECORDS];
+int trace_buffered = 0;
+
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Registers the fork handlers once
+ */
+static pthread_once_t trace_atfork_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Writes the buffered records, trace_lock has to be held
+ */
+static void trace_flush()
+{
+	size_t len = trace_buffered * sizeof(t_trace_record);
+	char *pos = (char*)trace_buffer;
+
+	while (len > 0 && trace_fd >= 0)
+	{
+		ssize_t written = write(trace_fd, pos, len);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			break;
+
+		pos += written;
+		len -= written;
+	}
+
+	trace_buffered = 0;
+}
+
+/**
+ * Mixes the bits of x, the finalizer of splitmix64
+ */
+static uint64_t trace_mix(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+/**
+ * Hashes the server, share and path of url, leaving out protocol, user and
+ * password, and writes the hash of the directory containing it to parent.
+ * Trailing slashes are ignored. Returns 0 if url is NULL.
+ */
+static uint64_t trace_hash(const char *url, uint64_t *parent)
+{
+	const char *start, *end, *slash, *at, *p;
+	uint64_t hash = 0xcbf29ce484222325ull ^ trace_salt;
+	uint64_t parent_hash = 0;
+
+	if (parent)
+		*parent = 0;
+	if (!url)
+		return 0;
+
+	//Skip the protocol and the credentials
+	start = strstr(url, "://");
+	start = start ? start + 3 : url;
+	slash = strchr(start, '/');
+	at = strchr(start, '@');
+	if (at && (!slash || at < slash))
+		start = at + 1;
+
+	end = start + strlen(start);
+	while (end > start && end[-1] == '/')
+		end--;
+
+	for (p = start; p < end; p++)
+	{
+		if (*p == '/')
+			parent_hash = hash;
+		hash = (hash ^ (unsigned char)*p) * 0x100000001b3ull;
+	}
+
+	//0 stands for no path
+	if (parent)
+		*parent = parent_hash ? (trace_mix(parent_hash) | 1) : 0;
+	return trace_mix(hash) | 1;
+}
+
+/**
+ * Returns a random salt for the path hashes
+ */
+static uint64_t trace_random()
+{
+	uint64_t salt = 0;
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if (fd >= 0) {
+		if (read(fd, &salt, sizeof(salt)) != sizeof(salt))
+			salt = 0;
+		close(fd);
+	}
+
+	//Better than nothing
+	if (!salt)
+		salt = trace_mix(stats_clock() ^ ((uint64_t)getpid() << 32));
+
+	return salt;
+}
+
+/**
+ * Creates the trace file for trace_path in the calling process with a new salt
+ * and writes its header, trace_lock has to be held. Returns -1 if the file could not be created.
+ */
+static int trace_open()
+{
+	char filename[1024];
+	t_trace_header header;
+	struct timespec ts;
+	const char *p;
+	size_t len = 0;
+	int fd;
+
+	//Replace %p by the process id
+	for (p = trace_path; *p && len < sizeof(filename) - 1; p++)
+	{
+		if (p[0] == '%' && p[1] == 'p') {
+			len += snprintf(filename + len, sizeof(filename) - len, "%d",
+				(int)getpid());
+			if (len >= sizeof(filename))
+				len = sizeof(filename) - 1;
+			p++;
+		} else {
+			filename[len++] = *p;
+		}
+	}
+	filename[len] = 0;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return -1;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(t_trace_record);
+	header.start_time = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+	if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	trace_fd = fd;
+	trace_file++;
+	trace_start_ns = stats_clock();
+	trace_salt = trace_random();
+	trace_threads = 0;
+	trace_buffered = 0;
+
+	return 0;
+}
+
+/**
+ * Keeps trace_lock locked while the process forks
+ */
+static void trace_atfork_prepare()
+{
+	pthread_mutex_lock(&trace_lock);
+}
+
+static void trace_atfork_parent()
+{
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Lets the child leave the file and the records of the parent to it. The child
+ * creates its own file once it records a call, so children which only exec
+ * another program do not leave empty files. Without "%p" in the path the file
+ * would be the one of the parent, so the child does not trace.
+ */
+static void trace_atfork_child()
+{
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+		trace_reopen = strstr(trace_path, "%p") != NULL;
+	}
+	trace_buffered = 0;
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_atfork_register()
+{
+	pthread_atfork(&trace_atfork_prepare, &trace_atfork_parent,
+		&trace_atfork_child);
+}
+
+/* See trace.h */
+int trace_start(const char *path)
+{
+	char *copy = strdup(path);
+	int ret = -1;
+
+	if (!copy)
+		return -1;
+
+	pthread_once(&trace_atfork_once, &trace_atfork_register);
+
+	trace_stop();
+
+	pthread_mutex_lock(&trace_lock);
+	trace_path = copy;
+	ret = trace_open();
+	if (ret < 0) {
+		free(trace_path);
+		trace_path = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	if (ret == 0)
+		__atomic_store_n(&trace_enabled, 1, __ATOMIC_RELAXED);
+
+	return ret;
+}
+
+/* See trace.h */
+void trace_stop()
+{
+	__atomic_store_n(&trace_enabled, 0, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fd >= 0) {
+		trace_flush();
+		close(trace_fd);
+		trace_fd = -1;
+	}
+	trace_reopen = 0;
+	free(trace_path);
+	trace_path = NULL;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/* See trace.h */
+void trace_record(int op, uint64_t start, uint64_t ns, int64_t ret, int err,
+	const t_trace_call *call)
+{
+	int saved_errno = errno;
+	t_trace_record record;
+
+	if (trace_depth > 0)
+		return;
+
+	memset(&record, 0, sizeof(record));
+	record.duration_ns = ns;
+	record.op = op;
+	record.result = ret;
+	record.err = ret < 0 ? err : 0;
+	record.fd = call->fd;
+	record.size = call->size;
+	record.offset = call->offset;
+	record.flags = call->flags;
+
+	//Descriptors are returned by open and opendir
+	if (op == SMBCW_OP_OPEN || op == SMBCW_OP_OPENDIR)
+		record.fd = ret;
+
+	//Index into TRACE_MODES, "b" and "t" are left out
+	if (call->mode && call->mode[0]) {
+		const char *base = strchr("rwax", call->mode[0]);
+		record.flags = (base ? base - "rwax" : 0) +
+			(strchr(call->mode, '+') ? 4 : 0);
+	}
+
+	pthread_mutex_lock(&trace_lock);
+
+	//The first call of a forked child creates its file
+	if (trace_reopen) {
+		trace_reopen = 0;
+		trace_open();
+	}
+
+	if (trace_fd >= 0)
+	{
+		//The salt must not change while the paths are hashed
+		record.hash = trace_hash(call->url, &record.parent_hash);
+		record.hash2 = trace_hash(call->url2, NULL);
+
+		record.start_ns = start > trace_start_ns ? start - trace_start_ns : 0;
+
+		if (trace_thread_file != trace_file) {
+			trace_thread = ++trace_threads;
+			trace_thread_file = trace_file;
+		}
+		record.thread = trace_thread;
+
+		trace_buffer[trace_buffered++] = record;
+		if (trace_buffered == TRACE_BUFFER_RECORDS)
+			trace_flush();
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	errno = saved_errno;
+}
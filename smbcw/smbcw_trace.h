@@ -0,0 +1,121 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+/**
+ * Recording of the calls of the public functions into a binary trace file, which
+ * test/trace_replay.c re-executes. A trace file consists of a t_trace_header
+ * followed by t_trace_record entries in the byte order of the recording machine.
+ * Only the outermost public call of a thread is recorded, calls which smbcw makes
+ * internally (like the probe of smbcw_urlstat) are part of it. Paths are stored
+ * as salted hashes of server, share and path. The salt is chosen randomly for
+ * each trace file and not stored, so the hashes only relate the calls of one
+ * file.
+ */
+
+#define TRACE_MAGIC "SMBCWTR1"
+#define TRACE_VERSION 1
+
+/**
+ * Header at the start of a trace file
+ */
+typedef struct {
+	char magic[8];				//TRACE_MAGIC
+	uint32_t version;			//TRACE_VERSION
+	uint32_t record_size;	//sizeof(t_trace_record)
+	uint64_t start_time;	//wall clock time of the start in ns since the epoch
+} t_trace_header;
+
+/**
+ * One recorded call
+ */
+typedef struct {
+	uint64_t start_ns;		//start relative to the start of the trace
+	uint64_t duration_ns;
+	uint64_t hash;				//path of the call, 0 for calls on descriptors
+	uint64_t parent_hash;	//directory containing the path
+	uint64_t hash2;				//second path of smbcw_rename and smbcw_copy
+	int64_t size;					//bytes requested, chunk size or mode, see below
+	int64_t offset;				//offset of pread/pwrite/fseek, target of fcopy
+	int64_t result;				//return value of the call
+	int32_t fd;						//descriptor used, for open/opendir the one returned
+	int32_t err;					//smbcw_geterr of the call
+	uint16_t thread;			//number of the calling thread, starting with 1
+	uint8_t op;						//SMBCW_OP_*
+	uint8_t flags;				//open mode (TRACE_MODE_*), whence, stat mode, lanes
+	uint32_t reserved;
+} t_trace_record;
+
+/**
+ * Open modes in t_trace_record.flags, index into this list
+ */
+#define TRACE_MODES {"r", "w", "a", "x", "r+", "w+", "a+", "x+"}
+#define TRACE_MODE_COUNT 8
+
+/**
+ * Arguments of a public call, filled in by the _TRACE macros of smbcw.c
+ */
+typedef struct {
+	const char *url;
+	const char *url2;
+	const char *mode;			//open mode of smbcw_fopen
+	int fd;
+	int flags;
+	int64_t size;
+	int64_t offset;
+} t_trace_call;
+
+/**
+ * Set while a trace is written, see trace_start
+ */
+extern int trace_enabled;
+
+/**
+ * Starts writing a new trace to the file at path, "%p" in path is replaced by the
+ * process id. A forked child writes a file of its own from its first recorded
+ * call on if path contains "%p", otherwise it does not trace. A running trace is
+ * stopped first. Returns 0 on success, -1 if the file could not be created.
+ */
+int trace_start(const char *path);
+
+/**
+ * Writes the buffered records and closes the trace file
+ */
+void trace_stop();
+
+/**
+ * Number of recorded public calls the calling thread is currently in. smbcw.c
+ * increments it when a call starts and decrements it before trace_record.
+ */
+extern __thread int trace_depth;
+
+/**
+ * Records a call of type op (SMBCW_OP_*) which has been started at the
+ * stats_clock time start, took ns nanoseconds, returned ret and set err. Calls made while trace_depth
+ * is not 0 are nested into another public call and skipped. Does not change
+ * errno.
+ */
+void trace_record(int op, uint64_t start, uint64_t ns, int64_t ret, int err,
+	const t_trace_call *call);
+
+#endif /*_TRACE_H*/
@@ -0,0 +1,504 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "smbcw_common.h"
+#include "smbcw_connections.h"
+#include "smbcw_backend.h"
+#include "smbcw_transfer.h"
+
+#define TRANSFER_SLOT_EMPTY 0
+#define TRANSFER_SLOT_BUSY 1
+#define TRANSFER_SLOT_DONE 2
+
+/**
+ * Buffer for one chunk of a download
+ */
+typedef struct {
+	char *data;
+	int64_t len;
+	int state;
+} t_smbcw_transfer_slot;
+
+typedef struct t_smbcw_transfer t_smbcw_transfer;
+
+/**
+ * A lane is a thread with its own context and its own handle of the file
+ */
+typedef struct {
+	t_smbcw_transfer *transfer;
+	SMBCCTX *ctx;
+	SMBCFILE *file;
+	char *buf;
+	pthread_t thread;
+	int started;
+} t_smbcw_transfer_lane;
+
+/**
+ * State shared by the lanes of a transfer
+ */
+struct t_smbcw_transfer {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	t_smbcw_transfer_lane *lanes;
+	int lane_count;
+
+	int64_t size;
+	int64_t chunk_size;
+	int64_t chunk_count;
+
+	//Index of the next chunk a lane takes
+	int64_t next;
+
+	//Download: Number of chunks passed to the consumer, the lanes may only work
+	//window chunks ahead of it
+	int64_t delivered;
+	t_smbcw_transfer_slot *slots;
+	int window;
+
+	//Upload: Producer and number of bytes written
+	transfer_producer_fn producer;
+	void *priv;
+	int64_t total;
+	int eof;
+
+	int abort;
+	int err;
+};
+
+/**
+ * Sets the error of the transfer if it is the first one and tells all threads to
+ * stop. Has to be called with the lock held.
+ */
+static void transfer_fail(t_smbcw_transfer *transfer, int err)
+{
+	if (!transfer->err)
+		transfer->err = err ? err : EIO;
+	transfer->abort = 1;
+	pthread_cond_broadcast(&transfer->cond);
+}
+
+/**
+ * Reads or writes len bytes at the given offset of the file of a lane. Returns
+ * the number of bytes transferred, which is only smaller than len at the end of
+ * the file, or -1 on error.
+ */
+static int64_t transfer_io(t_smbcw_transfer_lane *lane, char *buf, int64_t len,
+	int64_t offset, int write)
+{
+	smbc_lseek_fn lseek_fn = backend_active->get_lseek(lane->ctx);
+	smbc_read_fn read_fn = backend_active->get_read(lane->ctx);
+	smbc_write_fn write_fn = backend_active->get_write(lane->ctx);
+	int64_t done = 0;
+
+	if (lseek_fn(lane->ctx, lane->file, offset, SEEK_SET) < 0)
+		return -1;
+
+	while (done < len)
+	{
+		ssize_t count = write ?
+			write_fn(lane->ctx, lane->file, buf + done, len - done) :
+			read_fn(lane->ctx, lane->file, buf + done, len - done);
+		if (count < 0)
+			return -1;
+		if (count == 0)
+			break;
+		done += count;
+	}
+
+	return done;
+}
+
+/**
+ * Body of a download lane. Takes the next chunk as long as it lies within the
+ * window and reads it into its slot.
+ */
+static void *transfer_get_thread(void *arg)
+{
+	t_smbcw_transfer_lane *lane = arg;
+	t_smbcw_transfer *transfer = lane->transfer;
+
+	pthread_mutex_lock(&transfer->lock);
+
+	while (!transfer->abort && transfer->next < transfer->chunk_count)
+	{
+		//Wait until the consumer has freed the slot of the next chunk
+		if (transfer->next >= transfer->delivered + transfer->window) {
+			pthread_cond_wait(&transfer->cond, &transfer->lock);
+			continue;
+		}
+
+		int64_t idx = transfer->next++;
+		t_smbcw_transfer_slot *slot = &transfer->slots[idx % transfer->window];
+		slot->state = TRANSFER_SLOT_BUSY;
+		pthread_mutex_unlock(&transfer->lock);
+
+		//Nobody else touches the slot until it is marked as done
+		int64_t offset = idx * transfer->chunk_size;
+		int64_t len = transfer->size - offset;
+		if (len > transfer->chunk_size)
+			len = transfer->chunk_size;
+
+		int64_t count = transfer_io(lane, slot->data, len, offset, 0);
+		int err = errno;
+
+		pthread_mutex_lock(&transfer->lock);
+
+		//A short read means the file shrunk during the transfer
+		if (count != len) {
+			transfer_fail(transfer, count < 0 ? err : EIO);
+			break;
+		}
+
+		slot->len = count;
+		slot->state = TRANSFER_SLOT_DONE;
+		pthread_cond_broadcast(&transfer->cond);
+	}
+
+	pthread_mutex_unlock(&transfer->lock);
+
+	return NULL;
+}
+
+/**
+ * Body of an upload lane. Takes the next chunk from the producer and writes it
+ * at its offset.
+ */
+static void *transfer_put_thread(void *arg)
+{
+	t_smbcw_transfer_lane *lane = arg;
+	t_smbcw_transfer *transfer = lane->transfer;
+
+	pthread_mutex_lock(&transfer->lock);
+
+	while (!transfer->abort && !transfer->eof)
+	{
+		//The producer is only called with the lock held, so the chunks are taken
+		//in order
+		int64_t idx = transfer->next++;
+		int64_t len = 0;
+		while (len < transfer->chunk_size)
+		{
+			int64_t count = transfer->producer(lane->buf + len,
+				transfer->chunk_size - len, transfer->priv);
+			if (count < 0) {
+				transfer_fail(transfer, ECANCELED);
+				break;
+			}
+			if (count == 0) {
+				transfer->eof = 1;
+				break;
+			}
+			len += count;
+		}
+
+		if (transfer->abort || len == 0)
+			break;
+
+		pthread_mutex_unlock(&transfer->lock);
+
+		int64_t count = transfer_io(lane, lane->buf, len, idx * transfer->chunk_size, 1);
+		int err = errno;
+
+		pthread_mutex_lock(&transfer->lock);
+
+		if (count != len) {
+			transfer_fail(transfer, count < 0 ? err : EIO);
+			break;
+		}
+
+		transfer->total += len;
+	}
+
+	pthread_mutex_unlock(&transfer->lock);
+
+	return NULL;
+}
+
+/**
+ * Waits for the lanes, closes their files and frees their contexts
+ */
+static void transfer_close_lanes(t_smbcw_transfer *transfer)
+{
+	int i;
+
+	for (i = 0; i < transfer->lane_count; i++)
+	{
+		t_smbcw_transfer_lane *lane = &transfer->lanes[i];
+
+		if (lane->started)
+			pthread_join(lane->thread, NULL);
+
+		if (lane->file) {
+			smbc_close_fn close_fn = backend_active->get_close(lane->ctx);
+			if (close_fn)
+				close_fn(lane->ctx, lane->file);
+		}
+
+		if (lane->ctx)
+			connections_free_private_ctx(lane->ctx);
+
+		free(lane->buf);
+	}
+
+	free(transfer->lanes);
+	transfer->lanes = NULL;
+	transfer->lane_count = 0;
+}
+
+/**
+ * Opens the file in a private context for each lane and starts the lanes. The
+ * files are opened by the calling thread, so a failure (e.g. wrong credentials)
+ * is reported before any data is moved. Returns 0 on success or -1 with errno
+ * set, in which case all lanes which have been started are stopped again.
+ */
+static int transfer_open_lanes(t_smbcw_transfer *transfer, SMBCCTX *ctx,
+	const char *filename, int lanes, int flags, void *(*thread_fn)(void *))
+{
+	int i, err = 0;
+
+	transfer->lanes = calloc(lanes, sizeof(t_smbcw_transfer_lane));
+	if (!transfer->lanes) {
+		errno = ENOMEM;
+		return -1;
+	}
+	transfer->lane_count = lanes;
+
+	for (i = 0; i < lanes && !err; i++)
+	{
+		t_smbcw_transfer_lane *lane = &transfer->lanes[i];
+		lane->transfer = transfer;
+
+		lane->ctx = connections_new_private_ctx(ctx);
+		if (!lane->ctx) {
+			err = errno ? errno : ENOMEM;
+			break;
+		}
+
+		smbc_open_fn open_fn = backend_active->get_open(lane->ctx);
+		if (!open_fn || !backend_active->get_lseek(lane->ctx)) {
+			err = EINVAL;
+			break;
+		}
+
+		lane->file = open_fn(lane->ctx, filename, flags, 0);
+		if (!lane->file) {
+			err = errno ? errno : EIO;
+			break;
+		}
+
+		//Upload lanes keep the chunk they took from the producer
+		if (flags != O_RDONLY) {
+			lane->buf = malloc(transfer->chunk_size);
+			if (!lane->buf) {
+				err = ENOMEM;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < lanes && !err; i++)
+	{
+		t_smbcw_transfer_lane *lane = &transfer->lanes[i];
+		if (pthread_create(&lane->thread, NULL, thread_fn, lane) != 0) {
+			err = EAGAIN;
+			break;
+		}
+		lane->started = 1;
+	}
+
+	if (err) {
+		pthread_mutex_lock(&transfer->lock);
+		transfer_fail(transfer, err);
+		pthread_mutex_unlock(&transfer->lock);
+
+		transfer_close_lanes(transfer);
+
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Initializes the shared state of a transfer
+ */
+static void transfer_init(t_smbcw_transfer *transfer, int64_t chunk_size)
+{
+	memset(transfer, 0, sizeof(*transfer));
+	transfer->chunk_size = chunk_size;
+	pthread_mutex_init(&transfer->lock, NULL);
+	pthread_cond_init(&transfer->cond, NULL);
+}
+
+/**
+ * Frees the shared state of a transfer
+ */
+static void transfer_done(t_smbcw_transfer *transfer)
+{
+	int i;
+
+	if (transfer->slots) {
+		for (i = 0; i < transfer->window; i++)
+			free(transfer->slots[i].data);
+		free(transfer->slots);
+	}
+
+	pthread_cond_destroy(&transfer->cond);
+	pthread_mutex_destroy(&transfer->lock);
+}
+
+/* See smbcw_transfer.h */
+int64_t transfer_get(SMBCCTX *ctx, const char *filename, int64_t size, int lanes,
+	int64_t chunk_size, transfer_consumer_fn consumer, void *priv)
+{
+	t_smbcw_transfer transfer;
+	int64_t idx, ret = 0;
+	int i;
+
+	if (lanes <= 0 || chunk_size <= 0 || size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size == 0)
+		return 0;
+
+	transfer_init(&transfer, chunk_size);
+	transfer.size = size;
+	transfer.chunk_count = (size + chunk_size - 1) / chunk_size;
+
+	//More lanes than chunks would only open sessions which are never used
+	if (lanes > transfer.chunk_count)
+		lanes = transfer.chunk_count;
+
+	//Reserve the slots of the window
+	transfer.window = 2 * lanes;
+	if (transfer.window > transfer.chunk_count)
+		transfer.window = transfer.chunk_count;
+
+	transfer.slots = calloc(transfer.window, sizeof(t_smbcw_transfer_slot));
+	if (!transfer.slots) {
+		transfer_done(&transfer);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < transfer.window; i++) {
+		transfer.slots[i].data = malloc(chunk_size);
+		if (!transfer.slots[i].data) {
+			transfer_done(&transfer);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	if (transfer_open_lanes(&transfer, ctx, filename, lanes, O_RDONLY,
+		&transfer_get_thread) < 0) {
+		int err = errno;
+		transfer_done(&transfer);
+		errno = err;
+		return -1;
+	}
+
+	//Pass the chunks to the consumer in file order
+	for (idx = 0; idx < transfer.chunk_count; idx++)
+	{
+		t_smbcw_transfer_slot *slot = &transfer.slots[idx % transfer.window];
+
+		pthread_mutex_lock(&transfer.lock);
+		while (slot->state != TRANSFER_SLOT_DONE && !transfer.abort)
+			pthread_cond_wait(&transfer.cond, &transfer.lock);
+		int abort = transfer.abort;
+		pthread_mutex_unlock(&transfer.lock);
+
+		if (abort)
+			break;
+
+		//The lanes do not touch a slot which is done
+		if (consumer(slot->data, slot->len, priv) < 0) {
+			pthread_mutex_lock(&transfer.lock);
+			transfer_fail(&transfer, ECANCELED);
+			pthread_mutex_unlock(&transfer.lock);
+			break;
+		}
+		ret += slot->len;
+
+		pthread_mutex_lock(&transfer.lock);
+		slot->state = TRANSFER_SLOT_EMPTY;
+		transfer.delivered++;
+		pthread_cond_broadcast(&transfer.cond);
+		pthread_mutex_unlock(&transfer.lock);
+	}
+
+	transfer_close_lanes(&transfer);
+
+	int err = transfer.err;
+	transfer_done(&transfer);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return ret;
+}
+
+/* See smbcw_transfer.h */
+int64_t transfer_put(SMBCCTX *ctx, const char *filename, int lanes,
+	int64_t chunk_size, transfer_producer_fn producer, void *priv)
+{
+	t_smbcw_transfer transfer;
+
+	if (lanes <= 0 || chunk_size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	transfer_init(&transfer, chunk_size);
+	transfer.producer = producer;
+	transfer.priv = priv;
+
+	if (transfer_open_lanes(&transfer, ctx, filename, lanes, O_WRONLY,
+		&transfer_put_thread) < 0) {
+		int err = errno;
+		transfer_done(&transfer);
+		errno = err;
+		return -1;
+	}
+
+	transfer_close_lanes(&transfer);
+
+	int err = transfer.err;
+	int64_t ret = transfer.total;
+	transfer_done(&transfer);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return ret;
+}
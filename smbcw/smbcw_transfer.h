@@ -0,0 +1,63 @@
+#ifndef _TRANSFER_H
+#define _TRANSFER_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libsmbclient.h>
+
+/**
+ * Parallel transfer of large files. The file is split into chunks of chunk_size
+ * bytes which are moved by lanes threads at the same time, each one with its own
+ * context (and thus its own SMB session) for the credentials of ctx. This makes
+ * use of several TCP windows for a single file.
+ */
+
+/**
+ * Function called with the data of a download in file order. Has to return a
+ * value < 0 to abort the transfer.
+ */
+typedef int (*transfer_consumer_fn)(const char *buf, uint64_t len, void *priv);
+
+/**
+ * Function called for the data of an upload. Has to fill buf with up to len
+ * bytes and return their number, 0 at the end of the data and a value < 0 to
+ * abort the transfer. It is never called by two threads at the same time.
+ */
+typedef int64_t (*transfer_producer_fn)(char *buf, uint64_t len, void *priv);
+
+/**
+ * Downloads the size bytes of the file with the given smbc filename and passes
+ * them to consumer in file order. At most 2 * lanes chunks are kept in memory.
+ * Returns the number of bytes passed to consumer or -1 with errno set.
+ */
+int64_t transfer_get(SMBCCTX *ctx, const char *filename, int64_t size, int lanes,
+	int64_t chunk_size, transfer_consumer_fn consumer, void *priv);
+
+/**
+ * Uploads the data returned by producer to the file with the given smbc filename,
+ * which has to exist. Each lane writes the chunks it took from producer at their
+ * offset. Returns the number of bytes written or -1 with errno set.
+ */
+int64_t transfer_put(SMBCCTX *ctx, const char *filename, int lanes,
+	int64_t chunk_size, transfer_producer_fn producer, void *priv);
+
+#endif /*_TRANSFER_H*/
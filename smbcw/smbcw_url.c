@@ -24,65 +24,6 @@
 // include php.h to be able to use: php_error(E_WARNING, "[SMBCW_WRAPPER] %s", str)
 #include "php.h"
 
-/**
- * Splits a string to a left and a right part at the first occurence of delem.
- * Only used internally by smbcw_url_parse.
- * @param in is the string which should be splitted. The memory in points to will
- *  be freed. This means, that you should always create a duplicate of the the in string
- *  if you get it as an function parameter.
- * @param left is a pointer to the string the left half should be written to.
- * @param right is the pointer to the string the right half should be written to.
- * @param delem is the delemiter. The delimiter itself will not be included inside
- *  the result
- * @param dir marks wheter the result should be written to "left" (dir <= 0) or
- *  to "right" (dir > 0)
- */
-void _str_split(char *in, char **left, char **right, const char *delem, int dir)
-{
-	//Get the position of the delimiter string
-	int in_len = strlen(in);
-	int delem_len = strlen(delem);
-	int pos;
-
-	char *dup = strdup(in);
-
-	//Free the old string which was passed to this function
-	free(in);
-
-	//Get the position of the delimiter in the string
-	char *str_pos = strstr(dup, delem);
-	if (str_pos) {
-		pos = str_pos - dup;
-	} else {
-		//If the delimiter has not been found, copy the whole string to the...
-		if (dir > 0) {
-			//...right side
-			pos = 0;
-			delem_len = 0;
-		} else {
-			//...left side
-			pos = in_len;
-		}
-	}
-
-	//Create a new string for the left side
-	int left_len = pos;
-	*left = malloc(pos + 1);
-	memset(*left, 0, pos + 1);
-	strncpy(*left, dup, pos);
-
-	//Create a new string for the right side
-	int right_len = in_len - delem_len - pos;
-	if (right_len < 0)
-		right_len = 0;
-	*right = malloc(right_len + 1); 
-	memset(*right, 0, right_len + 1);
-	strncpy(*right, dup + pos + delem_len, right_len);
-
-	//Free the duplicate of the in string
-	free(dup);
-}
-
 /**
  * Return integer value of a hex character
  *
@@ -147,31 +88,69 @@ void _str_url_decode(char *str)
 }
 
 /**
- * Parses the given url string and writes the parts into the url descriptor.
- * Internally used.
- * @param url is the pointer to the current smbcw url descriptor
- * @param url_str is the url which should be divided.
+ * Copies len bytes of src to *dst, terminates the copy and advances *dst behind
+ * the terminator. Returns the start of the copy. Internally used by the url
+ * parser.
  */
-int _smbcw_url_parse(lp_smbcw_url url, char *url_str)
+static char* _str_put(char **dst, const char *src, size_t len)
 {
-	char *tmp = NULL;
-	char *tmp2 = NULL;
-	char *cpy = NULL;
+	char *result = *dst;
+
+	memcpy(result, src, len);
+	result[len] = '\0';
+	*dst += len + 1;
+
+	return result;
+}
+
+/* See url.h */
+int smbcw_url_parse(lp_smbcw_url url, const char *url_str, char *buf, size_t buf_size)
+{
+	size_t len = strlen(url_str);
+	const char *end = url_str + len;
+	char *dst = buf;
+
+	memset(url, 0, sizeof(*url));
+
+	if (buf_size < SMBCW_URL_BUF_SIZE(len))
+		return -1;
+
+	//Everything in front of "://" is the protocol
+	const char *proto_end = strstr(url_str, "://");
+	if (proto_end && proto_end > url_str) {
+		const char *auth = proto_end + 3;
+
+		//The authority part ends at the first "/", everything behind is the path
+		const char *auth_end = strchr(auth, '/');
+		if (!auth_end)
+			auth_end = end;
+
+		//User information is separated from host and port by the first "@"
+		const char *at = memchr(auth, '@', auth_end - auth);
+		const char *info = auth;
+		const char *info_end = at ? at : auth;
+		const char *host = at ? at + 1 : auth;
+
+		const char *pw = memchr(info, ':', info_end - info);
+		const char *port = memchr(host, ':', auth_end - host);
 
-	cpy = strdup(url_str);
+		url->protocol = _str_put(&dst, url_str, proto_end - url_str);
+		url->user = _str_put(&dst, info, (pw ? pw : info_end) - info);
+		url->password = pw ? _str_put(&dst, pw + 1, info_end - pw - 1) : _str_put(&dst, "", 0);
+		url->host = _str_put(&dst, host, (port ? port : auth_end) - host);
+		url->port = port ? _str_put(&dst, port + 1, auth_end - port - 1) : _str_put(&dst, "", 0);
+		url->path = (auth_end < end) ? _str_put(&dst, auth_end + 1, end - auth_end - 1) : _str_put(&dst, "", 0);
 
-	_str_split(cpy, &(url->protocol), &tmp, "://", 1);
-	if (strlen(url->protocol) > 0) {
-		_str_split(tmp, &tmp, &(url->path), "/", -1);
-		_str_split(tmp, &tmp, &tmp2, "@", 1);
-		_str_split(tmp, &(url->user), &(url->password), ":", -1);
 		_str_url_decode(url->user);
 		_str_url_decode(url->password);
-		_str_split(tmp2, &(url->host), &(url->port), ":", -1);	
 	} else {
-		url->path = tmp;
+		//Without protocol the whole string (behind a leading "://") is the path
+		const char *path = proto_end ? proto_end + 3 : url_str;
+
+		url->protocol = _str_put(&dst, "", 0);
+		url->path = _str_put(&dst, path, end - path);
 	}
-	
+
 	return 0;
 }
 
@@ -179,42 +158,50 @@ int _smbcw_url_parse(lp_smbcw_url url, char *url_str)
 lp_smbcw_url smbcw_url_create(const char *url)
 {
 	lp_smbcw_url result;
+	size_t buf_size = SMBCW_URL_BUF_SIZE(strlen(url));
 
-	/* Reserve some memory for the url descriptor we're returning and initialize it
-		 with zeros */
-	result = malloc(sizeof(*result));
-	memset(result, 0, sizeof(*result));
+	/* Reserve the memory for the url descriptor we're returning and the strings
+		 inside of it in one block */
+	result = malloc(sizeof(*result) + buf_size);
 
-	_smbcw_url_parse(result, (char*)url);
+	smbcw_url_parse(result, url, (char*)(result + 1), buf_size);
 
 	return result;
 }
 
+/**
+ * Returns the number of bytes the given url part occupies in the string buffer
+ */
+static size_t _str_size(const char *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
+
+/**
+ * Copies the given url part to *dst if it is not NULL
+ */
+static char* _str_dup_to(char **dst, const char *str)
+{
+	return str ? _str_put(dst, str, strlen(str)) : NULL;
+}
+
 /* See url.h */
 lp_smbcw_url smbcw_url_dup(lp_smbcw_url url)
 {
 	lp_smbcw_url result;
+	size_t buf_size = _str_size(url->protocol) + _str_size(url->user) +
+		_str_size(url->password) + _str_size(url->host) + _str_size(url->port) +
+		_str_size(url->path);
 
-	result = malloc(sizeof(*result));
-	memset(result, 0, sizeof(*result));
+	result = malloc(sizeof(*result) + buf_size);
 
-	if (url->protocol)
-		result->protocol = strdup(url->protocol);
-
-	if (url->user)
-		result->user = strdup(url->user);
-
-	if (url->password)
-		result->password = strdup(url->password);
-
-	if (url->host)
-		result->host = strdup(url->host);
-
-	if (url->port)
-		result->port = strdup(url->port);
-
-	if (url->path)
-		result->path = strdup(url->path);
+	char *dst = (char*)(result + 1);
+	result->protocol = _str_dup_to(&dst, url->protocol);
+	result->user = _str_dup_to(&dst, url->user);
+	result->password = _str_dup_to(&dst, url->password);
+	result->host = _str_dup_to(&dst, url->host);
+	result->port = _str_dup_to(&dst, url->port);
+	result->path = _str_dup_to(&dst, url->path);
 
 	return result;
 }
@@ -277,26 +264,6 @@ char* smbcw_url_get_share(lp_smbcw_url url)
 /* See url.h */
 void smbcw_url_free(lp_smbcw_url url)
 {
-	//Free all strings inside the url structure
-	if (url->protocol)
-		free(url->protocol);
-
-	if (url->user)
-		free(url->user);
-
-	if (url->password)
-		free(url->password);
-
-	if (url->host)
-		free(url->host);
-
-	if (url->port)
-		free(url->port);
-
-	if (url->path)
-		free(url->path);
-
-	//Free the url structure itself
+	//The strings are stored in the same memory block as the url structure
 	free(url);
 }
-
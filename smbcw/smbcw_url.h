@@ -35,6 +35,8 @@
  * The port parameter is currently not used in SMBCW - I don't know if it is even possible
  * to pass a port to SMBC.
  */
+#include <stddef.h>
+
 typedef struct {
 	char *protocol;
 	char *user;
@@ -51,17 +53,38 @@ typedef struct {
 typedef t_smbcw_url *lp_smbcw_url;
 
 
+/**
+ * Number of bytes the string buffer passed to smbcw_url_parse needs for an url of
+ * the given length: the url itself plus a terminator for each of the six parts.
+ */
+#define SMBCW_URL_BUF_SIZE(len) ((len) + 6)
+
 /**
  * Creates a new url descriptor and divides the given url into multiple parts
  * which might then be accessed. Please note that some parts of the url descriptor
  * can be NULL. So always test the url descriptor parts for not being NULL before
  * accessing them. You have to free each created url descriptor by passing it to
- * the smbcw_url_free function.
+ * the smbcw_url_free function. The descriptor and all parts are stored in one
+ * memory block.
  *
  * @param url is the url which should be divided.
  */
 lp_smbcw_url smbcw_url_create(const char *url);
 
+/**
+ * Divides the given url into the given url descriptor without allocating any
+ * memory. The parts are written to buf, which has to be at least
+ * SMBCW_URL_BUF_SIZE(strlen(url_str)) bytes large and has to stay valid as long as
+ * the url descriptor is used. Never pass a descriptor filled by this function to
+ * smbcw_url_free. Returns 0 on success and -1 if buf is too small.
+ *
+ * @param url is the url descriptor which should be filled.
+ * @param url_str is the url which should be divided.
+ * @param buf is the memory the url parts are written to.
+ * @param buf_size is the size of buf in bytes.
+ */
+int smbcw_url_parse(lp_smbcw_url url, const char *url_str, char *buf, size_t buf_size);
+
 /**
  * Every url descriptor created by the smbcw_url_create function has to be freed
  * by using this function
@@ -0,0 +1,341 @@
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libsmbclient.h>
+
+#include "smbcw_common.h"
+#include "smbcw_connections.h"
+#include "smbcw_urlcache.h"
+
+/**
+ * Hash table of all cached entries. The number of buckets is the smallest power of
+ * two which is not smaller than the maximum number of entries.
+ */
+lp_smbcw_urlcache_entry *urlcache_buckets = NULL;
+uint32_t urlcache_bucket_count = 0;
+int urlcache_size = 0;
+int urlcache_count = 0;
+
+/**
+ * LRU list of all cached entries, the head is the most recently used one.
+ */
+lp_smbcw_urlcache_entry urlcache_lru_head = NULL;
+lp_smbcw_urlcache_entry urlcache_lru_tail = NULL;
+
+/**
+ * Statistic counters of urlcache_get
+ */
+uint64_t urlcache_hits = 0;
+uint64_t urlcache_misses = 0;
+
+/**
+ * Protects the table, the LRU list, the counters and the reference counts of the
+ * entries
+ */
+pthread_mutex_t urlcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Frees the given entry if it is neither cached nor used anymore.
+ */
+static void urlcache_entry_free(lp_smbcw_urlcache_entry entry)
+{
+	if (!entry->cached && entry->refcount <= 0)
+		free(entry);
+}
+
+/**
+ * Removes the given entry from the LRU list.
+ */
+static void urlcache_lru_unlink(lp_smbcw_urlcache_entry entry)
+{
+	lp_smbcw_urlcache_entry prev = entry->lru_prev;
+	lp_smbcw_urlcache_entry next = entry->lru_next;
+
+	if (prev)
+		prev->lru_next = next;
+	else
+		urlcache_lru_head = next;
+
+	if (next)
+		next->lru_prev = prev;
+	else
+		urlcache_lru_tail = prev;
+
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+/**
+ * Inserts the given entry at the head of the LRU list.
+ */
+static void urlcache_lru_push(lp_smbcw_urlcache_entry entry)
+{
+	entry->lru_next = urlcache_lru_head;
+	if (urlcache_lru_head)
+		urlcache_lru_head->lru_prev = entry;
+	urlcache_lru_head = entry;
+	if (!urlcache_lru_tail)
+		urlcache_lru_tail = entry;
+}
+
+/**
+ * Removes the given entry from the cache. The memory is freed as soon as the
+ * entry is not used anymore.
+ */
+static void urlcache_remove(lp_smbcw_urlcache_entry entry)
+{
+	lp_smbcw_urlcache_entry *link =
+		&urlcache_buckets[entry->hash & (urlcache_bucket_count - 1)];
+
+	//Remove the entry from its bucket
+	while (*link && *link != entry)
+		link = (lp_smbcw_urlcache_entry*)&(*link)->next;
+	if (*link)
+		*link = entry->next;
+
+	urlcache_lru_unlink(entry);
+	urlcache_count--;
+
+	entry->cached = 0;
+	urlcache_entry_free(entry);
+}
+
+/**
+ * Drops all entries and the table. Has to be called with the lock held.
+ */
+static void urlcache_clear()
+{
+	while (urlcache_lru_tail)
+		urlcache_remove(urlcache_lru_tail);
+
+	free(urlcache_buckets);
+	urlcache_buckets = NULL;
+	urlcache_bucket_count = 0;
+}
+
+/* See urlcache.h */
+void urlcache_finalize()
+{
+	pthread_mutex_lock(&urlcache_lock);
+	urlcache_clear();
+	pthread_mutex_unlock(&urlcache_lock);
+}
+
+/* See urlcache.h */
+void urlcache_set_size(int size)
+{
+	uint32_t bucket_count = 1;
+
+	pthread_mutex_lock(&urlcache_lock);
+
+	urlcache_clear();
+
+	urlcache_size = size > 0 ? size : 0;
+	if (urlcache_size)
+	{
+		while (bucket_count < urlcache_size)
+			bucket_count <<= 1;
+
+		urlcache_buckets = malloc(bucket_count * sizeof(*urlcache_buckets));
+		if (urlcache_buckets) {
+			memset(urlcache_buckets, 0, bucket_count * sizeof(*urlcache_buckets));
+			urlcache_bucket_count = bucket_count;
+		} else {
+			urlcache_size = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&urlcache_lock);
+}
+
+/**
+ * Returns the entry of the given url or NULL. Has to be called with the lock held
+ * and a cache size > 0.
+ */
+static lp_smbcw_urlcache_entry urlcache_find(const char *url)
+{
+	uint32_t hash = smbcw_hash_str(SMBCW_HASH_INIT, url);
+	lp_smbcw_urlcache_entry tmp = urlcache_buckets[hash & (urlcache_bucket_count - 1)];
+
+	while (tmp && !(tmp->hash == hash && strcmp(tmp->url, url) == 0))
+		tmp = tmp->next;
+
+	return tmp;
+}
+
+/**
+ * Counts a hit of the given entry and moves it to the head of the LRU list. Has
+ * to be called with the lock held.
+ */
+static void urlcache_hit(lp_smbcw_urlcache_entry entry)
+{
+	urlcache_hits++;
+
+	if (urlcache_lru_head != entry) {
+		urlcache_lru_unlink(entry);
+		urlcache_lru_push(entry);
+	}
+}
+
+/* See urlcache.h */
+lp_smbcw_urlcache_entry urlcache_get(const char *url)
+{
+	lp_smbcw_urlcache_entry result = NULL;
+
+	pthread_mutex_lock(&urlcache_lock);
+
+	if (urlcache_size)
+	{
+		lp_smbcw_urlcache_entry tmp = urlcache_find(url);
+
+		//The context might be closed by another thread right now. It is not freed
+		//before it has been dropped from the cache, which needs the lock.
+		if (tmp && connections_ref_ctx(tmp->ctx) < 0) {
+			urlcache_remove(tmp);
+			tmp = NULL;
+		}
+
+		if (tmp) {
+			urlcache_hit(tmp);
+			tmp->refcount++;
+			result = tmp;
+		} else {
+			urlcache_misses++;
+		}
+	}
+
+	pthread_mutex_unlock(&urlcache_lock);
+
+	return result;
+}
+
+/* See urlcache.h */
+int urlcache_peek(const char *url,
+	int (*fn)(lp_smbcw_urlcache_entry entry, void *arg), void *arg)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&urlcache_lock);
+
+	if (urlcache_size)
+	{
+		lp_smbcw_urlcache_entry tmp = urlcache_find(url);
+
+		//Misses are counted by the urlcache_get call which follows
+		if (tmp && (ret = fn(tmp, arg)))
+			urlcache_hit(tmp);
+	}
+
+	pthread_mutex_unlock(&urlcache_lock);
+
+	return ret;
+}
+
+/* See urlcache.h */
+lp_smbcw_urlcache_entry urlcache_put(const char *url, SMBCCTX *ctx,
+	const char *filename)
+{
+	lp_smbcw_urlcache_entry result;
+	size_t url_len = strlen(url) + 1;
+	size_t fn_len = strlen(filename) + 1;
+
+	//Store the strings in the same memory block as the entry
+	result = malloc(sizeof(*result) + url_len + fn_len);
+	if (!result)
+		return NULL;
+	memset(result, 0, sizeof(*result));
+
+	result->url = (char*)(result + 1);
+	result->filename = result->url + url_len;
+	memcpy(result->url, url, url_len);
+	memcpy(result->filename, filename, fn_len);
+	result->ctx = ctx;
+	result->refcount = 1;
+
+	pthread_mutex_lock(&urlcache_lock);
+
+	if (urlcache_size) {
+		//Make room for the new entry
+		while (urlcache_count >= urlcache_size)
+			urlcache_remove(urlcache_lru_tail);
+
+		result->hash = smbcw_hash_str(SMBCW_HASH_INIT, url);
+		result->cached = 1;
+
+		lp_smbcw_urlcache_entry *bucket =
+			&urlcache_buckets[result->hash & (urlcache_bucket_count - 1)];
+		result->next = *bucket;
+		*bucket = result;
+
+		urlcache_lru_push(result);
+		urlcache_count++;
+	}
+
+	pthread_mutex_unlock(&urlcache_lock);
+
+	return result;
+}
+
+/* See urlcache.h */
+void urlcache_release(lp_smbcw_urlcache_entry entry)
+{
+	if (entry) {
+		pthread_mutex_lock(&urlcache_lock);
+		entry->refcount--;
+		urlcache_entry_free(entry);
+		pthread_mutex_unlock(&urlcache_lock);
+	}
+}
+
+/* See urlcache.h */
+void urlcache_invalidate_ctx(SMBCCTX *ctx)
+{
+	pthread_mutex_lock(&urlcache_lock);
+
+	lp_smbcw_urlcache_entry tmp = urlcache_lru_head;
+
+	while (tmp) {
+		lp_smbcw_urlcache_entry next = tmp->lru_next;
+		if (tmp->ctx == ctx)
+			urlcache_remove(tmp);
+		tmp = next;
+	}
+
+	pthread_mutex_unlock(&urlcache_lock);
+}
+
+/* See urlcache.h */
+void urlcache_get_stats(uint64_t *hits, uint64_t *misses, uint64_t *entries)
+{
+	pthread_mutex_lock(&urlcache_lock);
+
+	if (hits)
+		*hits = urlcache_hits;
+	if (misses)
+		*misses = urlcache_misses;
+	if (entries)
+		*entries = urlcache_count;
+
+	pthread_mutex_unlock(&urlcache_lock);
+}
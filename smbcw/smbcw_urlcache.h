@@ -0,0 +1,109 @@
+#ifndef _URLCACHE_H
+#define _URLCACHE_H
+
+/* Small wrapper library for the basic functions of libsmbclient. This library
+ * provides a common interface to libsmbclient with fixed size types.
+ *
+ * (c) by Andreas Stoeckel 2010
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <libsmbclient.h>
+
+/**
+ * The url cache maps an url string exactly as it was passed to smbcw onto the
+ * context and the smbc filename it resolves to. This way repeated operations on
+ * the same url neither have to parse the url, nor to search the connection
+ * table, nor to assemble the filename again. All functions may be called by
+ * several threads at the same time.
+ */
+typedef struct {
+	char *url;
+	SMBCCTX *ctx;
+	char *filename;
+
+	//Internally used by the cache
+	uint32_t hash;
+	int refcount;
+	int cached;
+	void *next;
+	void *lru_prev;
+	void *lru_next;
+} t_smbcw_urlcache_entry;
+
+/**
+ * Pointer on t_smbcw_urlcache_entry
+ */
+typedef t_smbcw_urlcache_entry *lp_smbcw_urlcache_entry;
+
+/**
+ * Frees all entries of the url cache.
+ */
+void urlcache_finalize();
+
+/**
+ * Sets the maximum number of entries kept in the url cache. If size is <= 0, urls
+ * are not cached at all. Changing the size empties the cache.
+ */
+void urlcache_set_size(int size);
+
+/**
+ * Searches the cache for the given url. If an entry is found, it is returned and
+ * stays valid until it is passed to urlcache_release - even if it is dropped from
+ * the cache in the meantime. A reference is added to the context of the entry
+ * (see connections_ref_ctx), which the caller has to remove. Returns NULL if the
+ * url is not cached or its context is being closed.
+ */
+lp_smbcw_urlcache_entry urlcache_get(const char *url);
+
+/**
+ * Calls fn with the cache entry of the given url while the cache is locked, so
+ * that the context of the entry is not freed before fn returns, although no
+ * reference is added to it. Used to serve calls from other caches without taking
+ * references. fn must not call urlcache_* functions. Returns the value fn
+ * returned, 0 if the url is not cached.
+ */
+int urlcache_peek(const char *url,
+	int (*fn)(lp_smbcw_urlcache_entry entry, void *arg), void *arg);
+
+/**
+ * Creates an entry for the given url, context and filename and adds it to the
+ * cache, replacing the least recently used entry if the cache is full. The
+ * returned entry has to be passed to urlcache_release. If caching is disabled,
+ * the entry is not added to the cache but is returned nevertheless.
+ */
+lp_smbcw_urlcache_entry urlcache_put(const char *url, SMBCCTX *ctx,
+	const char *filename);
+
+/**
+ * Releases an entry returned by urlcache_get or urlcache_put.
+ */
+void urlcache_release(lp_smbcw_urlcache_entry entry);
+
+/**
+ * Drops all entries which refer to the given context from the cache. Has to be
+ * called whenever a context is freed.
+ */
+void urlcache_invalidate_ctx(SMBCCTX *ctx);
+
+/**
+ * Returns the number of urlcache_get calls which found an entry (hits), the
+ * number of calls which did not (misses) and the number of cached urls. Any of
+ * the pointers may be NULL.
+ */
+void urlcache_get_stats(uint64_t *hits, uint64_t *misses, uint64_t *entries);
+
+#endif /*_URLCACHE_H*/
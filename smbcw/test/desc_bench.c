@@ -0,0 +1,87 @@
+//Compile with gcc -O2 -o desc_bench desc_bench.c ../smbcw_descriptor.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../smbcw_descriptor.h"
+
+#define LOOKUPS 10000000
+#define CHURN 1000000
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench(int live)
+{
+  int *ids = malloc(live * sizeof(*ids));
+  int i, j;
+  double t;
+  void * volatile sink;
+
+  //Register "live" descriptors
+  t = now();
+  for (i = 0; i < live; i++)
+    ids[i] = smbcw_gen_id(&ids[i]);
+  double t_gen = now() - t;
+
+  //Resolve ids spread over the whole table
+  t = now();
+  for (i = 0, j = 0; i < LOOKUPS; i++, j = (j + 7919) % live)
+    sink = smbcw_get_ptr(ids[j]);
+  double t_get = now() - t;
+  (void)sink;
+
+  //Release and re-register the descriptors
+  t = now();
+  for (i = 0; i < live; i++) {
+    smbcw_free_id(ids[i]);
+    ids[i] = smbcw_gen_id(&ids[i]);
+  }
+  double t_cycle = now() - t;
+
+  //Stale ids have to be rejected
+  int stale = smbcw_get_ptr(ids[0] ^ (1 << 20)) == NULL;
+
+  printf("%7d live: gen %6.1f ns, lookup %6.1f ns, free+gen %6.1f ns, stale rejected: %s\n",
+    live, t_gen * 1e9 / live, t_get * 1e9 / LOOKUPS, t_cycle * 1e9 / live,
+    stale ? "yes" : "NO");
+
+  for (i = 0; i < live; i++)
+    smbcw_free_id(ids[i]);
+  smbcw_free_all_ids();
+  free(ids);
+}
+
+//Open and close a single descriptor over and over while a stale id is kept,
+//like a PHP stream which still holds a closed fd
+int churn()
+{
+  int i, x, y;
+  int stale = smbcw_gen_id(&x);
+  int hits = 0;
+
+  smbcw_free_id(stale);
+  for (i = 0; i < CHURN; i++) {
+    int id = smbcw_gen_id(&y);
+    if (id == stale || smbcw_get_ptr(stale))
+      hits++;
+    smbcw_free_id(id);
+  }
+  smbcw_free_all_ids();
+
+  printf("%7d open/close: stale id resolved %d times\n", CHURN, hits);
+  return hits == 0;
+}
+
+int main()
+{
+  bench(10);
+  bench(1000);
+  bench(100000);
+  return churn() ? 0 : 1;
+}
@@ -1,10 +1,10 @@
 
-//Compile with gcc -o desc_test desc_test.c ../descriptor.c
+//Compile with gcc -o desc_test desc_test.c ../smbcw_descriptor.c
 
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "../descriptor.h"
+#include "../smbcw_descriptor.h"
 
 void test_id(void *ptr)
 {
@@ -0,0 +1,48 @@
+//Stand-in for libsmbclient which forwards everything to the fake backend of
+//smbcw (see smbcw_set_backend), which maps smb://host/share/path onto
+//$FAKE_SMB_ROOT/share/path (default /tmp/smbcw_fake). Link it instead of
+//-lsmbclient to run tests and benchmarks on machines without libsmbclient, e.g.:
+//gcc -o stat_test stat_test.c fake_smbclient.c ../*.c `php-config --includes`
+//
+//smbcw_fake_round_trips() counts the calls of file functions. Set
+//$FAKE_SMB_LATENCY_US to add latency to each round trip,
+//$FAKE_SMB_SESSION_MBPS to limit the throughput of each context, like a TCP
+//window does on a link with high latency, and $FAKE_SMB_FAIL_EVERY to let every
+//n-th round trip fail with EIO.
+
+#include <libsmbclient.h>
+
+#include "../smbcw_fake.h"
+
+smbc_open_fn smbc_getFunctionOpen(SMBCCTX *c) { return backend_fake.get_open(c); }
+smbc_read_fn smbc_getFunctionRead(SMBCCTX *c) { return backend_fake.get_read(c); }
+smbc_write_fn smbc_getFunctionWrite(SMBCCTX *c) { return backend_fake.get_write(c); }
+smbc_lseek_fn smbc_getFunctionLseek(SMBCCTX *c) { return backend_fake.get_lseek(c); }
+smbc_close_fn smbc_getFunctionClose(SMBCCTX *c) { return backend_fake.get_close(c); }
+smbc_stat_fn smbc_getFunctionStat(SMBCCTX *c) { return backend_fake.get_stat(c); }
+smbc_fstat_fn smbc_getFunctionFstat(SMBCCTX *c) { return backend_fake.get_fstat(c); }
+smbc_unlink_fn smbc_getFunctionUnlink(SMBCCTX *c) { return backend_fake.get_unlink(c); }
+smbc_rename_fn smbc_getFunctionRename(SMBCCTX *c) { return backend_fake.get_rename(c); }
+smbc_mkdir_fn smbc_getFunctionMkdir(SMBCCTX *c) { return backend_fake.get_mkdir(c); }
+smbc_rmdir_fn smbc_getFunctionRmdir(SMBCCTX *c) { return backend_fake.get_rmdir(c); }
+smbc_chmod_fn smbc_getFunctionChmod(SMBCCTX *c) { return backend_fake.get_chmod(c); }
+smbc_opendir_fn smbc_getFunctionOpendir(SMBCCTX *c) { return backend_fake.get_opendir(c); }
+smbc_readdir_fn smbc_getFunctionReaddir(SMBCCTX *c) { return backend_fake.get_readdir(c); }
+#ifdef HAVE_SMBC_READDIRPLUS2
+smbc_readdirplus2_fn smbc_getFunctionReaddirPlus2(SMBCCTX *c) { return backend_fake.get_readdirplus2(c); }
+#endif
+#ifdef HAVE_SMBC_SPLICE
+smbc_splice_fn smbc_getFunctionSplice(SMBCCTX *c) { return backend_fake.get_splice(c); }
+#endif
+smbc_closedir_fn smbc_getFunctionClosedir(SMBCCTX *c) { return backend_fake.get_closedir(c); }
+smbc_lseekdir_fn smbc_getFunctionLseekdir(SMBCCTX *c) { return backend_fake.get_lseekdir(c); }
+
+SMBCCTX *smbc_new_context(void) { return backend_fake.new_context(); }
+SMBCCTX *smbc_init_context(SMBCCTX *c) { return backend_fake.init_context(c); }
+int smbc_free_context(SMBCCTX *c, int shutdown_ctx) { return backend_fake.free_context(c, shutdown_ctx); }
+SMBCCTX *smbc_set_context(SMBCCTX *c) { backend_fake.init(); return c; }
+void smbc_setDebug(SMBCCTX *c, int debug) { }
+void smbc_thread_posix(void) { }
+void *smbc_getOptionUserData(SMBCCTX *c) { return backend_fake.get_user_data(c); }
+void smbc_setOptionUserData(SMBCCTX *c, void *user_data) { backend_fake.set_user_data(c, user_data); }
+void smbc_setFunctionAuthDataWithContext(SMBCCTX *c, smbc_get_auth_data_with_context_fn fn) { }
@@ -1,4 +1,5 @@
 //Compile with gcc -o smbcw_test smbcw_test.c -lsmbcw -g
+//Run with --fake to test against /tmp/smbcw_fake instead of a Samba server
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,10 +25,17 @@ void format_mode(int mode)
   if (mode & 001) printf("x"); else printf("-");
 }
 
-int main ()
+int main (int argc, char **argv)
 {
   int fd = 0;
 
+  if (argc > 1 && strcmp(argv[1], "--fake") == 0) {
+    smbcw_init();
+    smbcw_set_backend(SMBCW_BACKEND_FAKE);
+    mkdir("/tmp/smbcw_fake", 0755);
+    mkdir("/tmp/smbcw_fake/smb_test", 0755);
+  }
+
   //Open a file using smbcw
   fd = smbcw_fopen(TEST_URL, "w");
   if (fd > 0) {
@@ -21,17 +21,45 @@
 #endif
 
 #include "php.h"
+#include "php_ini.h"
+#include "ext/standard/info.h"
+#include "ext/standard/file.h"
 #include "php_smbcw_wrapper.h"
 #include <stdio.h>
 #include <errno.h>
 #include "smbcw/smbcw.h"
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 static zend_function_entry smbcw_wrapper_functions[] = {
     PHP_FE(smb_chmod, NULL)
+    PHP_FE(smb_cache_stats, NULL)
+    PHP_FE(smb_copy, NULL)
+    PHP_FE(smb_async_open, NULL)
+    PHP_FE(smb_async_read, NULL)
+    PHP_FE(smb_async_write, NULL)
+    PHP_FE(smb_async_stat, NULL)
+    PHP_FE(smb_async_opendir, NULL)
+    PHP_FE(smb_async_readdir, NULL)
+    PHP_FE(smb_async_close, NULL)
+    PHP_FE(smb_async_closedir, NULL)
+    PHP_FE(smb_async_wait, NULL)
+    PHP_FE(smb_async_fd, NULL)
+    PHP_FE(smb_stat_many, NULL)
+    PHP_FE(smb_stats, NULL)
+    PHP_FE(smb_roundtrips, NULL)
     {NULL, NULL, NULL}
 };
 
+ZEND_DECLARE_MODULE_GLOBALS(smbcw)
+
+static PHP_GINIT_FUNCTION(smbcw)
+{
+	memset(smbcw_globals, 0, sizeof(*smbcw_globals));
+}
+
 zend_module_entry smbcw_wrapper_module_entry = {
         STANDARD_MODULE_HEADER,
         PHP_SMBCW_WRAPPER_EXTNAME,
@@ -39,16 +67,250 @@ zend_module_entry smbcw_wrapper_module_entry = {
         PHP_MINIT(smbcw),
         PHP_MSHUTDOWN(smbcw),
         NULL,
-        NULL,
+        PHP_RSHUTDOWN(smbcw),
         PHP_MINFO(smbcw),
         PHP_SMBCW_WRAPPER_VERSION,
-        STANDARD_MODULE_PROPERTIES
+        PHP_MODULE_GLOBALS(smbcw),
+        PHP_GINIT(smbcw),
+        NULL,
+        NULL,
+        STANDARD_MODULE_PROPERTIES_EX
 };
 
 #ifdef COMPILE_DL_SMBCW_WRAPPER
 ZEND_GET_MODULE(smbcw_wrapper)
 #endif
 
+//---- INI SETTINGS ----
+
+static int smbcw_max_contexts = 0;
+static int smbcw_idle_timeout = 0;
+
+static PHP_INI_MH(OnUpdateSmbcwMaxContexts)
+{
+	smbcw_max_contexts = atoi(new_value);
+	smbcw_set_context_limits(smbcw_max_contexts, smbcw_idle_timeout);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwIdleTimeout)
+{
+	smbcw_idle_timeout = atoi(new_value);
+	smbcw_set_context_limits(smbcw_max_contexts, smbcw_idle_timeout);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwUrlCacheSize)
+{
+	smbcw_set_url_cache_size(atoi(new_value));
+	return SUCCESS;
+}
+
+/* Translates a stat mode name ("probe", "fast", "cached") into the smbcw mode */
+static int smbcw_parse_stat_mode(const char *mode)
+{
+	if (strcasecmp(mode, "fast") == 0)
+		return SMBCW_STAT_FAST;
+	if (strcasecmp(mode, "cached") == 0)
+		return SMBCW_STAT_CACHED;
+	if (strcasecmp(mode, "probe") == 0)
+		return SMBCW_STAT_PROBE;
+
+	return SMBCW_STAT_DEFAULT;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwStatMode)
+{
+	int mode = smbcw_parse_stat_mode(new_value);
+	if (mode == SMBCW_STAT_DEFAULT)
+		return FAILURE;
+
+	smbcw_set_stat_mode(mode);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwStatProbeTtl)
+{
+	smbcw_set_probe_cache_ttl(atoi(new_value));
+	return SUCCESS;
+}
+
+static int smbcw_stat_cache_size = 0;
+static int smbcw_stat_cache_ttl = 0;
+
+static PHP_INI_MH(OnUpdateSmbcwStatCacheSize)
+{
+	smbcw_stat_cache_size = atoi(new_value);
+	smbcw_set_stat_cache(smbcw_stat_cache_size, smbcw_stat_cache_ttl);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwStatCacheTtl)
+{
+	smbcw_stat_cache_ttl = atoi(new_value);
+	smbcw_set_stat_cache(smbcw_stat_cache_size, smbcw_stat_cache_ttl);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwReadAhead)
+{
+	/* Accepts sizes like "1M" */
+	smbcw_set_read_ahead(zend_atol(new_value, new_value_length));
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwPrefetchBlocks)
+{
+	smbcw_set_prefetch(atoi(new_value));
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwWriteBuffer)
+{
+	/* Accepts sizes like "64K" */
+	smbcw_set_write_buffer_size(zend_atol(new_value, new_value_length));
+	return SUCCESS;
+}
+
+static int smbcw_neg_cache_size = 0;
+static int smbcw_neg_cache_ttl = 0;
+
+static PHP_INI_MH(OnUpdateSmbcwNegCacheSize)
+{
+	smbcw_neg_cache_size = atoi(new_value);
+	smbcw_set_negative_cache(smbcw_neg_cache_size, smbcw_neg_cache_ttl);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwNegCacheTtl)
+{
+	smbcw_neg_cache_ttl = atoi(new_value);
+	smbcw_set_negative_cache(smbcw_neg_cache_size, smbcw_neg_cache_ttl);
+	return SUCCESS;
+}
+
+static int smbcw_pool_size = 1;
+static int smbcw_pool_wait = 1;
+
+static PHP_INI_MH(OnUpdateSmbcwPoolSize)
+{
+	smbcw_pool_size = atoi(new_value);
+	smbcw_set_pool(smbcw_pool_size, smbcw_pool_wait);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwPoolWait)
+{
+	smbcw_pool_wait = atoi(new_value);
+	smbcw_set_pool(smbcw_pool_size, smbcw_pool_wait);
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwAsyncWorkers)
+{
+	smbcw_set_async_workers(atoi(new_value));
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwStats)
+{
+	smbcw_set_stats(atoi(new_value));
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwBackend)
+{
+	int backend;
+	if (strcmp(new_value, "libsmbclient") == 0)
+		backend = SMBCW_BACKEND_LIBSMBCLIENT;
+	else if (strcmp(new_value, "fake") == 0)
+		backend = SMBCW_BACKEND_FAKE;
+	else
+		return FAILURE;
+
+	return smbcw_set_backend(backend) < 0 ? FAILURE : SUCCESS;
+}
+
+static int smbcw_roundtrip_log = -1;
+
+static PHP_INI_MH(OnUpdateSmbcwRoundtripLog)
+{
+	int fd = -1;
+	if (new_value && new_value[0]) {
+		fd = open(new_value, O_WRONLY | O_APPEND | O_CREAT, 0640);
+		if (fd < 0)
+			return FAILURE;
+	}
+
+	smbcw_set_roundtrip_log(fd);
+	if (smbcw_roundtrip_log >= 0)
+		close(smbcw_roundtrip_log);
+	smbcw_roundtrip_log = fd;
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwTrace)
+{
+	if (new_value && new_value[0])
+		return smbcw_trace_start(new_value) < 0 ? FAILURE : SUCCESS;
+
+	smbcw_trace_stop();
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateSmbcwSlowThreshold)
+{
+	//The class is passed as mh_arg1 of the ini entry
+	int cls = (int)(intptr_t)mh_arg1;
+	return smbcw_set_slow_threshold(cls, atoi(new_value)) < 0 ? FAILURE : SUCCESS;
+}
+
+static int smbcw_slow_log = -1;
+
+static PHP_INI_MH(OnUpdateSmbcwSlowLog)
+{
+	int fd = SMBCW_SLOW_LOG_SYSLOG;
+	if (new_value && new_value[0] && strcmp(new_value, "syslog") != 0) {
+		fd = open(new_value, O_WRONLY | O_APPEND | O_CREAT, 0640);
+		if (fd < 0)
+			return FAILURE;
+	}
+
+	smbcw_set_slow_log(fd);
+	if (smbcw_slow_log >= 0)
+		close(smbcw_slow_log);
+	smbcw_slow_log = fd;
+	return SUCCESS;
+}
+
+PHP_INI_BEGIN()
+	PHP_INI_ENTRY("smbcw.max_contexts", "64", PHP_INI_SYSTEM, OnUpdateSmbcwMaxContexts)
+	PHP_INI_ENTRY("smbcw.idle_timeout", "300", PHP_INI_SYSTEM, OnUpdateSmbcwIdleTimeout)
+	PHP_INI_ENTRY("smbcw.url_cache_size", "256", PHP_INI_SYSTEM, OnUpdateSmbcwUrlCacheSize)
+	PHP_INI_ENTRY("smbcw.stat_mode", "probe", PHP_INI_ALL, OnUpdateSmbcwStatMode)
+	PHP_INI_ENTRY("smbcw.stat_probe_ttl", "60", PHP_INI_SYSTEM, OnUpdateSmbcwStatProbeTtl)
+	PHP_INI_ENTRY("smbcw.stat_cache_size", "4096", PHP_INI_SYSTEM, OnUpdateSmbcwStatCacheSize)
+	PHP_INI_ENTRY("smbcw.stat_cache_ttl", "2", PHP_INI_SYSTEM, OnUpdateSmbcwStatCacheTtl)
+	PHP_INI_ENTRY("smbcw.read_ahead", "1M", PHP_INI_SYSTEM, OnUpdateSmbcwReadAhead)
+	PHP_INI_ENTRY("smbcw.prefetch_blocks", "0", PHP_INI_SYSTEM, OnUpdateSmbcwPrefetchBlocks)
+	PHP_INI_ENTRY("smbcw.write_buffer", "64K", PHP_INI_SYSTEM, OnUpdateSmbcwWriteBuffer)
+	PHP_INI_ENTRY("smbcw.negative_cache_size", "1024", PHP_INI_SYSTEM, OnUpdateSmbcwNegCacheSize)
+	PHP_INI_ENTRY("smbcw.negative_cache_ttl", "2", PHP_INI_SYSTEM, OnUpdateSmbcwNegCacheTtl)
+	PHP_INI_ENTRY("smbcw.pool_size", "1", PHP_INI_SYSTEM, OnUpdateSmbcwPoolSize)
+	PHP_INI_ENTRY("smbcw.pool_wait", "1", PHP_INI_SYSTEM, OnUpdateSmbcwPoolWait)
+	PHP_INI_ENTRY("smbcw.async_workers", "4", PHP_INI_SYSTEM, OnUpdateSmbcwAsyncWorkers)
+	PHP_INI_ENTRY("smbcw.stats", "0", PHP_INI_SYSTEM, OnUpdateSmbcwStats)
+	PHP_INI_ENTRY("smbcw.backend", "libsmbclient", PHP_INI_SYSTEM, OnUpdateSmbcwBackend)
+	PHP_INI_ENTRY("smbcw.roundtrip_log", "", PHP_INI_SYSTEM, OnUpdateSmbcwRoundtripLog)
+	PHP_INI_ENTRY("smbcw.trace", "", PHP_INI_SYSTEM, OnUpdateSmbcwTrace)
+	PHP_INI_ENTRY1("smbcw.slow_metadata_ms", "0", PHP_INI_SYSTEM, OnUpdateSmbcwSlowThreshold, (void*)SMBCW_SLOW_METADATA)
+	PHP_INI_ENTRY1("smbcw.slow_read_ms", "0", PHP_INI_SYSTEM, OnUpdateSmbcwSlowThreshold, (void*)SMBCW_SLOW_READ)
+	PHP_INI_ENTRY1("smbcw.slow_write_ms", "0", PHP_INI_SYSTEM, OnUpdateSmbcwSlowThreshold, (void*)SMBCW_SLOW_WRITE)
+	PHP_INI_ENTRY1("smbcw.slow_open_ms", "0", PHP_INI_SYSTEM, OnUpdateSmbcwSlowThreshold, (void*)SMBCW_SLOW_OPEN)
+	PHP_INI_ENTRY1("smbcw.slow_readdir_ms", "0", PHP_INI_SYSTEM, OnUpdateSmbcwSlowThreshold, (void*)SMBCW_SLOW_READDIR)
+	PHP_INI_ENTRY("smbcw.slow_log", "syslog", PHP_INI_SYSTEM, OnUpdateSmbcwSlowLog)
+PHP_INI_END()
+
 void print_last_smb_err()
 {
 	//Get the smbcw error and print it
@@ -137,8 +399,16 @@ static int php_smb_close(php_stream *stream, int close_handle TSRMLS_DC)
 
 static int php_smb_flush(php_stream *stream TSRMLS_DC)
 {
-	//!
-	return 1;
+	lp_php_smb_data self = (lp_php_smb_data)stream->abstract;
+
+	/* Send the data collected in the smbcw write buffer to the server */
+	if (self->fd > 0 && smbcw_fflush(self->fd) < 0)
+	{
+		print_last_smb_err();
+		return EOF;
+	}
+
+	return 0;
 }
 
 static int php_smb_seek(php_stream *stream, off_t offset, int whence, off_t *newoffset TSRMLS_DC)
@@ -179,6 +449,31 @@ static int php_smb_stat(php_stream *stream, php_stream_statbuf *ssb TSRMLS_DC)
 	return 0;
 }
 
+static int php_smb_set_option(php_stream *stream, int option, int value, void *ptrparam TSRMLS_DC)
+{
+	lp_php_smb_data self = (lp_php_smb_data)stream->abstract;
+
+	if (self->fd <= 0)
+		return PHP_STREAM_OPTION_RETURN_ERR;
+
+	switch (option)
+	{
+		case PHP_STREAM_OPTION_WRITE_BUFFER:
+			/* stream_set_write_buffer($fp, 0) makes the stream write-through */
+			if (value == PHP_STREAM_BUFFER_NONE)
+				return smbcw_set_write_buffer(self->fd, 0) < 0 ?
+					PHP_STREAM_OPTION_RETURN_ERR : PHP_STREAM_OPTION_RETURN_OK;
+
+			if (ptrparam)
+				return smbcw_set_write_buffer(self->fd, *(size_t*)ptrparam) < 0 ?
+					PHP_STREAM_OPTION_RETURN_ERR : PHP_STREAM_OPTION_RETURN_OK;
+
+			return PHP_STREAM_OPTION_RETURN_OK;
+	}
+
+	return PHP_STREAM_OPTION_RETURN_NOTIMPL;
+}
+
 php_stream_ops php_stream_smb_ops = {
         php_smb_write,
 		php_smb_read,
@@ -188,7 +483,7 @@ php_stream_ops php_stream_smb_ops = {
         php_smb_seek, /* seek */
         NULL, /* cast */
         php_smb_stat, /* stat */
-        NULL  /* set_option */
+        php_smb_set_option  /* set_option */
 };
 
 #define FREE_AND_RETURN {\
@@ -228,7 +523,14 @@ static size_t php_smb_dirstream_read(php_stream *stream, char *buf, size_t count
 
 		/* Read the dir entry name */
 		char *name;
+#ifdef HAVE_SMBC_READDIRPLUS2
+		/* Fetch the attributes with the name, so following is_dir/filesize
+		   calls on the entries are answered from the metadata cache */
+		smbcw_stat st;
+		smbcw_readdirplus(self->fd, &name, &st);
+#else
 		smbcw_readdir(self->fd, &name);
+#endif
 		if (name != NULL)
 		{
 			php_stream_dirent *php_ent = (php_stream_dirent*)buf;
@@ -247,7 +549,7 @@ static int php_smb_dirstream_close(php_stream *stream, int close_handle TSRMLS_D
 {
 	lp_php_smb_data self = (lp_php_smb_data)stream->abstract;
 
-	if (self->fd == 0)
+	if (self->fd > 0)
 		smbcw_closedir(self->fd);
 
 	free_smb_data(self);
@@ -261,7 +563,7 @@ static int php_smb_dirstream_rewind(php_stream *stream, off_t offset, int whence
 
 	if (self->fd > 0)
 	{
-		int err = smbc_lseekdir(self->fd, 0);
+		int err = smbcw_rewinddir(self->fd);
 		SMB_CHECK_ERR(err);
 	}
 	
@@ -300,15 +602,39 @@ php_stream *_php_smb_dir_opener(php_stream_wrapper *wrapper, char *path, char *m
 
 //---- MISC FILE OPERATIONS ----
 
+/* Returns the stat mode set with the "stat_mode" option of the "smb" stream
+   context, e.g. stream_context_set_default(array('smb' => array('stat_mode' => 'fast'))) */
+static int php_smb_context_stat_mode(php_stream_context *context TSRMLS_DC)
+{
+	zval **option;
+
+	//stat() and friends do not pass a context, fall back to the default one
+	if (!context)
+		context = FG(default_context);
+
+	if (context && php_stream_context_get_option(context, "smb", "stat_mode", &option) == SUCCESS)
+	{
+		if (Z_TYPE_PP(option) == IS_STRING)
+			return smbcw_parse_stat_mode(Z_STRVAL_PP(option));
+		if (Z_TYPE_PP(option) == IS_LONG)
+			return Z_LVAL_PP(option);
+	}
+
+	return SMBCW_STAT_DEFAULT;
+}
+
 int _php_smb_url_stat(php_stream_wrapper *wrapper, char *url, int flags, php_stream_statbuf *ssb, php_stream_context *context TSRMLS_DC)
 {
 	smbcw_stat stat;
-	if (smbcw_urlstat(url, &stat) >= 0)
+
+	/* SMB shares do not expose symlinks to libsmbclient, so lstat
+	   (PHP_STREAM_URL_STAT_LINK) is the same as stat */
+	if (smbcw_urlstat_ex(url, &stat, php_smb_context_stat_mode(context TSRMLS_CC)) >= 0)
 	{
 		copy_to_php_stat(&stat, &ssb->sb);
 		return 0;
 	}
-	else
+	else if (!(flags & PHP_STREAM_URL_STAT_QUIET))
 		print_last_smb_err();
 
 	return -1;
@@ -371,13 +697,813 @@ PHP_FUNCTION(smb_chmod)
 	RETURN_LONG(ret >= 0 ? 1 : 0);
 }
 
+PHP_FUNCTION(smb_cache_stats)
+{
+	smbcw_cache_stats stats;
+	smbcw_get_cache_stats(&stats);
+
+	array_init(return_value);
+	add_assoc_long(return_value, "conn_hits", stats.conn_hits);
+	add_assoc_long(return_value, "conn_misses", stats.conn_misses);
+	add_assoc_long(return_value, "conn_entries", stats.conn_entries);
+	add_assoc_long(return_value, "conn_waits", stats.conn_waits);
+	add_assoc_long(return_value, "url_hits", stats.url_hits);
+	add_assoc_long(return_value, "url_misses", stats.url_misses);
+	add_assoc_long(return_value, "url_entries", stats.url_entries);
+	add_assoc_long(return_value, "stat_hits", stats.stat_hits);
+	add_assoc_long(return_value, "stat_misses", stats.stat_misses);
+	add_assoc_long(return_value, "stat_entries", stats.stat_entries);
+	add_assoc_long(return_value, "neg_hits", stats.neg_hits);
+	add_assoc_long(return_value, "neg_misses", stats.neg_misses);
+	add_assoc_long(return_value, "neg_entries", stats.neg_entries);
+}
+
+PHP_FUNCTION(smb_copy)
+{
+	char *url_from, *url_to;
+	int url_from_len = 0, url_to_len = 0;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &url_from,
+		&url_from_len, &url_to, &url_to_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (smbcw_copy(url_from, url_to) < 0)
+	{
+		print_last_smb_err();
+		RETURN_FALSE;
+	}
+
+	RETURN_TRUE;
+}
+
+//---- ASYNCHRONOUS CALLS ----
+
+/* Buffers of an asynchronous request, passed as its priv pointer */
+typedef struct {
+	char *buf;
+	smbcw_stat stat;
+} php_smb_async_op;
+
+typedef php_smb_async_op *lp_php_smb_async_op;
+
+/* Longest name smb_async_readdir returns, in bytes */
+#define PHP_SMB_ASYNC_NAME_SIZE 1024
+
+/* Returns the completion queue of the current request, creating it on first use */
+static smbcw_async_queue *php_smb_async_queue(TSRMLS_D)
+{
+	if (!SMBCW_G(async_queue))
+		SMBCW_G(async_queue) = smbcw_async_create();
+
+	return SMBCW_G(async_queue);
+}
+
+/* Allocates the buffers of a request. The workers write to them, so they are not
+   taken from the request memory, which might be gone before the request is. */
+static lp_php_smb_async_op php_smb_async_op_new(size_t buf_size)
+{
+	lp_php_smb_async_op op = calloc(1, sizeof(*op));
+
+	if (op && buf_size && !(op->buf = malloc(buf_size)))
+	{
+		free(op);
+		op = NULL;
+	}
+
+	return op;
+}
+
+static void php_smb_async_op_free(lp_php_smb_async_op op)
+{
+	if (op)
+	{
+		free(op->buf);
+		free(op);
+	}
+}
+
+/* Returns the id of a submitted request or false if it could not be submitted */
+#define PHP_SMB_ASYNC_RETURN(id, op)\
+if (id < 0) {\
+	php_error(E_WARNING, "[SMBCW_WRAPPER WARNING] %s ", strerror(errno));\
+	php_smb_async_op_free(op);\
+	RETURN_FALSE;\
+}\
+RETURN_LONG(id);
+
+/* Writes stat to result as an array with the keys of stat() */
+static void php_smb_stat_array(smbcw_stat *stat, zval *result)
+{
+	array_init(result);
+	add_assoc_long(result, "dev", stat->s_dev);
+	add_assoc_long(result, "ino", stat->s_ino);
+	add_assoc_long(result, "mode", stat->s_mode);
+	add_assoc_long(result, "nlink", stat->s_nlink);
+	add_assoc_long(result, "uid", stat->s_uid);
+	add_assoc_long(result, "gid", stat->s_gid);
+	add_assoc_long(result, "rdev", stat->s_rdev);
+	add_assoc_long(result, "size", stat->s_size);
+	add_assoc_long(result, "atime", stat->s_atime);
+	add_assoc_long(result, "mtime", stat->s_mtime);
+	add_assoc_long(result, "ctime", stat->s_ctime);
+	add_assoc_long(result, "blksize", stat->s_blksize);
+	add_assoc_long(result, "blocks", stat->s_blocks);
+}
+
+/* Converts a completion to the value smb_async_wait returns for it and frees its
+   buffers */
+static void php_smb_async_result(smbcw_completion *done, zval *result)
+{
+	lp_php_smb_async_op op = done->priv;
+	zval *stat;
+
+	/* The end of a directory is no error worth a warning */
+	if (done->result < 0 && done->op != SMBCW_ASYNC_READDIR)
+		php_error(E_WARNING, "[SMBCW_WRAPPER WARNING] %s ", strerror(done->err));
+
+	switch (done->op)
+	{
+		case SMBCW_ASYNC_OPEN:
+		case SMBCW_ASYNC_OPENDIR:
+		case SMBCW_ASYNC_WRITE:
+			if (done->result >= 0) {
+				ZVAL_LONG(result, done->result);
+			} else {
+				ZVAL_FALSE(result);
+			}
+			break;
+		case SMBCW_ASYNC_READ:
+			if (done->result >= 0) {
+				ZVAL_STRINGL(result, op->buf, done->result, 1);
+			} else {
+				ZVAL_FALSE(result);
+			}
+			break;
+		case SMBCW_ASYNC_STAT:
+			if (done->result >= 0) {
+				php_smb_stat_array(&op->stat, result);
+			} else {
+				ZVAL_FALSE(result);
+			}
+			break;
+		case SMBCW_ASYNC_READDIR:
+			if (done->result >= 0)
+			{
+				array_init(result);
+				add_assoc_string(result, "name", op->buf, 1);
+				MAKE_STD_ZVAL(stat);
+				php_smb_stat_array(&op->stat, stat);
+				add_assoc_zval(result, "stat", stat);
+			} else {
+				ZVAL_FALSE(result);
+			}
+			break;
+		default:
+			ZVAL_BOOL(result, done->result >= 0);
+			break;
+	}
+
+	php_smb_async_op_free(op);
+}
+
+/* Fetches the available completions, waiting up to timeout milliseconds for the
+   first one. Returns the number of completions fetched. */
+static int php_smb_async_fetch(int timeout TSRMLS_DC)
+{
+	smbcw_async_queue *queue = SMBCW_G(async_queue);
+
+	/* Nothing would ever arrive */
+	if (!queue || !smbcw_async_pending(queue))
+		return 0;
+
+	int free_count = SMBCW_G(async_done_size) - SMBCW_G(async_done_count);
+	if (free_count < 16)
+	{
+		int size = SMBCW_G(async_done_size) * 2 + 16;
+		smbcw_completion *done = realloc(SMBCW_G(async_done), size * sizeof(*done));
+		if (!done)
+			return 0;
+
+		SMBCW_G(async_done) = done;
+		SMBCW_G(async_done_size) = size;
+		free_count = size - SMBCW_G(async_done_count);
+	}
+
+	int count = smbcw_async_wait(queue, SMBCW_G(async_done) + SMBCW_G(async_done_count),
+		free_count, timeout);
+	if (count < 0)
+		return 0;
+
+	SMBCW_G(async_done_count) += count;
+	return count;
+}
+
+/* Moves the fetched completion at index to result */
+static void php_smb_async_take(int index, zval *result TSRMLS_DC)
+{
+	smbcw_completion *done = SMBCW_G(async_done);
+	zval *value;
+
+	MAKE_STD_ZVAL(value);
+	php_smb_async_result(&done[index], value);
+	add_index_zval(result, done[index].id, value);
+
+	done[index] = done[--SMBCW_G(async_done_count)];
+}
+
+PHP_FUNCTION(smb_async_open)
+{
+	char *url, *mode = "r";
+	int url_len = 0, mode_len = 0;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|s", &url, &url_len,
+		&mode, &mode_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	int64_t id = smbcw_async_open(php_smb_async_queue(TSRMLS_C), url, mode, NULL);
+	PHP_SMB_ASYNC_RETURN(id, NULL);
+}
+
+PHP_FUNCTION(smb_async_read)
+{
+	long fd, length;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ll", &fd, &length) == FAILURE ||
+		length <= 0) {
+		RETURN_FALSE;
+	}
+
+	lp_php_smb_async_op op = php_smb_async_op_new(length);
+	int64_t id = op ? smbcw_async_read(php_smb_async_queue(TSRMLS_C), fd, op->buf,
+		length, op) : -1;
+	PHP_SMB_ASYNC_RETURN(id, op);
+}
+
+PHP_FUNCTION(smb_async_write)
+{
+	long fd;
+	char *data;
+	int data_len = 0;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ls", &fd, &data,
+		&data_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	/* The string might be gone before the data has been written */
+	lp_php_smb_async_op op = php_smb_async_op_new(data_len + 1);
+	if (op)
+		memcpy(op->buf, data, data_len);
+
+	int64_t id = op ? smbcw_async_write(php_smb_async_queue(TSRMLS_C), fd, op->buf,
+		data_len, op) : -1;
+	PHP_SMB_ASYNC_RETURN(id, op);
+}
+
+PHP_FUNCTION(smb_async_stat)
+{
+	char *url;
+	int url_len = 0;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &url, &url_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	lp_php_smb_async_op op = php_smb_async_op_new(0);
+	int64_t id = op ? smbcw_async_stat(php_smb_async_queue(TSRMLS_C), url, &op->stat,
+		op) : -1;
+	PHP_SMB_ASYNC_RETURN(id, op);
+}
+
+PHP_FUNCTION(smb_async_opendir)
+{
+	char *url;
+	int url_len = 0;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &url, &url_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	int64_t id = smbcw_async_opendir(php_smb_async_queue(TSRMLS_C), url, NULL);
+	PHP_SMB_ASYNC_RETURN(id, NULL);
+}
+
+PHP_FUNCTION(smb_async_readdir)
+{
+	long fd;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &fd) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	lp_php_smb_async_op op = php_smb_async_op_new(PHP_SMB_ASYNC_NAME_SIZE);
+	int64_t id = op ? smbcw_async_readdir(php_smb_async_queue(TSRMLS_C), fd, op->buf,
+		PHP_SMB_ASYNC_NAME_SIZE, &op->stat, op) : -1;
+	PHP_SMB_ASYNC_RETURN(id, op);
+}
+
+PHP_FUNCTION(smb_async_close)
+{
+	long fd;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &fd) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	int64_t id = smbcw_async_close(php_smb_async_queue(TSRMLS_C), fd, NULL);
+	PHP_SMB_ASYNC_RETURN(id, NULL);
+}
+
+PHP_FUNCTION(smb_async_closedir)
+{
+	long fd;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &fd) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	int64_t id = smbcw_async_closedir(php_smb_async_queue(TSRMLS_C), fd, NULL);
+	PHP_SMB_ASYNC_RETURN(id, NULL);
+}
+
+/* smb_async_wait([array $ids [, float $timeout]]) returns an array mapping the
+   ids of completed requests to their results. With ids it waits until all of
+   them have completed, otherwise until at least one request has completed.
+   Completions of other requests are kept for later calls. A timeout < 0 waits
+   forever, 0 only returns what is already there. */
+PHP_FUNCTION(smb_async_wait)
+{
+	zval *ids = NULL;
+	double timeout = -1;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|a!d", &ids,
+		&timeout) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	struct timeval start, now;
+	gettimeofday(&start, NULL);
+
+	array_init(return_value);
+
+	while (1)
+	{
+		int i, missing = 0;
+
+		if (ids)
+		{
+			HashPosition pos;
+			zval **entry;
+
+			/* Return the requested completions which are already there */
+			for (zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(ids), &pos);
+				zend_hash_get_current_data_ex(Z_ARRVAL_P(ids), (void **)&entry, &pos) == SUCCESS;
+				zend_hash_move_forward_ex(Z_ARRVAL_P(ids), &pos))
+			{
+				long id = (Z_TYPE_PP(entry) == IS_LONG) ? Z_LVAL_PP(entry) : 0;
+
+				if (zend_hash_index_exists(Z_ARRVAL_P(return_value), id))
+					continue;
+
+				for (i = 0; i < SMBCW_G(async_done_count); i++)
+					if (SMBCW_G(async_done)[i].id == id)
+						break;
+
+				if (i < SMBCW_G(async_done_count))
+					php_smb_async_take(i, return_value TSRMLS_CC);
+				else
+					missing++;
+			}
+		}
+		else
+		{
+			while (SMBCW_G(async_done_count))
+				php_smb_async_take(0, return_value TSRMLS_CC);
+
+			missing = !zend_hash_num_elements(Z_ARRVAL_P(return_value));
+		}
+
+		if (!missing)
+			break;
+
+		/* Wait for the remaining time */
+		int wait = -1;
+		if (timeout >= 0)
+		{
+			gettimeofday(&now, NULL);
+			double left = timeout - (now.tv_sec - start.tv_sec) -
+				(now.tv_usec - start.tv_usec) / 1e6;
+			wait = left > 0 ? left * 1000 : 0;
+		}
+
+		if (!php_smb_async_fetch(wait TSRMLS_CC) && wait >= 0)
+			break;
+		if (!SMBCW_G(async_queue) || (!smbcw_async_pending(SMBCW_G(async_queue)) &&
+			!SMBCW_G(async_done_count)))
+			break;
+	}
+}
+
+/* Returns a stream which becomes readable when smb_async_wait has something to
+   return, so it can be watched by an event loop. It must not be read from. */
+PHP_FUNCTION(smb_async_fd)
+{
+	smbcw_async_queue *queue = php_smb_async_queue(TSRMLS_C);
+	if (!queue) {
+		RETURN_FALSE;
+	}
+
+	/* Closing the stream must not close the descriptor of the queue */
+	int fd = dup(smbcw_async_fd(queue));
+	php_stream *stream = (fd >= 0) ? php_stream_fopen_from_fd(fd, "r", NULL) : NULL;
+	if (!stream) {
+		if (fd >= 0)
+			close(fd);
+		RETURN_FALSE;
+	}
+
+	php_stream_to_zval(stream, return_value);
+}
+
+/* smb_stat_many(array $urls) returns the stat of all urls, retrieved
+   concurrently. The keys of $urls are kept, urls which could not be stat'ed map
+   to false. */
+PHP_FUNCTION(smb_stat_many)
+{
+	zval *urls, **entry;
+	HashPosition pos;
+	int i = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &urls) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	int count = zend_hash_num_elements(Z_ARRVAL_P(urls));
+	char **strs = ecalloc(count + 1, sizeof(*strs));
+	smbcw_stat *stats = ecalloc(count + 1, sizeof(*stats));
+	int *errors = ecalloc(count + 1, sizeof(*errors));
+
+	for (zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(urls), &pos);
+		zend_hash_get_current_data_ex(Z_ARRVAL_P(urls), (void **)&entry, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(Z_ARRVAL_P(urls), &pos))
+	{
+		zval copy = **entry;
+		zval_copy_ctor(&copy);
+		convert_to_string(&copy);
+		strs[i++] = Z_STRVAL(copy);
+	}
+
+	//-1 leaves errors unset, e.g. if memory ran out
+	if (smbcw_urlstat_many(strs, count, stats, errors) < 0) {
+		print_last_smb_err();
+		for (i = 0; i < count; i++)
+			efree(strs[i]);
+		efree(strs);
+		efree(stats);
+		efree(errors);
+		RETURN_FALSE;
+	}
+
+	array_init(return_value);
+
+	for (i = 0, zend_hash_internal_pointer_reset_ex(Z_ARRVAL_P(urls), &pos);
+		i < count; i++, zend_hash_move_forward_ex(Z_ARRVAL_P(urls), &pos))
+	{
+		zval *value;
+		char *key;
+		uint key_len;
+		ulong index;
+
+		MAKE_STD_ZVAL(value);
+		if (errors[i] == 0) {
+			php_smb_stat_array(&stats[i], value);
+		} else {
+			ZVAL_FALSE(value);
+		}
+
+		if (zend_hash_get_current_key_ex(Z_ARRVAL_P(urls), &key, &key_len, &index, 0,
+			&pos) == HASH_KEY_IS_STRING)
+			add_assoc_zval_ex(return_value, key, key_len, value);
+		else
+			add_index_zval(return_value, index, value);
+
+		efree(strs[i]);
+	}
+
+	efree(strs);
+	efree(stats);
+	efree(errors);
+}
+
+//---- STATISTICS ----
+
+PHP_FUNCTION(smb_stats)
+{
+	smbcw_stats stats;
+	int i;
+
+	if (smbcw_get_stats(&stats) < 0) {
+		RETURN_FALSE;
+	}
+
+	array_init(return_value);
+	add_assoc_long(return_value, "bytes_read", stats.bytes_read);
+	add_assoc_long(return_value, "bytes_written", stats.bytes_written);
+	add_assoc_long(return_value, "conn_hits", stats.conn_hits);
+	add_assoc_long(return_value, "conn_misses", stats.conn_misses);
+	add_assoc_long(return_value, "descriptors_open", stats.descriptors_open);
+	add_assoc_long(return_value, "contexts_alive", stats.contexts_alive);
+
+	zval *ops;
+	MAKE_STD_ZVAL(ops);
+	array_init(ops);
+
+	for (i = 0; i < stats.op_count; i++)
+	{
+		smbcw_op_stats *op = &stats.ops[i];
+		zval *entry;
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_string(entry, "op", (char*)op->name, 1);
+		add_assoc_string(entry, "host", op->host, 1);
+		add_assoc_long(entry, "count", op->count);
+		add_assoc_long(entry, "errors", op->errors);
+		add_assoc_long(entry, "total_ns", op->total_ns);
+		add_assoc_long(entry, "p50_ns", op->p50_ns);
+		add_assoc_long(entry, "p90_ns", op->p90_ns);
+		add_assoc_long(entry, "p99_ns", op->p99_ns);
+		add_assoc_long(entry, "p999_ns", op->p999_ns);
+		add_assoc_long(entry, "max_ns", op->max_ns);
+		add_assoc_long(entry, "round_trips", op->round_trips);
+		add_assoc_long(entry, "max_round_trips", op->max_round_trips);
+		add_next_index_zval(ops, entry);
+	}
+
+	add_assoc_zval(return_value, "ops", ops);
+
+	smbcw_free_stats(&stats);
+}
+
+PHP_FUNCTION(smb_roundtrips)
+{
+	smbcw_stats stats;
+	uint64_t calls[SMBCW_OP_COUNT] = {0};
+	uint64_t round_trips[SMBCW_OP_COUNT] = {0};
+	uint64_t max[SMBCW_OP_COUNT] = {0};
+	const char *names[SMBCW_OP_COUNT] = {NULL};
+	int i;
+
+	if (smbcw_get_stats(&stats) < 0) {
+		RETURN_FALSE;
+	}
+
+	//Sum up the entries of all hosts
+	for (i = 0; i < stats.op_count; i++)
+	{
+		smbcw_op_stats *op = &stats.ops[i];
+
+		names[op->op] = op->name;
+		calls[op->op] += op->count;
+		round_trips[op->op] += op->round_trips;
+		if (op->max_round_trips > max[op->op])
+			max[op->op] = op->max_round_trips;
+	}
+
+	array_init(return_value);
+
+	for (i = 0; i < SMBCW_OP_COUNT; i++)
+	{
+		zval *entry;
+
+		if (!names[i])
+			continue;
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_long(entry, "calls", calls[i]);
+		add_assoc_long(entry, "round_trips", round_trips[i]);
+		add_assoc_double(entry, "per_call", (double)round_trips[i] / calls[i]);
+		add_assoc_long(entry, "max", max[i]);
+		add_assoc_zval(return_value, (char*)names[i], entry);
+	}
+
+	smbcw_free_stats(&stats);
+}
+
+/**
+ * Prints the counters and latencies of smbcw_get_stats in the phpinfo() output
+ */
+static void php_smb_info_stats()
+{
+	smbcw_stats stats;
+	char buf[8][48];
+	int i;
+
+	if (smbcw_get_stats(&stats) < 0)
+		return;
+
+	php_info_print_table_start();
+	php_info_print_table_header(2, "SMB statistics", "Value");
+	snprintf(buf[0], sizeof(buf[0]), "%llu", (unsigned long long)stats.bytes_read);
+	php_info_print_table_row(2, "Bytes read", buf[0]);
+	snprintf(buf[0], sizeof(buf[0]), "%llu", (unsigned long long)stats.bytes_written);
+	php_info_print_table_row(2, "Bytes written", buf[0]);
+	snprintf(buf[0], sizeof(buf[0]), "%llu / %llu", (unsigned long long)stats.conn_hits,
+		(unsigned long long)stats.conn_misses);
+	php_info_print_table_row(2, "Connection hits / misses", buf[0]);
+	snprintf(buf[0], sizeof(buf[0]), "%llu",
+		(unsigned long long)stats.descriptors_open);
+	php_info_print_table_row(2, "Descriptors open", buf[0]);
+	snprintf(buf[0], sizeof(buf[0]), "%llu", (unsigned long long)stats.contexts_alive);
+	php_info_print_table_row(2, "Contexts alive", buf[0]);
+	php_info_print_table_end();
+
+	if (stats.op_count > 0)
+	{
+		php_info_print_table_start();
+		php_info_print_table_header(10, "Operation", "Host", "Calls", "Errors",
+			"Round trips", "Mean (us)", "p50 (us)", "p99 (us)", "p99.9 (us)",
+			"Max (us)");
+
+		for (i = 0; i < stats.op_count; i++)
+		{
+			smbcw_op_stats *op = &stats.ops[i];
+
+			snprintf(buf[0], sizeof(buf[0]), "%llu", (unsigned long long)op->count);
+			snprintf(buf[1], sizeof(buf[0]), "%llu", (unsigned long long)op->errors);
+			snprintf(buf[2], sizeof(buf[0]), "%.1f", op->total_ns / 1000.0 / op->count);
+			snprintf(buf[3], sizeof(buf[0]), "%.1f", op->p50_ns / 1000.0);
+			snprintf(buf[4], sizeof(buf[0]), "%.1f", op->p99_ns / 1000.0);
+			snprintf(buf[5], sizeof(buf[0]), "%.1f", op->p999_ns / 1000.0);
+			snprintf(buf[6], sizeof(buf[0]), "%.1f", op->max_ns / 1000.0);
+			snprintf(buf[7], sizeof(buf[0]), "%.2f",
+				(double)op->round_trips / op->count);
+			php_info_print_table_row(10, op->name, op->host[0] ? op->host : "-",
+				buf[0], buf[1], buf[7], buf[2], buf[3], buf[4], buf[5], buf[6]);
+		}
+
+		php_info_print_table_end();
+	}
+
+	smbcw_free_stats(&stats);
+}
+
+//---- OVERRIDDEN PHP FUNCTIONS ----
+
+typedef void (*php_smb_handler)(INTERNAL_FUNCTION_PARAMETERS);
+
+/* Replaces the handler of the internal PHP function name with handler and stores
+   the original one in orig, so the replacement can call it. */
+static void php_smb_override_function(const char *name, php_smb_handler handler,
+	php_smb_handler *orig TSRMLS_DC)
+{
+	zend_function *func;
+
+	if (zend_hash_find(CG(function_table), (char*)name, strlen(name) + 1,
+			(void **)&func) == SUCCESS && func->type == ZEND_INTERNAL_FUNCTION)
+	{
+		*orig = func->internal_function.handler;
+		func->internal_function.handler = handler;
+	}
+}
+
+/* Restores a handler replaced by php_smb_override_function */
+static void php_smb_restore_function(const char *name, php_smb_handler *orig TSRMLS_DC)
+{
+	zend_function *func;
+
+	if (*orig && zend_hash_find(CG(function_table), (char*)name, strlen(name) + 1,
+			(void **)&func) == SUCCESS)
+	{
+		func->internal_function.handler = *orig;
+		*orig = NULL;
+	}
+}
+
+static php_smb_handler php_smb_orig_clearstatcache = NULL;
+
+/* clearstatcache() does not notify stream wrappers, so smbcw's metadata cache is
+   flushed here before PHP's own stat cache */
+static PHP_FUNCTION(smb_clearstatcache)
+{
+	smbcw_clear_stat_cache();
+	php_smb_orig_clearstatcache(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+}
+
+/* Returns whether url is handled by this wrapper */
+static int php_smb_is_url(const char *url)
+{
+	return strncasecmp(url, "smb://", 6) == 0;
+}
+
+/* Returns the smbcw descriptor of stream if it is an smb:// stream, 0 otherwise */
+static int php_smb_stream_fd(php_stream *stream)
+{
+	if (stream && stream->ops == &php_stream_smb_ops)
+		return ((lp_php_smb_data)stream->abstract)->fd;
+
+	return 0;
+}
+
+static php_smb_handler php_smb_orig_copy = NULL;
+
+/* copy() between two smb:// urls lets the server copy the file if possible
+   instead of streaming it through PHP */
+static PHP_FUNCTION(smb_php_copy)
+{
+	char *url_from, *url_to;
+	int url_from_len = 0, url_to_len = 0;
+	zval *zcontext = NULL;
+
+	if (zend_parse_parameters_ex(ZEND_PARSE_PARAMS_QUIET, ZEND_NUM_ARGS() TSRMLS_CC,
+		"ss|r", &url_from, &url_from_len, &url_to, &url_to_len, &zcontext) == SUCCESS &&
+		php_smb_is_url(url_from) && php_smb_is_url(url_to))
+	{
+		/* smbcw_copy refuses directories and copying a file onto itself, which
+		   the checks of copy() skipped here would refuse as well */
+		if (smbcw_copy(url_from, url_to) < 0)
+		{
+			if (smbcw_geterr() == EISDIR)
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"The first argument to copy() function cannot be a directory");
+			else
+				print_last_smb_err();
+			RETURN_FALSE;
+		}
+
+		RETURN_TRUE;
+	}
+
+	php_smb_orig_copy(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+}
+
+static php_smb_handler php_smb_orig_stream_copy_to_stream = NULL;
+
+/* stream_copy_to_stream() between two smb:// streams, see smb_php_copy */
+static PHP_FUNCTION(smb_stream_copy_to_stream)
+{
+	zval *zsrc, *zdest;
+	long maxlen = PHP_STREAM_COPY_ALL, pos = 0;
+	php_stream *src = NULL, *dest = NULL;
+
+	if (zend_parse_parameters_ex(ZEND_PARSE_PARAMS_QUIET, ZEND_NUM_ARGS() TSRMLS_CC,
+		"rr|ll", &zsrc, &zdest, &maxlen, &pos) == SUCCESS)
+	{
+		php_stream_from_zval_no_verify(src, &zsrc);
+		php_stream_from_zval_no_verify(dest, &zdest);
+	}
+
+	/* Filters have to see the data, so those streams take the usual way */
+	if (php_smb_stream_fd(src) > 0 && php_smb_stream_fd(dest) > 0 &&
+		!src->readfilters.head && !dest->writefilters.head)
+	{
+		if (pos > 0 && php_stream_seek(src, pos, SEEK_SET) < 0)
+		{
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Failed to seek to position %ld in the stream", pos);
+			RETURN_FALSE;
+		}
+
+		/* Data PHP has already read from src has to be copied by PHP */
+		if (src->writepos == src->readpos)
+		{
+			php_stream_flush(dest);
+
+			int64_t ret = smbcw_fcopy(php_smb_stream_fd(src), php_smb_stream_fd(dest),
+				maxlen < 0 ? -1 : maxlen);
+
+			if (ret < 0)
+			{
+				print_last_smb_err();
+				RETURN_FALSE;
+			}
+
+			/* Tell PHP where the streams are now */
+			src->position += ret;
+			dest->position += ret;
+			if (maxlen < 0 || ret < maxlen)
+				src->eof = 1;
+
+			RETURN_LONG(ret);
+		}
+	}
+
+	php_smb_orig_stream_copy_to_stream(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+}
+
 PHP_MINIT_FUNCTION(smbcw)
 {
 	//Initialize SMBCW
-	if (smbcw_init() >= 0) 
+	int res = smbcw_init();
+
+	//Apply the ini settings
+	REGISTER_INI_ENTRIES();
+
+	if (res >= 0) 
 	{
 		//Register the smbcw wrapper library
 		php_register_url_stream_wrapper("smb", &php_stream_smb_wrapper TSRMLS_CC);
+
+		php_smb_override_function("clearstatcache", PHP_FN(smb_clearstatcache),
+			&php_smb_orig_clearstatcache TSRMLS_CC);
+		php_smb_override_function("copy", PHP_FN(smb_php_copy),
+			&php_smb_orig_copy TSRMLS_CC);
+		php_smb_override_function("stream_copy_to_stream",
+			PHP_FN(smb_stream_copy_to_stream),
+			&php_smb_orig_stream_copy_to_stream TSRMLS_CC);
 	}
 
 	return SUCCESS;
@@ -385,19 +1511,66 @@ PHP_MINIT_FUNCTION(smbcw)
 
 PHP_MSHUTDOWN_FUNCTION(smbcw)
 {
+	php_smb_restore_function("clearstatcache", &php_smb_orig_clearstatcache TSRMLS_CC);
+	php_smb_restore_function("copy", &php_smb_orig_copy TSRMLS_CC);
+	php_smb_restore_function("stream_copy_to_stream",
+		&php_smb_orig_stream_copy_to_stream TSRMLS_CC);
+
 	//Finalize smbcw
 	smbcw_finalize();
 
+	smbcw_set_roundtrip_log(-1);
+	if (smbcw_roundtrip_log >= 0)
+		close(smbcw_roundtrip_log);
+	smbcw_roundtrip_log = -1;
+
+	smbcw_set_slow_log(-1);
+	if (smbcw_slow_log >= 0)
+		close(smbcw_slow_log);
+	smbcw_slow_log = -1;
+
+	UNREGISTER_INI_ENTRIES();
+
 	//Unregister the SMBCW wrapper library
 	php_unregister_url_stream_wrapper("smb" TSRMLS_CC);	
 
 	return SUCCESS;
 }
 
+PHP_RSHUTDOWN_FUNCTION(smbcw)
+{
+	smbcw_async_queue *queue = SMBCW_G(async_queue);
+	int i;
+
+	if (queue)
+	{
+		/* The buffers of the requests in flight are still written to */
+		while (smbcw_async_pending(queue) && php_smb_async_fetch(-1 TSRMLS_CC));
+
+		for (i = 0; i < SMBCW_G(async_done_count); i++)
+			php_smb_async_op_free(SMBCW_G(async_done)[i].priv);
+
+		/* Closes the descriptors the script left open */
+		smbcw_async_destroy(queue);
+		SMBCW_G(async_queue) = NULL;
+	}
+
+	free(SMBCW_G(async_done));
+	SMBCW_G(async_done) = NULL;
+	SMBCW_G(async_done_count) = 0;
+	SMBCW_G(async_done_size) = 0;
+
+	return SUCCESS;
+}
+
 PHP_MINFO_FUNCTION(smbcw)
 {
         php_info_print_table_start();
         php_info_print_table_row(2, "SMBCW_WRAPPER Support", "Enabled");
         php_info_print_table_end();
+
+        php_smb_info_stats();
+
+        DISPLAY_INI_ENTRIES();
 }
 